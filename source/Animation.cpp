@@ -0,0 +1,1008 @@
+#include "Animation.h"
+#include "SimdLanes.h"
+#include "TaskPool.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+static const unsigned int INSTANCE_BATCH_SIZE = 16;
+
+// Keys stepped over from the cursor before falling back to a binary search
+static const unsigned int KEY_CURSOR_STEP_COUNT = 4;
+
+// Packed keys, see CMesh::SAnimation. The three smallest components of a unit quaternion lie within +-1 / sqrt( 2 ),
+// and an even number of steps across that range keeps zero exact.
+static const unsigned int ROTATION_COMPONENT_MASK = ( 1 << 15 ) - 1;
+static const unsigned int ROTATION_COMPONENT_MAX = ( 1 << 15 ) - 2;
+static const float ROTATION_COMPONENT_RANGE = 0.70710678f;
+static const float VECTOR_COMPONENT_MAX = 65535.0f;
+
+// Rotation keys whose quaternions are at least this close, 16 degrees apart, are nlerped, which stays within about
+// 1e-4 radians of slerp. Keys further apart are slerped.
+static const float NLERP_MIN_COS_ANGLE = 0.99f;
+
+static EAnimationSampler g_AnimationSampler = ANIMATION_SAMPLER_NLERP;
+
+EAnimationSampler GetAnimationSampler()
+{
+    return g_AnimationSampler;
+}
+
+void SetAnimationSampler( EAnimationSampler sampler )
+{
+    g_AnimationSampler = sampler;
+}
+
+const char* GetAnimationSamplerName( EAnimationSampler sampler )
+{
+    static const char* ANIMATION_SAMPLER_NAMES[ ANIMATION_SAMPLER_COUNT ] = { "slerp", "nlerp" };
+    return ANIMATION_SAMPLER_NAMES[ sampler ];
+}
+
+unsigned int CalculateKeyCursorCount( const CMesh* mesh )
+{
+    unsigned int channel_count = 0;
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        channel_count = std::max( channel_count, mesh->Animations[ i ].ChannelCount );
+    }
+    return channel_count * KEY_CURSORS_PER_CHANNEL;
+}
+
+// Finds the key the time lies after, which is the first key whose next time is not before the time, or the last
+// key. This is the key the linear search from the first key used to find. The cursor holds the key of the previous
+// call and is checked first together with the few keys after it, so playing forward takes constant time. Seeks,
+// loop wrap-around and cursors of another animation fall back to a binary search.
+unsigned int FindKey( const double* frame_times, const uint16_t* key_frames, unsigned int key_count, double animation_time, unsigned int* cursor )
+{
+    unsigned int index = *cursor;
+    if ( index < key_count && ( index == 0 || animation_time > frame_times[ key_frames[ index ] ] ) )
+    {
+        for ( unsigned int i = 0; i < KEY_CURSOR_STEP_COUNT && index + 1 < key_count && animation_time > frame_times[ key_frames[ index + 1 ] ]; ++i )
+        {
+            ++index;
+        }
+        if ( index + 1 == key_count || animation_time <= frame_times[ key_frames[ index + 1 ] ] )
+        {
+            *cursor = index;
+            return index;
+        }
+    }
+
+    index = static_cast< unsigned int >( std::lower_bound( key_frames + 1, key_frames + key_count, animation_time, [ frame_times ]( uint16_t frame, double time )
+    {
+        return frame_times[ frame ] < time;
+    } ) - ( key_frames + 1 ) );
+    *cursor = index;
+    return index;
+}
+
+DirectX::XMVECTOR DecodeVector( const CMesh::SAnimation::STrack& track, const uint16_t* key )
+{
+    const DirectX::XMVECTOR words = DirectX::XMVectorSet( static_cast< float >( key[ 0 ] ), static_cast< float >( key[ 1 ] ), static_cast< float >( key[ 2 ] ), 0.0f );
+    return DirectX::XMVectorMultiplyAdd( words, DirectX::XMLoadFloat3( &track.Step ), DirectX::XMLoadFloat3( &track.Minimum ) );
+}
+
+// The top two bits of the 48 hold the index of the largest component, which is positive and follows from the
+// others since the quaternion has unit length
+DirectX::XMVECTOR DecodeRotation( const uint16_t* key )
+{
+    const uint64_t bits = static_cast< uint64_t >( key[ 0 ] ) | ( static_cast< uint64_t >( key[ 1 ] ) << 16 ) | ( static_cast< uint64_t >( key[ 2 ] ) << 32 );
+    const unsigned int largest_index = static_cast< unsigned int >( bits >> 45 );
+
+    float components[ 4 ];
+    float sum_of_squares = 0.0f;
+    for ( unsigned int i = 0, j = 0; i < 4; ++i )
+    {
+        if ( i == largest_index )
+            continue;
+        const unsigned int word = static_cast< unsigned int >( bits >> ( 30 - 15 * j++ ) ) & ROTATION_COMPONENT_MASK;
+        components[ i ] = ( static_cast< float >( word ) * ( 2.0f / ROTATION_COMPONENT_MAX ) - 1.0f ) * ROTATION_COMPONENT_RANGE;
+        sum_of_squares += components[ i ] * components[ i ];
+    }
+    components[ largest_index ] = sqrtf( std::max( 1.0f - sum_of_squares, 0.0f ) );
+    return DirectX::XMVectorSet( components[ 0 ], components[ 1 ], components[ 2 ], components[ 3 ] );
+}
+
+// Finds the keys of the track around the time and how far the time lies between them
+void FindTrackKeys( const CMesh::SAnimation& animation, const CMesh::SAnimation::STrack& track, double animation_time, unsigned int* cursor, const uint16_t** curr_key, const uint16_t** next_key, float* t )
+{
+    const uint16_t* key_frames = animation.KeyFrames + track.KeyOffset;
+    const unsigned int curr_index = FindKey( animation.FrameTimes, key_frames, track.KeyCount, animation_time, cursor );
+    const unsigned int next_index = std::min( curr_index + 1, track.KeyCount - 1 );
+
+    const double curr_time = animation.FrameTimes[ key_frames[ curr_index ] ];
+    const double next_time = animation.FrameTimes[ key_frames[ next_index ] ];
+    *curr_key = animation.Keys + ( track.KeyOffset + curr_index ) * 3;
+    *next_key = animation.Keys + ( track.KeyOffset + next_index ) * 3;
+    *t = next_index != curr_index ? static_cast< float >( ( animation_time - curr_time ) / ( next_time - curr_time ) ) : 0.0f;
+}
+
+// The cursors are the scaling, rotation and translation cursor of the channel
+void SampleChannel( const CMesh::SAnimation& animation, unsigned int channel_index, double animation_time, unsigned int* key_cursors, DirectX::XMVECTOR* scaling, DirectX::XMVECTOR* rotation, DirectX::XMVECTOR* translation )
+{
+    // Without cursors every key is found with a binary search
+    unsigned int search_cursors[ KEY_CURSORS_PER_CHANNEL ] = {};
+    if ( key_cursors == nullptr )
+    {
+        key_cursors = search_cursors;
+    }
+
+    const CMesh::SAnimation::SChannel& channel = animation.Channels[ channel_index ];
+    const uint16_t* curr_key;
+    const uint16_t* next_key;
+    float t;
+
+    if ( channel.Scaling.KeyCount == 1 )
+    {
+        *scaling = DecodeVector( channel.Scaling, animation.Keys + channel.Scaling.KeyOffset * 3 );
+    }
+    else
+    {
+        FindTrackKeys( animation, channel.Scaling, animation_time, &key_cursors[ 0 ], &curr_key, &next_key, &t );
+        *scaling = DirectX::XMVectorLerp( DecodeVector( channel.Scaling, curr_key ), DecodeVector( channel.Scaling, next_key ), t );
+    }
+
+    if ( channel.Rotation.KeyCount == 1 )
+    {
+        *rotation = DecodeRotation( animation.Keys + channel.Rotation.KeyOffset * 3 );
+    }
+    else
+    {
+        FindTrackKeys( animation, channel.Rotation, animation_time, &key_cursors[ 1 ], &curr_key, &next_key, &t );
+        *rotation = DirectX::XMQuaternionNormalize( DirectX::XMQuaternionSlerp( DecodeRotation( curr_key ), DecodeRotation( next_key ), t ) );
+    }
+
+    if ( channel.Translation.KeyCount == 1 )
+    {
+        *translation = DecodeVector( channel.Translation, animation.Keys + channel.Translation.KeyOffset * 3 );
+    }
+    else
+    {
+        FindTrackKeys( animation, channel.Translation, animation_time, &key_cursors[ 2 ], &curr_key, &next_key, &t );
+        *translation = DirectX::XMVectorLerp( DecodeVector( channel.Translation, curr_key ), DecodeVector( channel.Translation, next_key ), t );
+    }
+}
+
+// Keeps the keys of a track whose neighbours do not reproduce them, splitting at the worst key until every dropped
+// key is within the tolerance of the interpolation between the kept keys around it. Returns the new key count.
+template< typename TKey, typename TLoad, typename TInterpolate, typename TError >
+unsigned int ReduceTrack( double* timestamps, TKey* keys, unsigned int key_count, float tolerance, TLoad load, TInterpolate interpolate, TError error, double* max_error )
+{
+    if ( key_count < 2 )
+        return key_count;
+
+    // A track within the tolerance of its first key everywhere becomes constant
+    const DirectX::XMVECTOR first_key = load( keys[ 0 ] );
+    float constant_error = 0.0f;
+    for ( unsigned int i = 1; i < key_count && constant_error <= tolerance; ++i )
+    {
+        constant_error = std::max( constant_error, error( load( keys[ i ] ), first_key ) );
+    }
+    if ( constant_error <= tolerance )
+    {
+        *max_error = std::max( *max_error, static_cast< double >( constant_error ) );
+        return 1;
+    }
+
+    std::vector<uint8_t> is_kept( key_count, 0 );
+    is_kept[ 0 ] = 1;
+    is_kept[ key_count - 1 ] = 1;
+
+    std::vector< std::pair<unsigned int, unsigned int> > segments;
+    segments.push_back( std::make_pair( 0u, key_count - 1 ) );
+    while ( !segments.empty() )
+    {
+        const unsigned int begin = segments.back().first;
+        const unsigned int end = segments.back().second;
+        segments.pop_back();
+
+        // Interpolates the way SampleChannel does
+        const DirectX::XMVECTOR begin_key = load( keys[ begin ] );
+        const DirectX::XMVECTOR end_key = load( keys[ end ] );
+        float segment_error = 0.0f;
+        unsigned int worst_index = begin;
+        for ( unsigned int i = begin + 1; i < end; ++i )
+        {
+            const float t = static_cast< float >( ( timestamps[ i ] - timestamps[ begin ] ) / ( timestamps[ end ] - timestamps[ begin ] ) );
+            const float key_error = error( load( keys[ i ] ), interpolate( begin_key, end_key, t ) );
+            if ( key_error > segment_error )
+            {
+                segment_error = key_error;
+                worst_index = i;
+            }
+        }
+
+        if ( segment_error <= tolerance )
+        {
+            *max_error = std::max( *max_error, static_cast< double >( segment_error ) );
+            continue;
+        }
+        is_kept[ worst_index ] = 1;
+        segments.push_back( std::make_pair( begin, worst_index ) );
+        segments.push_back( std::make_pair( worst_index, end ) );
+    }
+
+    unsigned int kept_key_count = 0;
+    for ( unsigned int i = 0; i < key_count; ++i )
+    {
+        if ( is_kept[ i ] )
+        {
+            timestamps[ kept_key_count ] = timestamps[ i ];
+            keys[ kept_key_count ] = keys[ i ];
+            ++kept_key_count;
+        }
+    }
+    return kept_key_count;
+}
+
+void ReduceChannel( SAnimationKeys::SChannel& channel, float tolerance, SKeyReductionReport* report )
+{
+    const size_t key_count = channel.TranslationKeys.size() + channel.RotationKeys.size() + channel.ScalingKeys.size();
+    const size_t key_bytes = channel.TranslationKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT3 ) ) +
+                             channel.RotationKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT4 ) ) +
+                             channel.ScalingKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT3 ) );
+
+    const float parent_scale = channel.ParentScale;
+    const float reach_distance = channel.Reach;
+    auto load_float3 = []( const DirectX::XMFLOAT3& key ) { return DirectX::XMLoadFloat3( &key ); };
+    auto load_float4 = []( const DirectX::XMFLOAT4& key ) { return DirectX::XMLoadFloat4( &key ); };
+    auto lerp = []( DirectX::XMVECTOR a, DirectX::XMVECTOR b, float t ) { return DirectX::XMVectorLerp( a, b, t ); };
+    auto slerp = []( DirectX::XMVECTOR a, DirectX::XMVECTOR b, float t ) { return DirectX::XMQuaternionNormalize( DirectX::XMQuaternionSlerp( a, b, t ) ); };
+
+    unsigned int kept_key_count = ReduceTrack( channel.TranslationKeyTimestamps.data(), channel.TranslationKeys.data(), static_cast< unsigned int >( channel.TranslationKeys.size() ), tolerance, load_float3, lerp,
+        [ parent_scale ]( DirectX::XMVECTOR key, DirectX::XMVECTOR approximation )
+        {
+            return DirectX::XMVectorGetX( DirectX::XMVector3Length( DirectX::XMVectorSubtract( key, approximation ) ) ) * parent_scale;
+        }, &report->MaxError );
+    channel.TranslationKeyTimestamps.resize( kept_key_count );
+    channel.TranslationKeys.resize( kept_key_count );
+
+    // A rotation by angle a moves a joint at distance r by the chord 2 r sin( a / 2 ), which is 2 r sqrt( 1 - d^2 )
+    // for the absolute dot product d of the two unit quaternions
+    kept_key_count = ReduceTrack( channel.RotationKeyTimestamps.data(), channel.RotationKeys.data(), static_cast< unsigned int >( channel.RotationKeys.size() ), tolerance, load_float4, slerp,
+        [ reach_distance ]( DirectX::XMVECTOR key, DirectX::XMVECTOR approximation )
+        {
+            const float d = fabsf( DirectX::XMVectorGetX( DirectX::XMVector4Dot( DirectX::XMQuaternionNormalize( key ), DirectX::XMQuaternionNormalize( approximation ) ) ) );
+            return 2.0f * reach_distance * sqrtf( std::max( 1.0f - d * d, 0.0f ) );
+        }, &report->MaxError );
+    channel.RotationKeyTimestamps.resize( kept_key_count );
+    channel.RotationKeys.resize( kept_key_count );
+
+    kept_key_count = ReduceTrack( channel.ScalingKeyTimestamps.data(), channel.ScalingKeys.data(), static_cast< unsigned int >( channel.ScalingKeys.size() ), tolerance, load_float3, lerp,
+        [ reach_distance ]( DirectX::XMVECTOR key, DirectX::XMVECTOR approximation )
+        {
+            const DirectX::XMVECTOR relative_error = DirectX::XMVectorDivide( DirectX::XMVectorAbs( DirectX::XMVectorSubtract( key, approximation ) ),
+                                                                              DirectX::XMVectorMax( DirectX::XMVectorAbs( key ), DirectX::XMVectorReplicate( 1e-6f ) ) );
+            return std::max( std::max( DirectX::XMVectorGetX( relative_error ), DirectX::XMVectorGetY( relative_error ) ), DirectX::XMVectorGetZ( relative_error ) ) * reach_distance;
+        }, &report->MaxError );
+    channel.ScalingKeyTimestamps.resize( kept_key_count );
+    channel.ScalingKeys.resize( kept_key_count );
+
+    const size_t kept_keys = channel.TranslationKeys.size() + channel.RotationKeys.size() + channel.ScalingKeys.size();
+    const size_t kept_key_bytes = channel.TranslationKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT3 ) ) +
+                                  channel.RotationKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT4 ) ) +
+                                  channel.ScalingKeys.size() * ( sizeof( double ) + sizeof( DirectX::XMFLOAT3 ) );
+    report->ImportedKeyCount += static_cast< unsigned int >( key_count );
+    report->KeptKeyCount += static_cast< unsigned int >( kept_keys );
+    report->SavedBytes += key_bytes - kept_key_bytes;
+}
+
+void ReduceAnimationKeys( SAnimationKeys* animation_keys, unsigned int animation_count, float tolerance, CTaskPool* task_pool, SKeyReductionReport* report )
+{
+    std::vector<SKeyReductionReport> animation_reports( animation_count );
+    STaskCounter task_counter;
+    for ( unsigned int i = 0; i < animation_count; ++i )
+    {
+        SubmitTask( task_pool, &task_counter, [ animation_keys, i, tolerance, &animation_reports ]()
+        {
+            SKeyReductionReport& animation_report = animation_reports[ i ];
+            animation_report = SKeyReductionReport();
+            for ( SAnimationKeys::SChannel& channel : animation_keys[ i ].Channels )
+            {
+                if ( channel.Reach >= 0.0f )
+                {
+                    ReduceChannel( channel, tolerance, &animation_report );
+                }
+                else
+                {
+                    const size_t key_count = channel.TranslationKeys.size() + channel.RotationKeys.size() + channel.ScalingKeys.size();
+                    animation_report.ImportedKeyCount += static_cast< unsigned int >( key_count );
+                    animation_report.KeptKeyCount += static_cast< unsigned int >( key_count );
+                }
+            }
+        } );
+    }
+    WaitForTasks( task_pool, &task_counter );
+
+    *report = SKeyReductionReport();
+    report->Tolerance = tolerance;
+    for ( const SKeyReductionReport& animation_report : animation_reports )
+    {
+        report->ImportedKeyCount += animation_report.ImportedKeyCount;
+        report->KeptKeyCount += animation_report.KeptKeyCount;
+        report->SavedBytes += animation_report.SavedBytes;
+        report->MaxError = std::max( report->MaxError, animation_report.MaxError );
+    }
+}
+
+// The distinct key times of every track of the animation in increasing order
+void CollectFrameTimes( const SAnimationKeys& animation_keys, std::vector<double>& frame_times )
+{
+    frame_times.clear();
+    for ( const SAnimationKeys::SChannel& channel : animation_keys.Channels )
+    {
+        frame_times.insert( frame_times.end(), channel.TranslationKeyTimestamps.begin(), channel.TranslationKeyTimestamps.end() );
+        frame_times.insert( frame_times.end(), channel.RotationKeyTimestamps.begin(), channel.RotationKeyTimestamps.end() );
+        frame_times.insert( frame_times.end(), channel.ScalingKeyTimestamps.begin(), channel.ScalingKeyTimestamps.end() );
+    }
+    std::sort( frame_times.begin(), frame_times.end() );
+    frame_times.erase( std::unique( frame_times.begin(), frame_times.end() ), frame_times.end() );
+}
+
+unsigned int CountAnimationFrames( const SAnimationKeys& animation_keys )
+{
+    std::vector<double> frame_times;
+    CollectFrameTimes( animation_keys, frame_times );
+    return static_cast< unsigned int >( frame_times.size() );
+}
+
+size_t CountKeys( const SAnimationKeys& animation_keys )
+{
+    size_t key_count = 0;
+    for ( const SAnimationKeys::SChannel& channel : animation_keys.Channels )
+    {
+        key_count += channel.TranslationKeys.size() + channel.RotationKeys.size() + channel.ScalingKeys.size();
+    }
+    return key_count;
+}
+
+// The frame times come first, so the block needs no more than their alignment
+size_t CalculateAnimationClipSize( const SAnimationKeys& animation_keys )
+{
+    std::vector<double> frame_times;
+    CollectFrameTimes( animation_keys, frame_times );
+    return frame_times.size() * sizeof( double ) + animation_keys.Channels.size() * sizeof( CMesh::SAnimation::SChannel ) + CountKeys( animation_keys ) * 4 * sizeof( uint16_t );
+}
+
+void PackFrames( const std::vector<double>& frame_times, const std::vector<double>& timestamps, uint16_t* key_frames )
+{
+    for ( size_t i = 0; i < timestamps.size(); ++i )
+    {
+        key_frames[ i ] = static_cast< uint16_t >( std::lower_bound( frame_times.begin(), frame_times.end(), timestamps[ i ] ) - frame_times.begin() );
+    }
+}
+
+void PackVectors( const std::vector<DirectX::XMFLOAT3>& vectors, CMesh::SAnimation::STrack& track, uint16_t* keys )
+{
+    DirectX::XMVECTOR minimum = DirectX::XMLoadFloat3( &vectors[ 0 ] );
+    DirectX::XMVECTOR maximum = minimum;
+    for ( const DirectX::XMFLOAT3& vector : vectors )
+    {
+        minimum = DirectX::XMVectorMin( minimum, DirectX::XMLoadFloat3( &vector ) );
+        maximum = DirectX::XMVectorMax( maximum, DirectX::XMLoadFloat3( &vector ) );
+    }
+    const DirectX::XMVECTOR step = DirectX::XMVectorScale( DirectX::XMVectorSubtract( maximum, minimum ), 1.0f / VECTOR_COMPONENT_MAX );
+    DirectX::XMStoreFloat3( &track.Minimum, minimum );
+    DirectX::XMStoreFloat3( &track.Step, step );
+
+    // Components that never change have a zero step and pack to zeros
+    const float* minimum_components = &track.Minimum.x;
+    const float* step_components = &track.Step.x;
+    for ( size_t i = 0; i < vectors.size(); ++i )
+    {
+        const float* components = &vectors[ i ].x;
+        for ( unsigned int c = 0; c < 3; ++c )
+        {
+            const float word = step_components[ c ] > 0.0f ? floorf( ( components[ c ] - minimum_components[ c ] ) / step_components[ c ] + 0.5f ) : 0.0f;
+            keys[ i * 3 + c ] = static_cast< uint16_t >( std::min( std::max( word, 0.0f ), VECTOR_COMPONENT_MAX ) );
+        }
+    }
+}
+
+void PackRotations( const std::vector<DirectX::XMFLOAT4>& rotations, uint16_t* keys )
+{
+    for ( size_t i = 0; i < rotations.size(); ++i )
+    {
+        DirectX::XMFLOAT4 rotation;
+        DirectX::XMStoreFloat4( &rotation, DirectX::XMQuaternionNormalize( DirectX::XMLoadFloat4( &rotations[ i ] ) ) );
+        const float* components = &rotation.x;
+
+        unsigned int largest_index = 0;
+        for ( unsigned int c = 1; c < 4; ++c )
+        {
+            largest_index = fabsf( components[ c ] ) > fabsf( components[ largest_index ] ) ? c : largest_index;
+        }
+
+        // q and -q are the same rotation, so the largest component can always be positive
+        const float sign = components[ largest_index ] < 0.0f ? -1.0f : 1.0f;
+        uint64_t bits = static_cast< uint64_t >( largest_index ) << 45;
+        for ( unsigned int c = 0, j = 0; c < 4; ++c )
+        {
+            if ( c == largest_index )
+                continue;
+            const float component = std::min( std::max( sign * components[ c ] / ROTATION_COMPONENT_RANGE, -1.0f ), 1.0f );
+            const uint64_t word = static_cast< uint64_t >( floorf( ( component + 1.0f ) * ( 0.5f * ROTATION_COMPONENT_MAX ) + 0.5f ) );
+            bits |= word << ( 30 - 15 * j++ );
+        }
+
+        keys[ i * 3 + 0 ] = static_cast< uint16_t >( bits );
+        keys[ i * 3 + 1 ] = static_cast< uint16_t >( bits >> 16 );
+        keys[ i * 3 + 2 ] = static_cast< uint16_t >( bits >> 32 );
+    }
+}
+
+bool PackAnimationClip( const SAnimationKeys& animation_keys, void* data, CMesh::SAnimation* animation )
+{
+    assert( ( reinterpret_cast< uintptr_t >( data ) & ( sizeof( double ) - 1 ) ) == 0 );
+
+    std::vector<double> frame_times;
+    CollectFrameTimes( animation_keys, frame_times );
+    if ( frame_times.size() > MAX_ANIMATION_FRAME_COUNT )
+        return false;
+
+    animation->ChannelCount = static_cast< unsigned int >( animation_keys.Channels.size() );
+    animation->FrameCount = static_cast< unsigned int >( frame_times.size() );
+    animation->KeyCount = static_cast< unsigned int >( CountKeys( animation_keys ) );
+    animation->FrameTimes = static_cast< double* >( data );
+    animation->Channels = reinterpret_cast< CMesh::SAnimation::SChannel* >( animation->FrameTimes + animation->FrameCount );
+    animation->KeyFrames = reinterpret_cast< uint16_t* >( animation->Channels + animation->ChannelCount );
+    animation->Keys = animation->KeyFrames + animation->KeyCount;
+    animation->TicksPerSecond = animation_keys.TicksPerSecond;
+    animation->Duration = animation_keys.Duration;
+
+    std::copy( frame_times.begin(), frame_times.end(), animation->FrameTimes );
+
+    // Every track takes the next keys, in translation, rotation, scaling order
+    unsigned int key_offset = 0;
+    auto begin_track = [ &key_offset ]( CMesh::SAnimation::STrack& track, size_t key_count )
+    {
+        assert( key_count > 0 );
+        track.KeyCount = static_cast< unsigned int >( key_count );
+        track.KeyOffset = key_offset;
+        track.Minimum = DirectX::XMFLOAT3( 0.0f, 0.0f, 0.0f );
+        track.Step = DirectX::XMFLOAT3( 0.0f, 0.0f, 0.0f );
+        key_offset += track.KeyCount;
+    };
+
+    for ( unsigned int i = 0; i < animation->ChannelCount; ++i )
+    {
+        const SAnimationKeys::SChannel& channel_keys = animation_keys.Channels[ i ];
+        CMesh::SAnimation::SChannel& channel = animation->Channels[ i ];
+
+        begin_track( channel.Translation, channel_keys.TranslationKeys.size() );
+        PackFrames( frame_times, channel_keys.TranslationKeyTimestamps, animation->KeyFrames + channel.Translation.KeyOffset );
+        PackVectors( channel_keys.TranslationKeys, channel.Translation, animation->Keys + channel.Translation.KeyOffset * 3 );
+
+        begin_track( channel.Rotation, channel_keys.RotationKeys.size() );
+        PackFrames( frame_times, channel_keys.RotationKeyTimestamps, animation->KeyFrames + channel.Rotation.KeyOffset );
+        PackRotations( channel_keys.RotationKeys, animation->Keys + channel.Rotation.KeyOffset * 3 );
+
+        begin_track( channel.Scaling, channel_keys.ScalingKeys.size() );
+        PackFrames( frame_times, channel_keys.ScalingKeyTimestamps, animation->KeyFrames + channel.Scaling.KeyOffset );
+        PackVectors( channel_keys.ScalingKeys, channel.Scaling, animation->Keys + channel.Scaling.KeyOffset * 3 );
+    }
+    assert( key_offset == animation->KeyCount );
+    return true;
+}
+
+void ClassifyStaticNodes( CMesh* mesh )
+{
+    const DirectX::XMMATRIX inverse_root_transformation = DirectX::XMLoadFloat4x4( &mesh->InverseRootTransformation );
+    for ( unsigned int i = 0; i < mesh->NodeCount; ++i )
+    {
+        const unsigned int parent = mesh->NodeParents[ i ];
+        const DirectX::XMMATRIX parent_transformation = parent != INVALID_INDEX ? DirectX::XMLoadFloat4x4( &mesh->StaticNodeTransformations[ parent ] ) : inverse_root_transformation;
+        DirectX::XMStoreFloat4x4( &mesh->StaticNodeTransformations[ i ], DirectX::XMLoadFloat4x4( &mesh->NodeTransformations[ i ] ) * parent_transformation );
+    }
+
+    for ( unsigned int i = 0; i < mesh->BoneCount; ++i )
+    {
+        DirectX::XMStoreFloat4x4( &mesh->StaticBoneTransformations[ i ], DirectX::XMMatrixIdentity() );
+    }
+    for ( unsigned int i = 0; i < mesh->NodeCount; ++i )
+    {
+        const unsigned int bone_index = mesh->NodeBoneIndices[ i ];
+        if ( bone_index != INVALID_INDEX )
+        {
+            const DirectX::XMMATRIX bone_offset = DirectX::XMLoadFloat4x4( &mesh->BoneOffsets[ bone_index ] );
+            DirectX::XMStoreFloat4x4( &mesh->StaticBoneTransformations[ bone_index ], bone_offset * DirectX::XMLoadFloat4x4( &mesh->StaticNodeTransformations[ i ] ) );
+        }
+    }
+
+    // Parents come first, so one pass finds every node below a channel and the position of its parent
+    std::vector<unsigned int> node_positions( mesh->NodeCount );
+    for ( unsigned int a = 0; a < mesh->AnimationCount; ++a )
+    {
+        const unsigned int* animation_channels = mesh->NodeAnimationChannels + a * mesh->NodeCount;
+        unsigned int* animated_nodes = mesh->AnimatedNodes + a * mesh->NodeCount;
+        unsigned int* animated_node_parents = mesh->AnimatedNodeParents + a * mesh->NodeCount;
+        unsigned int* animated_channel_positions = mesh->AnimatedChannelPositions + a * mesh->NodeCount;
+        unsigned int animated_node_count = 0;
+        unsigned int animated_channel_count = 0;
+        for ( unsigned int i = 0; i < mesh->NodeCount; ++i )
+        {
+            const unsigned int parent = mesh->NodeParents[ i ];
+            const unsigned int parent_position = parent != INVALID_INDEX ? node_positions[ parent ] : INVALID_INDEX;
+            if ( animation_channels[ i ] == INVALID_INDEX && parent_position == INVALID_INDEX )
+            {
+                node_positions[ i ] = INVALID_INDEX;
+                continue;
+            }
+
+            if ( animation_channels[ i ] != INVALID_INDEX )
+            {
+                animated_channel_positions[ animated_channel_count++ ] = animated_node_count;
+            }
+            node_positions[ i ] = animated_node_count;
+            animated_nodes[ animated_node_count ] = i;
+            animated_node_parents[ animated_node_count ] = parent_position;
+            ++animated_node_count;
+        }
+        mesh->AnimatedNodeCounts[ a ] = animated_node_count;
+        mesh->AnimatedChannelCounts[ a ] = animated_channel_count;
+        std::fill( animated_nodes + animated_node_count, animated_nodes + mesh->NodeCount, INVALID_INDEX );
+        std::fill( animated_node_parents + animated_node_count, animated_node_parents + mesh->NodeCount, INVALID_INDEX );
+        std::fill( animated_channel_positions + animated_channel_count, animated_channel_positions + mesh->NodeCount, INVALID_INDEX );
+    }
+}
+
+template< typename TLanes >
+struct SAnimationKernel
+{
+    typedef typename TLanes::Vector V;
+    typedef typename TLanes::Mask M;
+
+    struct SVector3
+    {
+        V x, y, z;
+    };
+
+    // The first three columns of a row vector transformation, the last column is always 0, 0, 0, 1
+    struct SAffine
+    {
+        SVector3 Rows[ 4 ];
+    };
+
+    // The channel every lane samples, with the time already wrapped into the animation in ticks. Lanes without an
+    // animation sample the identity.
+    struct SLaneChannels
+    {
+        const CMesh::SAnimation*    Animations[ TLanes::WIDTH ];
+        unsigned int                ChannelIndices[ TLanes::WIDTH ];
+        double                      AnimationTimes[ TLanes::WIDTH ];
+        unsigned int*               KeyCursors[ TLanes::WIDTH ];
+    };
+
+    // The decoded keys of one track around the time of every lane, component by component
+    struct STrackLanes
+    {
+        float                       Curr[ 4 ][ TLanes::WIDTH ];
+        float                       Next[ 4 ][ TLanes::WIDTH ];
+        float                       T[ TLanes::WIDTH ];
+    };
+
+    // What every lane plays, with the time already wrapped into the animation in ticks
+    struct SLaneAnimations
+    {
+        unsigned int                InstanceIndex;
+        unsigned int                AnimationIndices[ TLanes::WIDTH ];
+        const CMesh::SAnimation*    Animations[ TLanes::WIDTH ];
+        double                      AnimationTimes[ TLanes::WIDTH ];
+        unsigned int*               KeyCursors[ TLanes::WIDTH ];
+    };
+
+    static SVector3 Add( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Add( a.x, b.x ), TLanes::Add( a.y, b.y ), TLanes::Add( a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Scale( const SVector3& a, V s )
+    {
+        SVector3 result = { TLanes::Mul( a.x, s ), TLanes::Mul( a.y, s ), TLanes::Mul( a.z, s ) };
+        return result;
+    }
+    static SVector3 Select( M mask, const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Select( mask, a.x, b.x ), TLanes::Select( mask, a.y, b.y ), TLanes::Select( mask, a.z, b.z ) };
+        return result;
+    }
+
+    static SAffine Broadcast( const DirectX::XMFLOAT4X4& m )
+    {
+        SAffine result;
+        for ( unsigned int r = 0; r < 4; ++r )
+        {
+            result.Rows[ r ].x = TLanes::Set( m.m[ r ][ 0 ] );
+            result.Rows[ r ].y = TLanes::Set( m.m[ r ][ 1 ] );
+            result.Rows[ r ].z = TLanes::Set( m.m[ r ][ 2 ] );
+        }
+        return result;
+    }
+    // a * b for row vectors, so a is applied first
+    static SAffine Multiply( const SAffine& a, const SAffine& b )
+    {
+        SAffine result;
+        for ( unsigned int r = 0; r < 4; ++r )
+        {
+            result.Rows[ r ] = Add( Add( Scale( b.Rows[ 0 ], a.Rows[ r ].x ), Scale( b.Rows[ 1 ], a.Rows[ r ].y ) ), Scale( b.Rows[ 2 ], a.Rows[ r ].z ) );
+        }
+        result.Rows[ 3 ] = Add( result.Rows[ 3 ], b.Rows[ 3 ] );
+        return result;
+    }
+    // Lane i goes to transformations[ i ]
+    static void Store( const SAffine& a, DirectX::XMFLOAT4X4* const* transformations )
+    {
+        float elements[ 4 ][ 3 ][ TLanes::WIDTH ];
+        for ( unsigned int r = 0; r < 4; ++r )
+        {
+            TLanes::Store( elements[ r ][ 0 ], a.Rows[ r ].x );
+            TLanes::Store( elements[ r ][ 1 ], a.Rows[ r ].y );
+            TLanes::Store( elements[ r ][ 2 ], a.Rows[ r ].z );
+        }
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            DirectX::XMFLOAT4X4& transformation = *transformations[ i ];
+            for ( unsigned int r = 0; r < 4; ++r )
+            {
+                transformation.m[ r ][ 0 ] = elements[ r ][ 0 ][ i ];
+                transformation.m[ r ][ 1 ] = elements[ r ][ 1 ][ i ];
+                transformation.m[ r ][ 2 ] = elements[ r ][ 2 ][ i ];
+                transformation.m[ r ][ 3 ] = r == 3 ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    static void SetLane( STrackLanes& track_lanes, unsigned int lane, DirectX::FXMVECTOR curr, DirectX::FXMVECTOR next, float t )
+    {
+        DirectX::XMFLOAT4 curr_components, next_components;
+        DirectX::XMStoreFloat4( &curr_components, curr );
+        DirectX::XMStoreFloat4( &next_components, next );
+        track_lanes.Curr[ 0 ][ lane ] = curr_components.x;
+        track_lanes.Curr[ 1 ][ lane ] = curr_components.y;
+        track_lanes.Curr[ 2 ][ lane ] = curr_components.z;
+        track_lanes.Curr[ 3 ][ lane ] = curr_components.w;
+        track_lanes.Next[ 0 ][ lane ] = next_components.x;
+        track_lanes.Next[ 1 ][ lane ] = next_components.y;
+        track_lanes.Next[ 2 ][ lane ] = next_components.z;
+        track_lanes.Next[ 3 ][ lane ] = next_components.w;
+        track_lanes.T[ lane ] = t;
+    }
+
+    static void GatherVector( const CMesh::SAnimation& animation, const CMesh::SAnimation::STrack& track, double animation_time, unsigned int* cursor, unsigned int lane, STrackLanes& track_lanes )
+    {
+        if ( track.KeyCount == 1 )
+        {
+            const DirectX::XMVECTOR vector = DecodeVector( track, animation.Keys + track.KeyOffset * 3 );
+            SetLane( track_lanes, lane, vector, vector, 0.0f );
+            return;
+        }
+
+        const uint16_t* curr_key;
+        const uint16_t* next_key;
+        float t;
+        FindTrackKeys( animation, track, animation_time, cursor, &curr_key, &next_key, &t );
+        SetLane( track_lanes, lane, DecodeVector( track, curr_key ), DecodeVector( track, next_key ), t );
+    }
+
+    // Puts the next key into the hemisphere of the current one. Keys too far apart for nlerp, and every key with the
+    // slerp sampler, are slerped here and leave the lane nothing to interpolate.
+    static void GatherRotation( const CMesh::SAnimation& animation, const CMesh::SAnimation::STrack& track, double animation_time, unsigned int* cursor, EAnimationSampler sampler, unsigned int lane, STrackLanes& track_lanes )
+    {
+        if ( track.KeyCount == 1 )
+        {
+            const DirectX::XMVECTOR rotation = DecodeRotation( animation.Keys + track.KeyOffset * 3 );
+            SetLane( track_lanes, lane, rotation, rotation, 0.0f );
+            return;
+        }
+
+        const uint16_t* curr_key;
+        const uint16_t* next_key;
+        float t;
+        FindTrackKeys( animation, track, animation_time, cursor, &curr_key, &next_key, &t );
+        const DirectX::XMVECTOR curr = DecodeRotation( curr_key );
+        DirectX::XMVECTOR next = DecodeRotation( next_key );
+
+        const float cos_angle = DirectX::XMVectorGetX( DirectX::XMVector4Dot( curr, next ) );
+        if ( sampler == ANIMATION_SAMPLER_SLERP || fabsf( cos_angle ) < NLERP_MIN_COS_ANGLE )
+        {
+            const DirectX::XMVECTOR rotation = DirectX::XMQuaternionNormalize( DirectX::XMQuaternionSlerp( curr, next, t ) );
+            SetLane( track_lanes, lane, rotation, rotation, 0.0f );
+            return;
+        }
+        if ( cos_angle < 0.0f )
+        {
+            next = DirectX::XMVectorNegate( next );
+        }
+        SetLane( track_lanes, lane, curr, next, t );
+    }
+
+    static V Lerp( const STrackLanes& track_lanes, unsigned int component, V t )
+    {
+        V curr = TLanes::Load( track_lanes.Curr[ component ] );
+        return TLanes::Add( curr, TLanes::Mul( TLanes::Sub( TLanes::Load( track_lanes.Next[ component ] ), curr ), t ) );
+    }
+
+    // Gathers the keys of every lane, then interpolates them together and composes scaling * rotation * translation
+    // straight into the affine rows
+    static SAffine SampleChannels( const SLaneChannels& lanes, EAnimationSampler sampler )
+    {
+        STrackLanes scaling, rotation, translation;
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            if ( lanes.Animations[ i ] == nullptr )
+            {
+                SetLane( scaling, i, DirectX::XMVectorSplatOne(), DirectX::XMVectorSplatOne(), 0.0f );
+                SetLane( rotation, i, DirectX::XMQuaternionIdentity(), DirectX::XMQuaternionIdentity(), 0.0f );
+                SetLane( translation, i, DirectX::XMVectorZero(), DirectX::XMVectorZero(), 0.0f );
+                continue;
+            }
+
+            // Without cursors every key is found with a binary search
+            unsigned int search_cursors[ KEY_CURSORS_PER_CHANNEL ] = {};
+            unsigned int* key_cursors = lanes.KeyCursors[ i ] != nullptr ? lanes.KeyCursors[ i ] : search_cursors;
+
+            const CMesh::SAnimation& animation = *lanes.Animations[ i ];
+            const CMesh::SAnimation::SChannel& channel = animation.Channels[ lanes.ChannelIndices[ i ] ];
+            GatherVector( animation, channel.Scaling, lanes.AnimationTimes[ i ], &key_cursors[ 0 ], i, scaling );
+            GatherRotation( animation, channel.Rotation, lanes.AnimationTimes[ i ], &key_cursors[ 1 ], sampler, i, rotation );
+            GatherVector( animation, channel.Translation, lanes.AnimationTimes[ i ], &key_cursors[ 2 ], i, translation );
+        }
+
+        V scaling_t = TLanes::Load( scaling.T );
+        V sx = Lerp( scaling, 0, scaling_t ), sy = Lerp( scaling, 1, scaling_t ), sz = Lerp( scaling, 2, scaling_t );
+
+        V rotation_t = TLanes::Load( rotation.T );
+        V x = Lerp( rotation, 0, rotation_t ), y = Lerp( rotation, 1, rotation_t ), z = Lerp( rotation, 2, rotation_t ), w = Lerp( rotation, 3, rotation_t );
+        V one = TLanes::Set( 1 );
+        V length_squared = TLanes::Add( TLanes::Add( TLanes::Mul( x, x ), TLanes::Mul( y, y ) ), TLanes::Add( TLanes::Mul( z, z ), TLanes::Mul( w, w ) ) );
+
+        // Normalizing through the doubled components also normalizes the rows built from them
+        V two_over_length_squared = TLanes::Div( TLanes::Set( 2 ), length_squared );
+        V x2 = TLanes::Mul( x, two_over_length_squared ), y2 = TLanes::Mul( y, two_over_length_squared ), z2 = TLanes::Mul( z, two_over_length_squared );
+        V xx = TLanes::Mul( x, x2 ), yy = TLanes::Mul( y, y2 ), zz = TLanes::Mul( z, z2 );
+        V xy = TLanes::Mul( x, y2 ), xz = TLanes::Mul( x, z2 ), yz = TLanes::Mul( y, z2 );
+        V wx = TLanes::Mul( w, x2 ), wy = TLanes::Mul( w, y2 ), wz = TLanes::Mul( w, z2 );
+
+        // Rows of the rotation of a row vector, each scaled by its axis scaling
+        SAffine local;
+        SVector3 row_0 = { TLanes::Sub( one, TLanes::Add( yy, zz ) ), TLanes::Add( xy, wz ), TLanes::Sub( xz, wy ) };
+        SVector3 row_1 = { TLanes::Sub( xy, wz ), TLanes::Sub( one, TLanes::Add( xx, zz ) ), TLanes::Add( yz, wx ) };
+        SVector3 row_2 = { TLanes::Add( xz, wy ), TLanes::Sub( yz, wx ), TLanes::Sub( one, TLanes::Add( xx, yy ) ) };
+        local.Rows[ 0 ] = Scale( row_0, sx );
+        local.Rows[ 1 ] = Scale( row_1, sy );
+        local.Rows[ 2 ] = Scale( row_2, sz );
+
+        V translation_t = TLanes::Load( translation.T );
+        local.Rows[ 3 ].x = Lerp( translation, 0, translation_t );
+        local.Rows[ 3 ].y = Lerp( translation, 1, translation_t );
+        local.Rows[ 3 ].z = Lerp( translation, 2, translation_t );
+        return local;
+    }
+
+    // Samples whole groups of WIDTH of the animated nodes at the given positions among them into their local
+    // transformations, stored by position, and returns where it stopped
+    static unsigned int RunChannels( const CMesh::SAnimation& animation, const unsigned int* animation_channels, double animation_time, unsigned int* key_cursors, const unsigned int* animated_nodes, const unsigned int* positions, unsigned int position_begin, unsigned int position_end, DirectX::XMFLOAT4X4* local_node_transformations )
+    {
+        unsigned int i = position_begin;
+        for ( ; i + TLanes::WIDTH <= position_end; i += TLanes::WIDTH )
+        {
+            SLaneChannels lanes;
+            DirectX::XMFLOAT4X4* transformations[ TLanes::WIDTH ];
+            for ( unsigned int j = 0; j < TLanes::WIDTH; ++j )
+            {
+                const unsigned int channel_index = animation_channels[ animated_nodes[ positions[ i + j ] ] ];
+                lanes.Animations[ j ] = &animation;
+                lanes.ChannelIndices[ j ] = channel_index;
+                lanes.AnimationTimes[ j ] = animation_time;
+                lanes.KeyCursors[ j ] = key_cursors != nullptr ? key_cursors + channel_index * KEY_CURSORS_PER_CHANNEL : nullptr;
+                transformations[ j ] = &local_node_transformations[ positions[ i + j ] ];
+            }
+            Store( SampleChannels( lanes, ANIMATION_SAMPLER_NLERP ), transformations );
+        }
+        return i;
+    }
+
+    // Lanes without a channel for the node keep its rest transformation
+    static SAffine CalculateLocalTransformation( const CMesh* mesh, unsigned int node_index, const SLaneAnimations& lanes, EAnimationSampler sampler )
+    {
+        SLaneChannels lane_channels;
+        float animated[ TLanes::WIDTH ];
+        bool any_animated = false;
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            const unsigned int channel_index = mesh->NodeAnimationChannels[ lanes.AnimationIndices[ i ] * mesh->NodeCount + node_index ];
+            const bool is_animated = channel_index != INVALID_INDEX;
+            lane_channels.Animations[ i ] = is_animated ? lanes.Animations[ i ] : nullptr;
+            lane_channels.ChannelIndices[ i ] = channel_index;
+            lane_channels.AnimationTimes[ i ] = lanes.AnimationTimes[ i ];
+            lane_channels.KeyCursors[ i ] = is_animated && lanes.KeyCursors[ i ] != nullptr ? lanes.KeyCursors[ i ] + channel_index * KEY_CURSORS_PER_CHANNEL : nullptr;
+            animated[ i ] = is_animated ? 1.0f : 0.0f;
+            any_animated = any_animated || is_animated;
+        }
+
+        SAffine rest = Broadcast( mesh->NodeTransformations[ node_index ] );
+        if ( !any_animated )
+            return rest;
+
+        SAffine local = SampleChannels( lane_channels, sampler );
+        M is_animated = TLanes::Greater( TLanes::Load( animated ), TLanes::Set( 0 ) );
+        for ( unsigned int r = 0; r < 4; ++r )
+        {
+            local.Rows[ r ] = Select( is_animated, local.Rows[ r ], rest.Rows[ r ] );
+        }
+        return local;
+    }
+
+    // One pass over the nodes in order, with the inverse root transformation as the parent of the root. Nodes that
+    // are static in every lane are skipped, and their global transformations are read from the mesh where an
+    // animated child needs them.
+    static void EvaluateNodes( const CMesh* mesh, const SLaneAnimations& lanes, EAnimationSampler sampler, const SAffine& inverse_root_transformation, const uint8_t* animated_lanes, SAffine* global_node_transformations, DirectX::XMFLOAT4X4* bone_transformations )
+    {
+        for ( unsigned int i = 0; i < mesh->NodeCount; ++i )
+        {
+            if ( animated_lanes[ i ] == 0 )
+                continue;
+
+            const unsigned int parent = mesh->NodeParents[ i ];
+            SAffine parent_transformation = inverse_root_transformation;
+            if ( parent != INVALID_INDEX )
+            {
+                parent_transformation = animated_lanes[ parent ] != 0 ? global_node_transformations[ parent ] : Broadcast( mesh->StaticNodeTransformations[ parent ] );
+            }
+            global_node_transformations[ i ] = Multiply( CalculateLocalTransformation( mesh, i, lanes, sampler ), parent_transformation );
+
+            const unsigned int bone_index = mesh->NodeBoneIndices[ i ];
+            if ( bone_index != INVALID_INDEX )
+            {
+                DirectX::XMFLOAT4X4* transformations[ TLanes::WIDTH ];
+                for ( unsigned int j = 0; j < TLanes::WIDTH; ++j )
+                {
+                    transformations[ j ] = &bone_transformations[ ( lanes.InstanceIndex + j ) * mesh->BoneCount + bone_index ];
+                }
+                Store( Multiply( Broadcast( mesh->BoneOffsets[ bone_index ] ), global_node_transformations[ i ] ), transformations );
+            }
+        }
+    }
+
+    // Processes whole groups of WIDTH instances and returns where it stopped. The scratch is allocated once for the
+    // whole range.
+    static unsigned int RunInstances( const CMesh* mesh, const SAnimationInstance* instances, unsigned int instance_begin, unsigned int instance_end, EAnimationSampler sampler, DirectX::XMFLOAT4X4* bone_transformations )
+    {
+        if ( instance_begin + TLanes::WIDTH > instance_end )
+            return instance_begin;
+
+        const SAffine inverse_root_transformation = Broadcast( mesh->InverseRootTransformation );
+        std::vector<SAffine> global_node_transformations( mesh->NodeCount );
+        std::vector<uint8_t> animated_lanes( mesh->NodeCount );
+
+        unsigned int i = instance_begin;
+        for ( ; i + TLanes::WIDTH <= instance_end; i += TLanes::WIDTH )
+        {
+            SLaneAnimations lanes;
+            lanes.InstanceIndex = i;
+            for ( unsigned int j = 0; j < TLanes::WIDTH; ++j )
+            {
+                const SAnimationInstance& instance = instances[ i + j ];
+                assert( instance.AnimationIndex < mesh->AnimationCount );
+                const CMesh::SAnimation& animation = mesh->Animations[ instance.AnimationIndex ];
+                lanes.AnimationIndices[ j ] = instance.AnimationIndex;
+                lanes.Animations[ j ] = &animation;
+                lanes.AnimationTimes[ j ] = fmod( instance.AnimationTime * animation.TicksPerSecond, animation.Duration );
+                lanes.KeyCursors[ j ] = instance.KeyCursors;
+            }
+
+            // Bit j of a node is set when it is animated in lane j
+            std::fill( animated_lanes.begin(), animated_lanes.end(), static_cast< uint8_t >( 0 ) );
+            for ( unsigned int j = 0; j < TLanes::WIDTH; ++j )
+            {
+                const unsigned int* animated_nodes = mesh->AnimatedNodes + lanes.AnimationIndices[ j ] * mesh->NodeCount;
+                for ( unsigned int k = 0; k < mesh->AnimatedNodeCounts[ lanes.AnimationIndices[ j ] ]; ++k )
+                {
+                    animated_lanes[ animated_nodes[ k ] ] |= static_cast< uint8_t >( 1 << j );
+                }
+                memcpy( bone_transformations + ( i + j ) * mesh->BoneCount, mesh->StaticBoneTransformations, mesh->BoneCount * sizeof( DirectX::XMFLOAT4X4 ) );
+            }
+
+            EvaluateNodes( mesh, lanes, sampler, inverse_root_transformation, animated_lanes.data(), global_node_transformations.data(), bone_transformations );
+        }
+        return i;
+    }
+};
+
+// The inverse root transformation is the parent of the root, so the global transformations of the nodes already
+// include it and every bone takes a single multiplication with its offset. The nlerp sampler first samples the
+// animated nodes with a channel across the SIMD lanes into the node transformations, which the walk over the
+// animated nodes then reads in place.
+void CalculateBoneTransformations( CMesh* mesh, unsigned int animation_index, double animation_time, unsigned int* key_cursors, DirectX::XMFLOAT4X4* node_transformations, DirectX::XMFLOAT4X4* bone_transformations )
+{
+    assert( animation_index < mesh->AnimationCount );
+    const CMesh::SAnimation& animation = mesh->Animations[ animation_index ];
+    animation_time = fmod( animation_time * animation.TicksPerSecond, animation.Duration );
+
+    memcpy( bone_transformations, mesh->StaticBoneTransformations, mesh->BoneCount * sizeof( DirectX::XMFLOAT4X4 ) );
+
+    const unsigned int* animation_channels = mesh->NodeAnimationChannels + animation_index * mesh->NodeCount;
+    const unsigned int* animated_nodes = mesh->AnimatedNodes + animation_index * mesh->NodeCount;
+    const unsigned int* animated_node_parents = mesh->AnimatedNodeParents + animation_index * mesh->NodeCount;
+    const unsigned int animated_node_count = mesh->AnimatedNodeCounts[ animation_index ];
+    const DirectX::XMMATRIX inverse_root_transformation = DirectX::XMLoadFloat4x4( &mesh->InverseRootTransformation );
+
+    const bool sample_lanes = g_AnimationSampler == ANIMATION_SAMPLER_NLERP;
+    if ( sample_lanes )
+    {
+        const unsigned int* channel_positions = mesh->AnimatedChannelPositions + animation_index * mesh->NodeCount;
+        const unsigned int channel_position_count = mesh->AnimatedChannelCounts[ animation_index ];
+        unsigned int k = 0;
+#ifdef SIMD_LANES_X86
+        k = SAnimationKernel<SSseLanes>::RunChannels( animation, animation_channels, animation_time, key_cursors, animated_nodes, channel_positions, k, channel_position_count, node_transformations );
+#endif
+        SAnimationKernel<SScalarLanes>::RunChannels( animation, animation_channels, animation_time, key_cursors, animated_nodes, channel_positions, k, channel_position_count, node_transformations );
+    }
+
+    for ( unsigned int k = 0; k < animated_node_count; ++k )
+    {
+        const unsigned int i = animated_nodes[ k ];
+        DirectX::XMMATRIX local_node_transformation = DirectX::XMLoadFloat4x4( &mesh->NodeTransformations[ i ] );
+
+        const unsigned int channel_index = animation_channels[ i ];
+        if ( channel_index != INVALID_INDEX && sample_lanes )
+        {
+            local_node_transformation = DirectX::XMLoadFloat4x4( &node_transformations[ k ] );
+        }
+        else if ( channel_index != INVALID_INDEX )
+        {
+            DirectX::XMVECTOR scaling, rotation, translation;
+            SampleChannel( animation, channel_index, animation_time, key_cursors != nullptr ? key_cursors + channel_index * KEY_CURSORS_PER_CHANNEL : nullptr, &scaling, &rotation, &translation );
+
+            DirectX::XMMATRIX scaling_matrix = DirectX::XMMatrixScalingFromVector( scaling );
+            DirectX::XMMATRIX rotation_matrix = DirectX::XMMatrixRotationQuaternion( rotation );
+            DirectX::XMMATRIX translation_matrix = DirectX::XMMatrixTranslationFromVector( translation );
+            local_node_transformation = scaling_matrix * rotation_matrix * translation_matrix;
+        }
+
+        // A parent that is not animated keeps its static global transformation
+        const unsigned int parent = mesh->NodeParents[ i ];
+        const unsigned int parent_position = animated_node_parents[ k ];
+        DirectX::XMMATRIX parent_transformation = inverse_root_transformation;
+        if ( parent_position != INVALID_INDEX )
+        {
+            parent_transformation = DirectX::XMLoadFloat4x4( &node_transformations[ parent_position ] );
+        }
+        else if ( parent != INVALID_INDEX )
+        {
+            parent_transformation = DirectX::XMLoadFloat4x4( &mesh->StaticNodeTransformations[ parent ] );
+        }
+        const DirectX::XMMATRIX global_node_transformation = local_node_transformation * parent_transformation;
+        DirectX::XMStoreFloat4x4( &node_transformations[ k ], global_node_transformation );
+
+        const unsigned int bone_index = mesh->NodeBoneIndices[ i ];
+        if ( bone_index != INVALID_INDEX )
+        {
+            DirectX::XMMATRIX bone_offset = DirectX::XMLoadFloat4x4( &mesh->BoneOffsets[ bone_index ] );
+            DirectX::XMStoreFloat4x4( &bone_transformations[ bone_index ], bone_offset * global_node_transformation );
+        }
+    }
+}
+
+void CalculateBoneTransformations( const CMesh* mesh, const SAnimationInstance* instances, unsigned int instance_count, DirectX::XMFLOAT4X4* bone_transformations, CTaskPool* task_pool )
+{
+    // One range of whole batches per thread, so every thread allocates the scratch of a kernel once per call instead
+    // of once per batch
+    const EAnimationSampler sampler = g_AnimationSampler;
+    const unsigned int thread_count = task_pool != nullptr ? task_pool->WorkerCount + 1 : 1;
+    const unsigned int batch_count = ( instance_count + INSTANCE_BATCH_SIZE - 1 ) / INSTANCE_BATCH_SIZE;
+    const unsigned int range_size = std::max( ( batch_count + thread_count - 1 ) / thread_count, 1u ) * INSTANCE_BATCH_SIZE;
+    ParallelFor( task_pool, instance_count, range_size, [ mesh, instances, sampler, bone_transformations ]( unsigned int begin, unsigned int end )
+    {
+        unsigned int i = begin;
+#ifdef SIMD_LANES_X86
+        i = SAnimationKernel<SSseLanes>::RunInstances( mesh, instances, i, end, sampler, bone_transformations );
+#endif
+        SAnimationKernel<SScalarLanes>::RunInstances( mesh, instances, i, end, sampler, bone_transformations );
+    } );
+}
\ No newline at end of file
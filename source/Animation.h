@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <DirectXMath.h>
+
+#include <vector>
+
+class CTaskPool;
+
+// Every animation channel has a scaling, a rotation and a translation key cursor
+static const unsigned int KEY_CURSORS_PER_CHANNEL = 3;
+
+// Per instance animation state, kept outside the shared mesh so any number of instances can play the same rig.
+// The key cursors remember the last key of every channel, so sampling a little later than the last time does
+// not search the keys again. They can be null, and otherwise hold CalculateKeyCursorCount entries that start
+// out as zeros and are valid for any animation of the mesh.
+struct SAnimationInstance
+{
+    unsigned int                AnimationIndex;
+    double                      AnimationTime;
+    unsigned int*               KeyCursors;
+};
+
+unsigned int CalculateKeyCursorCount( const CMesh* mesh );
+
+// How CalculateBoneTransformations interpolates rotations. Slerp samples every channel on its own and builds its
+// transformation from three matrices. Nlerp samples several channels at once across the SIMD lanes and composes
+// their transformations directly, and normalizes the linear interpolation of rotation keys less than 16 degrees
+// apart, which stays within about 1e-4 radians of slerp, and slerps the rest. Nlerp is the default.
+enum EAnimationSampler
+{
+    ANIMATION_SAMPLER_SLERP = 0,
+    ANIMATION_SAMPLER_NLERP,
+    ANIMATION_SAMPLER_COUNT
+};
+
+EAnimationSampler GetAnimationSampler();
+void SetAnimationSampler( EAnimationSampler sampler );
+const char* GetAnimationSamplerName( EAnimationSampler sampler );
+
+// Keys of an animation as imported, before ReduceAnimationKeys drops keys and PackAnimationClip quantizes them.
+// Rotations and scalings of a channel move joints up to Reach away and its translations are scaled by ParentScale,
+// both in world space in the rest pose. Channels that no node plays have a negative reach and keep every key.
+struct SAnimationKeys
+{
+    struct SChannel
+    {
+        std::vector<double>             TranslationKeyTimestamps;
+        std::vector<DirectX::XMFLOAT3>  TranslationKeys;
+        std::vector<double>             RotationKeyTimestamps;
+        std::vector<DirectX::XMFLOAT4>  RotationKeys;
+        std::vector<double>             ScalingKeyTimestamps;
+        std::vector<DirectX::XMFLOAT3>  ScalingKeys;
+
+        float                           ParentScale;
+        float                           Reach;
+    };
+    std::vector<SChannel>               Channels;
+
+    double                              TicksPerSecond;
+    double                              Duration;
+};
+
+// Drops the keys that interpolating the kept keys around them reproduces to within the tolerance, in place. The
+// error of a key is how far it moves the joints of the rest pose in world space, which the reach of its channel
+// bounds. The tolerance holds per track, so the errors of the nodes along a chain add up. Constant tracks keep a
+// single key.
+void ReduceAnimationKeys( SAnimationKeys* animation_keys, unsigned int animation_count, float tolerance, CTaskPool* task_pool, SKeyReductionReport* report );
+
+// Distinct key times of the animation, which become the frames of its timeline
+unsigned int CountAnimationFrames( const SAnimationKeys& animation_keys );
+
+// Bytes of the block PackAnimationClip fills, which has to be 8-byte aligned
+size_t CalculateAnimationClipSize( const SAnimationKeys& animation_keys );
+
+// Quantizes the keys into one block and points the arrays of the animation into it. Returns false without writing
+// anything when the timeline has more than MAX_ANIMATION_FRAME_COUNT frames. Rotations are off by at most about
+// 1e-4 radians and every component of the translations and scalings by at most half the step of its track,
+// 1 / 131070 of the range of the track.
+bool PackAnimationClip( const SAnimationKeys& animation_keys, void* data, CMesh::SAnimation* animation );
+
+// Fills the animated nodes of every animation and the static node and bone transformations of the mesh from its
+// node hierarchy, bone offsets and inverse root transformation. Bones that no node drives stay at identity.
+void ClassifyStaticNodes( CMesh* mesh );
+
+// Key cursors as in SAnimationInstance, null makes every key lookup a binary search. Only the animated nodes are
+// evaluated, the bones of the other nodes are copied from the static bone transformations. The node
+// transformations are NodeCount matrices of scratch that the caller keeps, so posing does not allocate.
+void CalculateBoneTransformations( CMesh* mesh, unsigned int animation_index, double animation_time, unsigned int* key_cursors, DirectX::XMFLOAT4X4* node_transformations, DirectX::XMFLOAT4X4* bone_transformations );
+
+// Evaluates the palettes of many instances of the same mesh in one walk over the hierarchy, with the instances
+// spread over the SIMD lanes and the task pool. The palette of instance i is BoneCount matrices starting at
+// bone_transformations[ i * mesh->BoneCount ]. The node and bone offset transformations must be affine, and
+// the result stays within float rounding of evaluating every instance on its own.
+void CalculateBoneTransformations( const CMesh* mesh, const SAnimationInstance* instances, unsigned int instance_count, DirectX::XMFLOAT4X4* bone_transformations, CTaskPool* task_pool );
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "Animation.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static const unsigned int NODE_COUNT = 16;
+static const unsigned int MIN_KEY_COUNT = 16;
+static const unsigned int MAX_KEY_COUNT = 1 << 16;
+static const unsigned int SAMPLE_COUNT = 20000;
+static const double TICKS_PER_SECOND = 30.0;
+static const double FRAME_SECONDS = 1.0 / 60.0;
+static const unsigned int REPEAT_COUNT = 5;
+static const unsigned int RIG_NODE_COUNT = 500;
+static const unsigned int RIG_STATIC_NODE_COUNT = 375;
+static const unsigned int RIG_KEY_COUNT = 256;
+static const unsigned int POSE_COUNT = 200;
+static const unsigned int INSTANCE_COUNT = 64;
+
+// One animation with a channel with key_count keys of each kind for every node. The first static_node_count nodes
+// are the root and leaves below it without a channel, and the others are a chain below the root that plays them.
+struct SBenchmarkRig
+{
+    CMesh                                     Mesh;
+    CMesh::SAnimation                         Animation;
+    std::vector<double>                       Clip;
+    std::vector<unsigned int>                 NodeParents;
+    std::vector<DirectX::XMFLOAT4X4>          NodeTransformations;
+    std::vector<unsigned int>                 NodeAnimationChannels;
+    std::vector<unsigned int>                 NodeIndices;
+    std::vector<DirectX::XMFLOAT4X4>          BoneOffsets;
+    unsigned int                              AnimatedNodeCount;
+    std::vector<unsigned int>                 AnimatedNodes;
+    std::vector<unsigned int>                 AnimatedNodeParents;
+    unsigned int                              AnimatedChannelCount;
+    std::vector<unsigned int>                 AnimatedChannelPositions;
+    std::vector<DirectX::XMFLOAT4X4>          StaticNodeTransformations;
+    std::vector<DirectX::XMFLOAT4X4>          StaticBoneTransformations;
+};
+
+double GetElapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void CreateBenchmarkRig( unsigned int node_count, unsigned int static_node_count, unsigned int key_count, SBenchmarkRig* rig )
+{
+    SAnimationKeys::SChannel channel;
+    for ( unsigned int i = 0; i < key_count; ++i )
+    {
+        const float angle = 0.05f * static_cast< float >( i );
+        const DirectX::XMFLOAT3 vector( 1.0f + 0.1f * sinf( angle ), 1.0f, 1.0f + 0.1f * cosf( angle ) );
+        channel.TranslationKeyTimestamps.push_back( static_cast< double >( i ) );
+        channel.TranslationKeys.push_back( vector );
+        channel.RotationKeyTimestamps.push_back( static_cast< double >( i ) );
+        channel.RotationKeys.push_back( DirectX::XMFLOAT4( 0.0f, sinf( 0.5f * angle ), 0.0f, cosf( 0.5f * angle ) ) );
+        channel.ScalingKeyTimestamps.push_back( static_cast< double >( i ) );
+        channel.ScalingKeys.push_back( vector );
+    }
+    channel.ParentScale = 1.0f;
+    channel.Reach = 1.0f;
+
+    SAnimationKeys animation_keys;
+    animation_keys.Channels.assign( node_count, channel );
+    animation_keys.TicksPerSecond = TICKS_PER_SECOND;
+    animation_keys.Duration = static_cast< double >( key_count - 1 );
+
+    rig->Clip.resize( ( CalculateAnimationClipSize( animation_keys ) + sizeof( double ) - 1 ) / sizeof( double ) );
+    PackAnimationClip( animation_keys, rig->Clip.data(), &rig->Animation );
+
+    // Node i drives bone i and plays channel i unless it is static
+    DirectX::XMFLOAT4X4 identity;
+    DirectX::XMStoreFloat4x4( &identity, DirectX::XMMatrixIdentity() );
+    rig->NodeParents.resize( node_count );
+    rig->NodeTransformations.assign( node_count, identity );
+    rig->NodeAnimationChannels.resize( node_count );
+    rig->NodeIndices.resize( node_count );
+    rig->BoneOffsets.assign( node_count, identity );
+    for ( unsigned int i = 0; i < node_count; ++i )
+    {
+        rig->NodeParents[ i ] = i > static_node_count ? i - 1 : ( i > 0 ? 0 : INVALID_INDEX );
+        rig->NodeAnimationChannels[ i ] = i >= static_node_count ? i : INVALID_INDEX;
+        rig->NodeIndices[ i ] = i;
+    }
+
+    memset( &rig->Mesh, 0, sizeof( CMesh ) );
+    rig->Mesh.BoneCount = node_count;
+    rig->Mesh.AnimationCount = 1;
+    rig->Mesh.Animations = &rig->Animation;
+    rig->Mesh.NodeCount = node_count;
+    rig->Mesh.NodeParents = rig->NodeParents.data();
+    rig->Mesh.NodeTransformations = rig->NodeTransformations.data();
+    rig->Mesh.NodeAnimationChannels = rig->NodeAnimationChannels.data();
+    rig->Mesh.NodeBoneIndices = rig->NodeIndices.data();
+    rig->Mesh.BoneOffsets = rig->BoneOffsets.data();
+    DirectX::XMStoreFloat4x4( &rig->Mesh.InverseRootTransformation, DirectX::XMMatrixIdentity() );
+
+    rig->AnimatedNodes.resize( node_count );
+    rig->AnimatedNodeParents.resize( node_count );
+    rig->AnimatedChannelPositions.resize( node_count );
+    rig->StaticNodeTransformations.resize( node_count );
+    rig->StaticBoneTransformations.resize( node_count );
+    rig->Mesh.AnimatedNodeCounts = &rig->AnimatedNodeCount;
+    rig->Mesh.AnimatedNodes = rig->AnimatedNodes.data();
+    rig->Mesh.AnimatedNodeParents = rig->AnimatedNodeParents.data();
+    rig->Mesh.AnimatedChannelCounts = &rig->AnimatedChannelCount;
+    rig->Mesh.AnimatedChannelPositions = rig->AnimatedChannelPositions.data();
+    rig->Mesh.StaticNodeTransformations = rig->StaticNodeTransformations.data();
+    rig->Mesh.StaticBoneTransformations = rig->StaticBoneTransformations.data();
+    ClassifyStaticNodes( &rig->Mesh );
+}
+
+// Plays the animation forward at 60 frames per second when seek is false, otherwise samples it at random times.
+// Returns the seconds per sampled channel.
+double MeasureSampling( SBenchmarkRig* rig, bool use_key_cursors, bool seek )
+{
+    std::vector<unsigned int> key_cursors( CalculateKeyCursorCount( &rig->Mesh ), 0 );
+    std::vector<DirectX::XMFLOAT4X4> node_transformations( rig->Mesh.NodeCount );
+    std::vector<DirectX::XMFLOAT4X4> bone_transformations( NODE_COUNT );
+    const double seconds = rig->Animation.Duration / TICKS_PER_SECOND;
+
+    double best_seconds = 1e9;
+    for ( unsigned int repeat = 0; repeat < REPEAT_COUNT; ++repeat )
+    {
+        unsigned int random = 12345;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for ( unsigned int i = 0; i < SAMPLE_COUNT; ++i )
+        {
+            random = random * 1664525u + 1013904223u;
+            const double animation_time = seek ? seconds * ( random >> 8 ) / 16777216.0 : i * FRAME_SECONDS;
+            CalculateBoneTransformations( &rig->Mesh, 0, animation_time, use_key_cursors ? key_cursors.data() : nullptr, node_transformations.data(), bone_transformations.data() );
+        }
+        best_seconds = std::min( best_seconds, GetElapsedSeconds( start ) );
+    }
+    return best_seconds / ( static_cast< double >( SAMPLE_COUNT ) * NODE_COUNT );
+}
+
+// Plays the animation forward at 60 frames per second with the sampler, one pose at a time or for many instances
+// per pose, and returns the seconds per bone
+double MeasurePoses( SBenchmarkRig* rig, EAnimationSampler sampler, bool batched )
+{
+    const unsigned int instance_count = batched ? INSTANCE_COUNT : 1;
+    const unsigned int key_cursor_count = CalculateKeyCursorCount( &rig->Mesh );
+    std::vector<unsigned int> key_cursors( instance_count * key_cursor_count, 0 );
+    std::vector<SAnimationInstance> instances( instance_count );
+    std::vector<DirectX::XMFLOAT4X4> node_transformations( rig->Mesh.NodeCount );
+    std::vector<DirectX::XMFLOAT4X4> bone_transformations( instance_count * rig->Mesh.BoneCount );
+    SetAnimationSampler( sampler );
+
+    double best_seconds = 1e9;
+    for ( unsigned int repeat = 0; repeat < REPEAT_COUNT; ++repeat )
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for ( unsigned int i = 0; i < POSE_COUNT; ++i )
+        {
+            if ( !batched )
+            {
+                CalculateBoneTransformations( &rig->Mesh, 0, i * FRAME_SECONDS, key_cursors.data(), node_transformations.data(), bone_transformations.data() );
+                continue;
+            }
+            for ( unsigned int j = 0; j < instance_count; ++j )
+            {
+                instances[ j ].AnimationIndex = 0;
+                instances[ j ].AnimationTime = ( i + j ) * FRAME_SECONDS;
+                instances[ j ].KeyCursors = key_cursors.data() + j * key_cursor_count;
+            }
+            CalculateBoneTransformations( &rig->Mesh, instances.data(), instance_count, bone_transformations.data(), nullptr );
+        }
+        best_seconds = std::min( best_seconds, GetElapsedSeconds( start ) );
+    }
+    return best_seconds / ( static_cast< double >( POSE_COUNT ) * instance_count * rig->Mesh.BoneCount );
+}
+
+int main( int argc, char** argv )
+{
+    if ( argc > 1 )
+    {
+        printf( "Usage: %s\n", argv[ 0 ] );
+        printf( "Measures the cost of sampling a channel for a doubling number of keys, when playing forward with key cursors,\n" );
+        printf( "when seeking to random times with key cursors and without key cursors, where every key is binary searched.\n" );
+        printf( "Then measures the cost per bone of posing a rig of %u bones with every sampler, one pose at a time and for %u instances at once,\n", RIG_NODE_COUNT, INSTANCE_COUNT );
+        printf( "with every node animated and with %u static nodes\n", RIG_STATIC_NODE_COUNT );
+        return 1;
+    }
+
+    printf( "%8s %18s %18s %18s\n", "keys", "forward ns", "seek ns", "no cursors ns" );
+    for ( unsigned int key_count = MIN_KEY_COUNT; key_count <= MAX_KEY_COUNT; key_count *= 4 )
+    {
+        SBenchmarkRig rig;
+        CreateBenchmarkRig( NODE_COUNT, 0, key_count, &rig );
+
+        const double forward_seconds = MeasureSampling( &rig, true, false );
+        const double seek_seconds = MeasureSampling( &rig, true, true );
+        const double search_seconds = MeasureSampling( &rig, false, false );
+        printf( "%8u %18.1f %18.1f %18.1f\n", key_count, forward_seconds * 1e9, seek_seconds * 1e9, search_seconds * 1e9 );
+    }
+
+    printf( "\n%8s %8s %18s %18s\n", "sampler", "static", "single ns", "batched ns" );
+    for ( unsigned int static_node_count = 0; static_node_count <= RIG_STATIC_NODE_COUNT; static_node_count += RIG_STATIC_NODE_COUNT )
+    {
+        SBenchmarkRig rig;
+        CreateBenchmarkRig( RIG_NODE_COUNT, static_node_count, RIG_KEY_COUNT, &rig );
+        for ( unsigned int sampler = 0; sampler < ANIMATION_SAMPLER_COUNT; ++sampler )
+        {
+            const double single_seconds = MeasurePoses( &rig, static_cast< EAnimationSampler >( sampler ), false );
+            const double batched_seconds = MeasurePoses( &rig, static_cast< EAnimationSampler >( sampler ), true );
+            printf( "%8s %8u %18.1f %18.1f\n", GetAnimationSamplerName( static_cast< EAnimationSampler >( sampler ) ), static_node_count, single_seconds * 1e9, batched_seconds * 1e9 );
+        }
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static const size_t ARENA_ALIGNMENT = 64;
+
+// Linear allocator over a single block. An arena without data only measures, which lets the same
+// allocation code run once to find the block size and once more to hand out the sub-allocations.
+// Size includes the alignment padding, AllocatedSize only counts the requested bytes.
+struct SArena
+{
+    char*  Data;
+    size_t Capacity;
+    size_t Size;
+    size_t AllocatedSize;
+};
+
+inline void* AllocateAligned( size_t size, size_t alignment )
+{
+#ifdef _WIN32
+    return _aligned_malloc( size, alignment );
+#else
+    void* data = nullptr;
+    return posix_memalign( &data, alignment, size ) == 0 ? data : nullptr;
+#endif
+}
+
+inline void FreeAligned( void* data )
+{
+#ifdef _WIN32
+    _aligned_free( data );
+#else
+    free( data );
+#endif
+}
+
+inline void CreateArena( SArena& arena, size_t capacity )
+{
+    arena.Data = static_cast< char* >( AllocateAligned( capacity > 0 ? capacity : ARENA_ALIGNMENT, ARENA_ALIGNMENT ) );
+    arena.Capacity = capacity;
+    arena.Size = 0;
+    arena.AllocatedSize = 0;
+}
+
+template< typename T >
+T* ArenaAllocate( SArena& arena, size_t count )
+{
+    if ( count == 0 )
+        return nullptr;
+
+    size_t offset = ( arena.Size + ARENA_ALIGNMENT - 1 ) & ~( ARENA_ALIGNMENT - 1 );
+    arena.Size = offset + count * sizeof( T );
+    arena.AllocatedSize += count * sizeof( T );
+    if ( arena.Data == nullptr )
+        return nullptr;
+
+    assert( arena.Size <= arena.Capacity );
+    return reinterpret_cast< T* >( arena.Data + offset );
+}
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "Animation.h"
+#include "GatherValidation.h"
+#include "Mesh.h"
+#include "PackedMesh.h"
+#include "Skinning.h"
+#include "TaskPool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+float CalculateAngleBetweenNormals( const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b )
+{
+    const float cos_angle = DirectX::XMVectorGetX( DirectX::XMVector3Dot( DirectX::XMVector3Normalize( DirectX::XMLoadFloat3( &a ) ), DirectX::XMVector3Normalize( DirectX::XMLoadFloat3( &b ) ) ) );
+    return acosf( fminf( fmaxf( cos_angle, -1.0f ), 1.0f ) ) * ( 180.0f / 3.14159265f );
+}
+
+int main( int argc, char** argv )
+{
+    const char* arguments[ 2 ] = {};
+    unsigned int argument_count = 0;
+    unsigned int thread_count = 0;
+    bool pin_threads = false;
+    bool validate = false;
+    bool report_weighting = false;
+    double evaluate_time = -1.0;
+    ESkinningMethod skinning_method = SKINNING_METHOD_LINEAR_BLEND;
+    unsigned int bone_palette_size = BONE_PALETTE_SIZE;
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[ i ], "-threads" ) == 0 && i + 1 < argc )
+        {
+            thread_count = static_cast< unsigned int >( atoi( argv[ ++i ] ) );
+        }
+        else if ( strcmp( argv[ i ], "-pin" ) == 0 )
+        {
+            pin_threads = true;
+        }
+        else if ( strcmp( argv[ i ], "-validate" ) == 0 )
+        {
+            validate = true;
+        }
+        else if ( strcmp( argv[ i ], "-weighting" ) == 0 )
+        {
+            report_weighting = true;
+        }
+        else if ( strcmp( argv[ i ], "-kernel" ) == 0 && i + 1 < argc )
+        {
+            const char* kernel_name = argv[ ++i ];
+            unsigned int kernel = 0;
+            while ( kernel < TRIANGLE_KERNEL_COUNT && strcmp( kernel_name, GetTriangleKernelName( static_cast< ETriangleKernel >( kernel ) ) ) != 0 )
+            {
+                ++kernel;
+            }
+            if ( kernel == TRIANGLE_KERNEL_COUNT )
+            {
+                printf( "Unknown triangle kernel %s\n", kernel_name );
+                argument_count = 0;
+                break;
+            }
+            SetTriangleKernel( static_cast< ETriangleKernel >( kernel ) );
+        }
+        else if ( strcmp( argv[ i ], "-evaluate" ) == 0 && i + 1 < argc )
+        {
+            evaluate_time = atof( argv[ ++i ] );
+        }
+        else if ( strcmp( argv[ i ], "-skinning" ) == 0 && i + 1 < argc )
+        {
+            const char* skinning_method_name = argv[ ++i ];
+            unsigned int method = 0;
+            while ( method < SKINNING_METHOD_COUNT && strcmp( skinning_method_name, GetSkinningMethodName( static_cast< ESkinningMethod >( method ) ) ) != 0 )
+            {
+                ++method;
+            }
+            if ( method == SKINNING_METHOD_COUNT )
+            {
+                printf( "Unknown skinning method %s\n", skinning_method_name );
+                argument_count = 0;
+                break;
+            }
+            skinning_method = static_cast< ESkinningMethod >( method );
+        }
+        else if ( strcmp( argv[ i ], "-sampler" ) == 0 && i + 1 < argc )
+        {
+            const char* sampler_name = argv[ ++i ];
+            unsigned int sampler = 0;
+            while ( sampler < ANIMATION_SAMPLER_COUNT && strcmp( sampler_name, GetAnimationSamplerName( static_cast< EAnimationSampler >( sampler ) ) ) != 0 )
+            {
+                ++sampler;
+            }
+            if ( sampler == ANIMATION_SAMPLER_COUNT )
+            {
+                printf( "Unknown animation sampler %s\n", sampler_name );
+                argument_count = 0;
+                break;
+            }
+            SetAnimationSampler( static_cast< EAnimationSampler >( sampler ) );
+        }
+        else if ( strcmp( argv[ i ], "-palette" ) == 0 && i + 1 < argc )
+        {
+            const int size = atoi( argv[ ++i ] );
+            bone_palette_size = static_cast< unsigned int >( std::min( std::max( size, static_cast< int >( MIN_BONE_PALETTE_SIZE ) ), static_cast< int >( MAX_BONE_PALETTE_SIZE ) ) );
+            if ( static_cast< int >( bone_palette_size ) != size )
+            {
+                printf( "Clamped the bone palette size %s to %u\n", argv[ i ], bone_palette_size );
+            }
+        }
+        else if ( argument_count < 2 )
+        {
+            arguments[ argument_count++ ] = argv[ i ];
+        }
+        else
+        {
+            argument_count = 0;
+            break;
+        }
+    }
+
+    if ( argument_count == 0 )
+    {
+        printf( "Usage: %s [-threads <count>] [-pin] [-validate] [-weighting] [-kernel <scalar|sse|avx2>] [-evaluate <seconds>] [-skinning <lbs|dqs>] [-sampler <slerp|nlerp>] [-palette <bones>] <source mesh> [output prefix]\n", argv[ 0 ] );
+        printf( "Writes one GPU-ready blob per sub mesh to <output prefix>.<sub mesh index>%s\n", PACKED_SUB_MESH_EXTENSION );
+        printf( "A thread count of 0 uses every hardware thread, the output does not depend on it\n" );
+        printf( "Pin binds each worker thread to its own hardware thread\n" );
+        printf( "Validate compares the baked normals, tangents and deform factors to a serial scatter reference\n" );
+        printf( "Weighting compares the approximate corner weightings to the exact one, in the evaluated pose if there is one\n" );
+        printf( "The triangle kernel defaults to the widest one the CPU supports\n" );
+        printf( "Evaluate skins the blobs on the CPU at the given time of the first animation and compares the normals to the reference\n" );
+        printf( "Skinning picks linear blend or dual quaternion skinning for the evaluation, both with the deform factor correction\n" );
+        printf( "Sampler picks how the animation is interpolated, evaluate also times both samplers and compares their bones\n" );
+        printf( "Palette is the most bones per draw, between %u and %u, and has to match the viewer, which uses %u\n", MIN_BONE_PALETTE_SIZE, MAX_BONE_PALETTE_SIZE, BONE_PALETTE_SIZE );
+        return 1;
+    }
+
+    const char* source_filepath = arguments[ 0 ];
+    const char* output_prefix = argument_count == 2 ? arguments[ 1 ] : source_filepath;
+
+    // The calling thread works too, so a single thread needs no pool at all
+    CTaskPool* task_pool = thread_count != 1 ? CreateTaskPool( thread_count > 1 ? thread_count - 1 : 0, pin_threads ) : nullptr;
+
+    SMeshLoadReport load_report;
+    CMesh* mesh = LoadMesh( source_filepath, task_pool, &load_report );
+    if ( mesh == nullptr )
+    {
+        printf( "Failed to load %s\n", source_filepath );
+        if ( load_report.KeyReduction.MaxFrameCount > MAX_ANIMATION_FRAME_COUNT )
+        {
+            printf( "An animation has %u distinct key times, packed clips hold at most %u\n", load_report.KeyReduction.MaxFrameCount, MAX_ANIMATION_FRAME_COUNT );
+        }
+        if ( task_pool != nullptr )
+        {
+            DestroyTaskPool( task_pool );
+        }
+        return 1;
+    }
+
+    if ( load_report.LoadedFromCache )
+    {
+        printf( "Loaded %s from cache in %.3f s\n", source_filepath, load_report.TotalSeconds );
+    }
+    else
+    {
+        printf( "Imported %s with %u threads and the %s kernel in %.3f s (import %.3f s, normals and tangents %.3f s, deform factors %.3f s)\n",
+            source_filepath, task_pool != nullptr ? static_cast< unsigned int >( task_pool->Threads.size() ) + 1 : 1, GetTriangleKernelName( load_report.TriangleKernel ),
+            load_report.TotalSeconds, load_report.ImportSeconds, load_report.NormalsAndTangentsSeconds, load_report.DeformFactorsSeconds );
+        printf( "Key reduction kept %u of %u animation keys, saving %zu bytes, with a max error of %g and a tolerance of %g, and packed them into %zu bytes\n",
+            load_report.KeyReduction.KeptKeyCount, load_report.KeyReduction.ImportedKeyCount, load_report.KeyReduction.SavedBytes, load_report.KeyReduction.MaxError,
+            load_report.KeyReduction.Tolerance, load_report.KeyReduction.PackedBytes );
+    }
+
+    int result = 0;
+    if ( validate )
+    {
+        for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+        {
+            SGatherValidationReport validation_report;
+            ValidateGather( mesh, i, &validation_report );
+            const float max_difference = std::max( std::max( std::max( validation_report.MaxNormalDifference, validation_report.MaxTangentDifference ), validation_report.MaxBitangentDifference ),
+                std::max( validation_report.MaxTangentDeformFactorDifference, validation_report.MaxBitangentDeformFactorDifference ) );
+            printf( "Sub mesh %u differs from the scatter reference by at most %g normal, %g tangent, %g bitangent, %g tangent and %g bitangent deform factor, %s the tolerance of %g\n", i,
+                validation_report.MaxNormalDifference, validation_report.MaxTangentDifference, validation_report.MaxBitangentDifference, validation_report.MaxTangentDeformFactorDifference,
+                validation_report.MaxBitangentDeformFactorDifference, max_difference <= GATHER_TOLERANCE ? "within" : "above", GATHER_TOLERANCE );
+            if ( !( max_difference <= GATHER_TOLERANCE ) )
+            {
+                result = 1;
+            }
+        }
+    }
+
+    std::vector<uint8_t> data;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        SPackedSubMeshHeader header;
+        InitializePackedSubMeshHeader( mesh, i, bone_palette_size, &header );
+
+        data.resize( header.VertexBufferSize + header.IndexBufferSize + header.PartitionBufferSize );
+        char filepath[ 1024 ];
+        GetPackedSubMeshFilepath( output_prefix, i, filepath, sizeof( filepath ) );
+        if ( !PackSubMesh( mesh, i, bone_palette_size, &header, data.data() ) )
+        {
+            printf( "Skipped %s: %u packed vertices do not fit 16-bit indices, the limit is %u\n", filepath, header.VertexCount, MAX_PACKED_VERTEX_COUNT );
+            result = 1;
+            continue;
+        }
+
+        if ( !SavePackedSubMesh( filepath, header, data.data() ) )
+        {
+            printf( "Failed to write %s\n", filepath );
+            result = 1;
+            continue;
+        }
+
+        printf( "%s: %u vertices, %u triangles, %u partitions of at most %u bones, %u bytes\n", filepath, header.VertexCount, header.TriangleCount, header.PartitionCount, header.BonePaletteSize,
+            header.VertexBufferSize + header.IndexBufferSize + header.PartitionBufferSize );
+    }
+
+    SMeshMemoryReport report;
+    CalculateMeshMemoryReport( mesh, &report );
+    printf( "Mesh memory: %zu vertex, %zu index, %zu adjacency, %zu triangle uv, %zu animation, %zu hierarchy, %zu padding, %zu total bytes\n",
+        report.VertexBytes, report.IndexBytes, report.AdjacencyBytes, report.TriangleUVBytes, report.AnimationBytes, report.HierarchyBytes, report.PaddingBytes, report.TotalBytes );
+    printf( "Animation workspace: %zu bytes per instance\n", CalculateMeshWorkspaceSize( mesh ) );
+
+    SMeshWorkspace* workspace = CreateMeshWorkspace( mesh );
+
+    std::vector<DirectX::XMFLOAT4X4> bone_transformations;
+    if ( evaluate_time >= 0.0 )
+    {
+        bone_transformations.resize( mesh->BoneCount > 0 ? mesh->BoneCount : 1 );
+        for ( DirectX::XMFLOAT4X4& bone_transformation : bone_transformations )
+        {
+            DirectX::XMStoreFloat4x4( &bone_transformation, DirectX::XMMatrixIdentity() );
+        }
+        if ( mesh->AnimationCount > 0 )
+        {
+            // Times a pose with every sampler, then keeps the bones of the chosen one for the skinning below
+            static const unsigned int SAMPLER_POSE_COUNT = 1000;
+            const EAnimationSampler chosen_sampler = GetAnimationSampler();
+            std::vector<DirectX::XMFLOAT4X4> node_transformations( mesh->NodeCount );
+            std::vector<DirectX::XMFLOAT4X4> sampler_bone_transformations[ ANIMATION_SAMPLER_COUNT ];
+            double pose_seconds[ ANIMATION_SAMPLER_COUNT ];
+            for ( unsigned int j = 0; j < ANIMATION_SAMPLER_COUNT; ++j )
+            {
+                SetAnimationSampler( static_cast< EAnimationSampler >( j ) );
+                sampler_bone_transformations[ j ] = bone_transformations;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for ( unsigned int k = 0; k < SAMPLER_POSE_COUNT; ++k )
+                {
+                    CalculateBoneTransformations( mesh, 0, evaluate_time, nullptr, node_transformations.data(), sampler_bone_transformations[ j ].data() );
+                }
+                pose_seconds[ j ] = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count() / SAMPLER_POSE_COUNT;
+            }
+            SetAnimationSampler( chosen_sampler );
+            bone_transformations = sampler_bone_transformations[ chosen_sampler ];
+
+            float max_difference = 0.0f;
+            for ( unsigned int j = 0; j < mesh->BoneCount; ++j )
+            {
+                for ( unsigned int r = 0; r < 4; ++r )
+                {
+                    for ( unsigned int c = 0; c < 4; ++c )
+                    {
+                        max_difference = std::max( max_difference, fabsf( sampler_bone_transformations[ ANIMATION_SAMPLER_SLERP ][ j ].m[ r ][ c ] - sampler_bone_transformations[ ANIMATION_SAMPLER_NLERP ][ j ].m[ r ][ c ] ) );
+                    }
+                }
+            }
+            printf( "Posed %u bones at %.3f s in %.1f us with slerp and %.1f us with nlerp, with a max difference of %g, using %s\n", mesh->BoneCount, evaluate_time,
+                pose_seconds[ ANIMATION_SAMPLER_SLERP ] * 1e6, pose_seconds[ ANIMATION_SAMPLER_NLERP ] * 1e6, max_difference, GetAnimationSamplerName( chosen_sampler ) );
+        }
+    }
+
+    // Runs after the blobs are written as it leaves the mesh posed, and before the skinning below, which updates the
+    // normals from scratch again
+    if ( report_weighting )
+    {
+        for ( unsigned int i = TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA + 1; i < TRIANGLE_CORNER_WEIGHTING_COUNT; ++i )
+        {
+            SCornerWeightingReport weighting_report;
+            CalculateCornerWeightingReport( mesh, workspace, evaluate_time >= 0.0 ? bone_transformations.data() : nullptr, static_cast< ETriangleCornerWeighting >( i ), &weighting_report );
+            printf( "Corner weighting %s%s: normal error %.4f max %.4f mean, tangent error %.4f max %.4f mean degrees\n", GetTriangleCornerWeightingName( weighting_report.CornerWeighting ),
+                evaluate_time >= 0.0 ? " in the evaluated pose" : " in the rest pose", weighting_report.MaxNormalError, weighting_report.MeanNormalError, weighting_report.MaxTangentError,
+                weighting_report.MeanTangentError );
+        }
+    }
+
+    // Skins the blobs as the shader does
+    if ( evaluate_time >= 0.0 )
+    {
+        std::vector<SDualQuaternion> bone_dual_quaternions( bone_transformations.size() );
+        CalculateBoneDualQuaternions( bone_transformations.data(), static_cast< unsigned int >( bone_transformations.size() ), bone_dual_quaternions.data() );
+
+        static const unsigned int SKINNING_BATCH_SIZE = 1024;
+        std::vector<DirectX::XMFLOAT4X4> palette_transformations( bone_palette_size );
+        std::vector<SDualQuaternion> palette_dual_quaternions( bone_palette_size );
+        std::vector<DirectX::XMFLOAT3> tangents_ref, bitangents_ref;
+        std::vector<DirectX::XMFLOAT3> skinned;
+        for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+        {
+            const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ i ];
+
+            SPackedSubMeshHeader header;
+            InitializePackedSubMeshHeader( mesh, i, bone_palette_size, &header );
+            data.resize( header.VertexBufferSize + header.IndexBufferSize + header.PartitionBufferSize );
+            if ( !PackSubMesh( mesh, i, bone_palette_size, &header, data.data() ) )
+                continue;
+
+            UpdateNormalsAndTangents( mesh, workspace, i, bone_transformations.data(), task_pool );
+
+            SPackedPartitions partitions;
+            InitializePackedPartitions( header, data.data() + header.VertexBufferSize + header.IndexBufferSize, &partitions );
+
+            // The viewer gathers the posed reference tangents the same way
+            tangents_ref.resize( header.VertexCount );
+            bitangents_ref.resize( header.VertexCount );
+            for ( unsigned int j = 0; j < header.VertexCount; ++j )
+            {
+                tangents_ref[ j ] = mesh->Tangents[ sub_mesh.VertexOffset + partitions.SourceVertices[ j ] ];
+                bitangents_ref[ j ] = mesh->Bitangents[ sub_mesh.VertexOffset + partitions.SourceVertices[ j ] ];
+            }
+
+            SSkinningInput input;
+            InitializeSkinningInput( header, data.data(), &input );
+            input.TangentsRef = tangents_ref.data();
+            input.BitangentsRef = bitangents_ref.data();
+
+            skinned.resize( 8 * header.VertexCount );
+            SSkinningOutput output;
+            DirectX::XMFLOAT3* streams = skinned.data();
+            output.Positions = streams + 0 * header.VertexCount;
+            output.TangentsOld = streams + 1 * header.VertexCount;
+            output.BitangentsOld = streams + 2 * header.VertexCount;
+            output.NormalsOld = streams + 3 * header.VertexCount;
+            output.TangentsNew = streams + 4 * header.VertexCount;
+            output.BitangentsNew = streams + 5 * header.VertexCount;
+            output.NormalsNew = streams + 6 * header.VertexCount;
+            output.NormalsRef = streams + 7 * header.VertexCount;
+
+            // Each partition is skinned with only its own bones, as the viewer uploads them
+            for ( unsigned int j = 0; j < header.PartitionCount; ++j )
+            {
+                const SPackedPartition& partition = partitions.Partitions[ j ];
+                for ( unsigned int k = 0; k < partition.BoneCount; ++k )
+                {
+                    palette_transformations[ k ] = bone_transformations[ partitions.Bones[ partition.BoneOffset + k ] ];
+                    palette_dual_quaternions[ k ] = bone_dual_quaternions[ partitions.Bones[ partition.BoneOffset + k ] ];
+                }
+
+                ParallelFor( task_pool, partition.VertexCount, SKINNING_BATCH_SIZE, [ skinning_method, &input, &partition, &palette_transformations, &palette_dual_quaternions, &output ]( unsigned int begin, unsigned int end )
+                {
+                    if ( skinning_method == SKINNING_METHOD_DUAL_QUATERNION )
+                    {
+                        SkinPackedVerticesDualQuaternion( input, palette_dual_quaternions.data(), partition.VertexOffset + begin, partition.VertexOffset + end, output );
+                    }
+                    else
+                    {
+                        SkinPackedVertices( input, palette_transformations.data(), partition.VertexOffset + begin, partition.VertexOffset + end, output );
+                    }
+                } );
+            }
+
+            float max_old_error = 0.0f, max_new_error = 0.0f;
+            double sum_old_error = 0.0, sum_new_error = 0.0;
+            for ( unsigned int j = 0; j < input.VertexCount; ++j )
+            {
+                const float old_error = CalculateAngleBetweenNormals( output.NormalsOld[ j ], output.NormalsRef[ j ] );
+                const float new_error = CalculateAngleBetweenNormals( output.NormalsNew[ j ], output.NormalsRef[ j ] );
+                max_old_error = fmaxf( max_old_error, old_error );
+                max_new_error = fmaxf( max_new_error, new_error );
+                sum_old_error += old_error;
+                sum_new_error += new_error;
+            }
+
+            const double vertex_count = input.VertexCount > 0 ? static_cast< double >( input.VertexCount ) : 1.0;
+            printf( "Sub mesh %u at %.3f s with %s: old normal error %.4f max %.4f mean, new normal error %.4f max %.4f mean degrees\n",
+                i, evaluate_time, GetSkinningMethodName( skinning_method ), max_old_error, sum_old_error / vertex_count, max_new_error, sum_new_error / vertex_count );
+        }
+    }
+    DestroyMeshWorkspace( workspace );
+
+    DestroyMesh( mesh );
+    if ( task_pool != nullptr )
+    {
+        DestroyTaskPool( task_pool );
+    }
+
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "GatherValidation.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+// The serial scatter passes the import used before the gather passes, kept as the reference they are checked against.
+// They add the contribution of every triangle to its three vertices in triangle order.
+
+bool CalculateTriangleFrame( const CMesh* mesh, const CMesh::SSubMesh& sub_mesh, unsigned int triangle_index, const DirectX::XMFLOAT3* sub_mesh_positions, DirectX::XMVECTOR* positions, DirectX::XMVECTOR& triangle_normal, DirectX::XMVECTOR& triangle_tangent, DirectX::XMVECTOR& triangle_bitangent, float& triangle_area )
+{
+    unsigned int sub_mesh_indices[ 3 ];
+    sub_mesh_indices[ 0 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + triangle_index ) * 3 + 0 ];
+    sub_mesh_indices[ 1 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + triangle_index ) * 3 + 1 ];
+    sub_mesh_indices[ 2 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + triangle_index ) * 3 + 2 ];
+
+    DirectX::XMVECTOR texture_coords[ 3 ];
+    texture_coords[ 0 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ sub_mesh_indices[ 0 ] + sub_mesh.VertexOffset ] );
+    texture_coords[ 1 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ sub_mesh_indices[ 1 ] + sub_mesh.VertexOffset ] );
+    texture_coords[ 2 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ sub_mesh_indices[ 2 ] + sub_mesh.VertexOffset ] );
+
+    DirectX::XMVECTOR u0 = DirectX::XMVectorSubtract( texture_coords[ 1 ], texture_coords[ 0 ] );
+    DirectX::XMVECTOR u1 = DirectX::XMVectorSubtract( texture_coords[ 2 ], texture_coords[ 0 ] );
+
+    float uv_area = DirectX::XMVectorGetX( DirectX::XMVector2Cross( u0, u1 ) );
+    if ( uv_area == 0 )
+        return false;
+    float s0 = -DirectX::XMVectorGetX( u1 ) / uv_area;
+    float s1 = DirectX::XMVectorGetY( u1 ) / uv_area;
+    float t0 = DirectX::XMVectorGetX( u0 ) / uv_area;
+    float t1 = -DirectX::XMVectorGetY( u0 ) / uv_area;
+
+    positions[ 0 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 0 ] ] );
+    positions[ 1 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 1 ] ] );
+    positions[ 2 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 2 ] ] );
+
+    DirectX::XMVECTOR e0 = DirectX::XMVectorSubtract( positions[ 1 ], positions[ 0 ] );
+    DirectX::XMVECTOR e1 = DirectX::XMVectorSubtract( positions[ 2 ], positions[ 0 ] );
+
+    triangle_normal = DirectX::XMVector3Cross( e1, e0 );
+    triangle_area = DirectX::XMVectorGetX( DirectX::XMVector3Length( triangle_normal ) );
+
+    triangle_tangent = DirectX::XMVector3Normalize( DirectX::XMVectorAdd( DirectX::XMVectorScale( e0, s0 ), DirectX::XMVectorScale( e1, t0 ) ) );
+    triangle_bitangent = DirectX::XMVector3Normalize( DirectX::XMVectorAdd( DirectX::XMVectorScale( e0, s1 ), DirectX::XMVectorScale( e1, t1 ) ) );
+    return true;
+}
+float CalculateWedgeAngle( const DirectX::XMVECTOR* positions, unsigned int corner )
+{
+    DirectX::XMVECTOR e2 = DirectX::XMVectorSubtract( positions[ ( corner + 1 ) % 3 ], positions[ corner ] );
+    DirectX::XMVECTOR e3 = DirectX::XMVectorSubtract( positions[ ( corner + 2 ) % 3 ], positions[ corner ] );
+    return DirectX::XMVectorGetX( DirectX::XMVector3AngleBetweenVectors( e2, e3 ) );
+}
+
+void NormalizeNormalAndTangents( DirectX::XMFLOAT3& normal, DirectX::XMFLOAT3& tangent, DirectX::XMFLOAT3& bitangent )
+{
+    DirectX::XMVECTOR n = DirectX::XMVector3Normalize( DirectX::XMLoadFloat3( &normal ) );
+    DirectX::XMVECTOR t = DirectX::XMLoadFloat3( &tangent );
+    DirectX::XMVECTOR b = DirectX::XMLoadFloat3( &bitangent );
+
+    DirectX::XMStoreFloat3( &normal, n );
+    DirectX::XMStoreFloat3( &tangent, DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( n, b ), n ) ) );
+    DirectX::XMStoreFloat3( &bitangent, DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( n, t ), n ) ) );
+}
+
+// The streams hold one element per vertex of the sub mesh
+void CalculateNormalsAndTangents( const CMesh* mesh, unsigned int sub_mesh_index, DirectX::XMFLOAT3* normals, DirectX::XMFLOAT3* tangents, DirectX::XMFLOAT3* bitangents )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+    {
+        normals[ i ] = tangents[ i ] = bitangents[ i ] = DirectX::XMFLOAT3( 0, 0, 0 );
+    }
+
+    for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
+    {
+        DirectX::XMVECTOR positions[ 3 ];
+        DirectX::XMVECTOR triangle_normal, triangle_tangent, triangle_bitangent;
+        float triangle_area;
+        if ( !CalculateTriangleFrame( mesh, sub_mesh, j, mesh->Positions + sub_mesh.VertexOffset, positions, triangle_normal, triangle_tangent, triangle_bitangent, triangle_area ) )
+            continue;
+
+        for ( unsigned int k = 0; k < 3; ++k )
+        {
+            unsigned int index = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + k ];
+            float wedge_angle = CalculateWedgeAngle( positions, k ) * triangle_area;
+
+            DirectX::XMStoreFloat3( &normals[ index ], DirectX::XMVectorAdd( DirectX::XMLoadFloat3( &normals[ index ] ), DirectX::XMVectorScale( triangle_normal, wedge_angle ) ) );
+            DirectX::XMStoreFloat3( &tangents[ index ], DirectX::XMVectorAdd( DirectX::XMLoadFloat3( &tangents[ index ] ), DirectX::XMVectorScale( triangle_tangent, wedge_angle ) ) );
+            DirectX::XMStoreFloat3( &bitangents[ index ], DirectX::XMVectorAdd( DirectX::XMLoadFloat3( &bitangents[ index ] ), DirectX::XMVectorScale( triangle_bitangent, wedge_angle ) ) );
+        }
+    }
+
+    for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+    {
+        NormalizeNormalAndTangents( normals[ i ], tangents[ i ], bitangents[ i ] );
+    }
+}
+
+void CalculateTriangleToLocal( const CMesh* mesh, const unsigned int* indices, DirectX::XMVECTOR* positions, DirectX::XMMATRIX& triangle_to_local, float& triangle_area )
+{
+    positions[ 0 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 0 ] ] );
+    positions[ 1 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 1 ] ] );
+    positions[ 2 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 2 ] ] );
+
+    DirectX::XMVECTOR e0 = DirectX::XMVectorSubtract( positions[ 1 ], positions[ 0 ] );
+    DirectX::XMVECTOR e1 = DirectX::XMVectorSubtract( positions[ 2 ], positions[ 0 ] );
+    DirectX::XMVECTOR n = DirectX::XMVector3Cross( e1, e0 );
+
+    triangle_area = DirectX::XMVectorGetX( DirectX::XMVector3Length( n ) );
+
+    const DirectX::XMFLOAT3X3 local_to_triangle_matrix(
+        DirectX::XMVectorGetX( e0 ), DirectX::XMVectorGetX( e1 ), DirectX::XMVectorGetX( n ),
+        DirectX::XMVectorGetY( e0 ), DirectX::XMVectorGetY( e1 ), DirectX::XMVectorGetY( n ),
+        DirectX::XMVectorGetZ( e0 ), DirectX::XMVectorGetZ( e1 ), DirectX::XMVectorGetZ( n ) );
+    DirectX::XMMATRIX local_to_triangle = DirectX::XMLoadFloat3x3( &local_to_triangle_matrix );
+
+    DirectX::XMVECTOR determinant;
+    triangle_to_local = DirectX::XMMatrixInverse( &determinant, local_to_triangle );
+}
+
+static const unsigned int MAX_TRIANGLE_BONES = 3 * BONE_WEIGHTS_PER_VERTEX;
+
+// Union of the bones weighted by any corner of a triangle, in first occurrence order, with the weight and
+// weight index of every bone in every corner. Bones whose weight does not vary over the triangle are dropped.
+struct STriangleBones
+{
+    unsigned int        Count;
+    unsigned int        Bones[ MAX_TRIANGLE_BONES ];
+    unsigned int        WeightIndices[ 3 ][ MAX_TRIANGLE_BONES ];
+    float               Weights[ 3 ][ MAX_TRIANGLE_BONES ];
+    DirectX::XMVECTOR   WeightGradients[ MAX_TRIANGLE_BONES ];
+};
+
+// The weight gradient of a bone is dw0 * gradient_0 + dw1 * gradient_1, the first two rows of the triangle to local matrix
+void CalculateTriangleBones( const CMesh* mesh, const unsigned int* indices, DirectX::FXMVECTOR gradient_0, DirectX::FXMVECTOR gradient_1, STriangleBones& triangle_bones )
+{
+    unsigned int bone_count = 0;
+    for ( unsigned int k = 0; k < 3; ++k )
+    {
+        const float* bone_weights = mesh->BoneWeights + indices[ k ] * BONE_WEIGHTS_PER_VERTEX;
+        const unsigned int* bone_indices = mesh->BoneIndices + indices[ k ] * BONE_WEIGHTS_PER_VERTEX;
+        for ( unsigned int l = 0; l < BONE_WEIGHTS_PER_VERTEX; ++l )
+        {
+            if ( bone_weights[ l ] == 0 )
+                continue;
+
+            unsigned int n = 0;
+            while ( n < bone_count && triangle_bones.Bones[ n ] != bone_indices[ l ] )
+                ++n;
+            if ( n == bone_count )
+            {
+                triangle_bones.Bones[ bone_count++ ] = bone_indices[ l ];
+            }
+        }
+    }
+
+    // Walk the weights backwards so that the first weight of a bone wins, even one that is zero
+    for ( unsigned int k = 0; k < 3; ++k )
+    {
+        const float* bone_weights = mesh->BoneWeights + indices[ k ] * BONE_WEIGHTS_PER_VERTEX;
+        const unsigned int* bone_indices = mesh->BoneIndices + indices[ k ] * BONE_WEIGHTS_PER_VERTEX;
+        for ( unsigned int n = 0; n < bone_count; ++n )
+        {
+            triangle_bones.WeightIndices[ k ][ n ] = INVALID_INDEX;
+            triangle_bones.Weights[ k ][ n ] = 0;
+        }
+        for ( unsigned int l = BONE_WEIGHTS_PER_VERTEX; l-- > 0; )
+        {
+            for ( unsigned int n = 0; n < bone_count; ++n )
+            {
+                if ( triangle_bones.Bones[ n ] == bone_indices[ l ] )
+                {
+                    triangle_bones.WeightIndices[ k ][ n ] = l;
+                    triangle_bones.Weights[ k ][ n ] = bone_weights[ l ];
+                    break;
+                }
+            }
+        }
+    }
+
+    triangle_bones.Count = 0;
+    for ( unsigned int n = 0; n < bone_count; ++n )
+    {
+        float dw0 = triangle_bones.Weights[ 1 ][ n ] - triangle_bones.Weights[ 0 ][ n ];
+        float dw1 = triangle_bones.Weights[ 2 ][ n ] - triangle_bones.Weights[ 0 ][ n ];
+
+        if ( dw0 == 0 && dw1 == 0 )
+            continue;
+
+        const unsigned int m = triangle_bones.Count++;
+        triangle_bones.Bones[ m ] = triangle_bones.Bones[ n ];
+        for ( unsigned int k = 0; k < 3; ++k )
+        {
+            triangle_bones.WeightIndices[ k ][ m ] = triangle_bones.WeightIndices[ k ][ n ];
+            triangle_bones.Weights[ k ][ m ] = triangle_bones.Weights[ k ][ n ];
+        }
+        triangle_bones.WeightGradients[ m ] = DirectX::XMVectorAdd( DirectX::XMVectorScale( gradient_0, dw0 ), DirectX::XMVectorScale( gradient_1, dw1 ) );
+    }
+}
+
+// The tangents are the ones of CalculateNormalsAndTangents, and the deform factors hold DEFORM_FACTORS_PER_VERTEX
+// elements per vertex of the sub mesh
+void CalculateDeformFactors( const CMesh* mesh, unsigned int sub_mesh_index, const DirectX::XMFLOAT3* tangents, const DirectX::XMFLOAT3* bitangents, float* tangent_deform_factors, float* bitangent_deform_factors )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    std::vector<float> deform_factor_sums( sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX, 0 );
+    std::fill( tangent_deform_factors, tangent_deform_factors + sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX, 0.0f );
+    std::fill( bitangent_deform_factors, bitangent_deform_factors + sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX, 0.0f );
+
+    for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
+    {
+        unsigned int indices[ 3 ];
+        indices[ 0 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 0 ] + sub_mesh.VertexOffset;
+        indices[ 1 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 1 ] + sub_mesh.VertexOffset;
+        indices[ 2 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 2 ] + sub_mesh.VertexOffset;
+
+        DirectX::XMVECTOR positions[ 3 ];
+        DirectX::XMMATRIX triangle_to_local;
+        float triangle_area;
+        CalculateTriangleToLocal( mesh, indices, positions, triangle_to_local, triangle_area );
+
+        STriangleBones triangle_bones;
+        CalculateTriangleBones( mesh, indices, triangle_to_local.r[ 0 ], triangle_to_local.r[ 1 ], triangle_bones );
+
+        for ( unsigned int k = 0; k < triangle_bones.Count; ++k )
+        {
+            for ( unsigned int m = 0; m < 3; ++m )
+            {
+                unsigned int weight_index = triangle_bones.WeightIndices[ m ][ k ];
+                if ( weight_index != INVALID_INDEX && weight_index > 0 )
+                {
+                    float wedge_angle = CalculateWedgeAngle( positions, m ) * triangle_area;
+
+                    const unsigned int vertex_index = indices[ m ] - sub_mesh.VertexOffset;
+                    DirectX::XMVECTOR tangent = DirectX::XMLoadFloat3( &tangents[ vertex_index ] );
+                    DirectX::XMVECTOR bitangent = DirectX::XMLoadFloat3( &bitangents[ vertex_index ] );
+
+                    unsigned int deform_factor_index = vertex_index * DEFORM_FACTORS_PER_VERTEX + weight_index - 1;
+                    tangent_deform_factors[ deform_factor_index ] += DirectX::XMVectorGetX( DirectX::XMVector3Dot( tangent, triangle_bones.WeightGradients[ k ] ) ) * wedge_angle;
+                    bitangent_deform_factors[ deform_factor_index ] += DirectX::XMVectorGetX( DirectX::XMVector3Dot( bitangent, triangle_bones.WeightGradients[ k ] ) ) * wedge_angle;
+                    deform_factor_sums[ deform_factor_index ] += wedge_angle;
+                }
+            }
+        }
+    }
+    for ( unsigned int i = 0; i < sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX; ++i )
+    {
+        if ( deform_factor_sums[ i ] > 0 )
+        {
+            tangent_deform_factors[ i ] /= deform_factor_sums[ i ];
+            bitangent_deform_factors[ i ] /= deform_factor_sums[ i ];
+        }
+    }
+}
+
+// Values that are NaN in both count as equal, NaN in only one of them as infinitely far apart
+float CalculateMaxDifference( const float* a, const float* b, unsigned int count )
+{
+    float max_difference = 0.0f;
+    for ( unsigned int i = 0; i < count; ++i )
+    {
+        if ( a[ i ] != a[ i ] && b[ i ] != b[ i ] )
+            continue;
+        const float difference = fabsf( a[ i ] - b[ i ] ) / std::max( 1.0f, std::max( fabsf( a[ i ] ), fabsf( b[ i ] ) ) );
+        max_difference = difference == difference ? std::max( max_difference, difference ) : INFINITY;
+    }
+    return max_difference;
+}
+
+void ValidateGather( const CMesh* mesh, unsigned int sub_mesh_index, SGatherValidationReport* report )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    std::vector<DirectX::XMFLOAT3> normals( sub_mesh.VertexCount );
+    std::vector<DirectX::XMFLOAT3> tangents( sub_mesh.VertexCount );
+    std::vector<DirectX::XMFLOAT3> bitangents( sub_mesh.VertexCount );
+    std::vector<float> tangent_deform_factors( sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    std::vector<float> bitangent_deform_factors( sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    CalculateNormalsAndTangents( mesh, sub_mesh_index, normals.data(), tangents.data(), bitangents.data() );
+    CalculateDeformFactors( mesh, sub_mesh_index, tangents.data(), bitangents.data(), tangent_deform_factors.data(), bitangent_deform_factors.data() );
+
+    const unsigned int vector_count = sub_mesh.VertexCount * 3;
+    const unsigned int deform_factor_count = sub_mesh.VertexCount * DEFORM_FACTORS_PER_VERTEX;
+    report->MaxNormalDifference = CalculateMaxDifference( &mesh->Normals[ sub_mesh.VertexOffset ].x, &normals.data()->x, vector_count );
+    report->MaxTangentDifference = CalculateMaxDifference( &mesh->Tangents[ sub_mesh.VertexOffset ].x, &tangents.data()->x, vector_count );
+    report->MaxBitangentDifference = CalculateMaxDifference( &mesh->Bitangents[ sub_mesh.VertexOffset ].x, &bitangents.data()->x, vector_count );
+    report->MaxTangentDeformFactorDifference = CalculateMaxDifference( mesh->TangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, tangent_deform_factors.data(), deform_factor_count );
+    report->MaxBitangentDeformFactorDifference = CalculateMaxDifference( mesh->BitangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, bitangent_deform_factors.data(), deform_factor_count );
+}
\ No newline at end of file
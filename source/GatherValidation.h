@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Mesh.h"
+
+// The gather passes use the closed form inverse of the triangle to local matrix and sum the corners of a vertex in
+// adjacency order, so they differ slightly from the scatter passes
+static const float GATHER_TOLERANCE = 1e-3f;
+
+// Largest differences of the baked rest pose streams of a sub mesh from the serial scatter passes that the gather
+// passes replaced, relative to the larger magnitude of the two values when it is above one
+struct SGatherValidationReport
+{
+    float                       MaxNormalDifference;
+    float                       MaxTangentDifference;
+    float                       MaxBitangentDifference;
+    float                       MaxTangentDeformFactorDifference;
+    float                       MaxBitangentDeformFactorDifference;
+};
+
+// Recomputes the normals, tangents and deform factors of the sub mesh triangle by triangle and compares the mesh to
+// them. The mesh has to hold the rest pose, so this runs before anything poses it.
+void ValidateGather( const CMesh* mesh, unsigned int sub_mesh_index, SGatherValidationReport* report );
\ No newline at end of file
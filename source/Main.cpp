@@ -1,13 +1,18 @@
 #include "WindowContext.h"
 #include "RenderContext.h"
+#include "Animation.h"
 #include "Mesh.h"
-#include "PackFunctions.h"
+#include "PackedMesh.h"
 #include "SimpleTweakbar.h"
+#include "TaskPool.h"
+
+#include <vector>
 
 int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
 {
     CWindowContext* wc = CreateWindowContext();
     CRenderContext* rc = CreateRenderContext( wc->Hwnd );
+    CTaskPool* task_pool = CreateTaskPool( 0, false );
 
     ID3D12RootSignature* root_signature = {};
     ID3D12PipelineState* pipeline_states[ 6 ] = {};
@@ -94,50 +99,49 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
         unsigned int        DiffIntensity;
         DirectX::XMFLOAT4   ViewDirection;
         DirectX::XMFLOAT4X4 ViewProjection;
-        DirectX::XMFLOAT4X4 BoneTransformations[ 64 ];
+        DirectX::XMFLOAT4X4 BoneTransformations[ BONE_PALETTE_SIZE ];
     } constants;
     constants.DiffIntensity = 32;
 
     ID3D12GraphicsCommandList* command_list = PrepareLoading( rc );
 
-    CMesh* mesh = LoadMesh( "assets/Chal_Head_Wrinkles.fbx" );
-    const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ 1 ];
+    const char* mesh_filepath = "assets/Chal_Head_Wrinkles.fbx";
+    const unsigned int sub_mesh_index = 1;
 
-    enum EVertexElement
-    {
-        VERTEX_ELEMENT_POSITION = 0,
-        VERTEX_ELEMENT_BONE_WEIGHTS,
-        VERTEX_ELEMENT_BONE_INDICES,
-        VERTEX_ELEMENT_TANGENTS,
-        VERTEX_ELEMENT_DEFORM_FACTORS_TANGENT,
-        VERTEX_ELEMENT_DEFORM_FACTORS_BITANGENT, 
-        VERTEX_ELEMENT_TANGENT_REF,
-        VERTEX_ELEMENT_BITANGENT_REF,
-        VERTEX_ELEMENT_COUNT
-    };
-    const unsigned int VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_COUNT ] =
-    {
-        4 * sizeof( uint16_t ),
-        4 * sizeof( uint8_t ),
-        4 * sizeof( uint8_t ),
-        4 * sizeof( uint8_t ),
-        4 * sizeof( uint8_t ),
-        4 * sizeof( uint8_t ),
-        3 * sizeof( float ),
-        3 * sizeof( float ),
-    };
+    CMesh* mesh = LoadMesh( mesh_filepath, task_pool, nullptr );
+    if ( mesh == nullptr )
+        return 1;
+    SMeshWorkspace* mesh_workspace = CreateMeshWorkspace( mesh );
+    const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+    std::vector<DirectX::XMFLOAT4X4> bone_transformations( mesh->BoneCount > 0 ? mesh->BoneCount : 1 );
+    std::vector<unsigned int> key_cursors( CalculateKeyCursorCount( mesh ), 0 );
+    std::vector<DirectX::XMFLOAT4X4> node_transformations( mesh->NodeCount > 0 ? mesh->NodeCount : 1 );
+
+    // The partitions stay on the CPU to gather the bones and reference tangents of each frame
+    SPackedSubMeshHeader packed_header;
+    std::vector<uint8_t> partition_data;
+    SPackedPartitions partitions;
+    std::vector<D3D12_GPU_VIRTUAL_ADDRESS> partition_constants;
 
     ID3D12Resource* vertex_buffer = {};
     ID3D12Resource* index_buffer = {};
     D3D12_VERTEX_BUFFER_VIEW vertex_buffer_views[ VERTEX_ELEMENT_COUNT ];
     D3D12_INDEX_BUFFER_VIEW index_buffer_view;
     {
-        unsigned int vertex_buffer_size = 0;
-        for ( unsigned int i = 0; i < VERTEX_ELEMENT_COUNT; ++i )
+        // Use the offline baked sub mesh when it is up to date, its header sizes the buffers and its data is copied
+        // straight into upload memory. Otherwise the sub mesh is packed here.
+        char packed_filepath[ 260 ];
+        GetPackedSubMeshFilepath( mesh_filepath, sub_mesh_index, packed_filepath, sizeof( packed_filepath ) );
+        const bool is_baked = LoadPackedSubMeshHeader( packed_filepath, mesh, sub_mesh_index, BONE_PALETTE_SIZE, &packed_header );
+        if ( !is_baked )
         {
-            vertex_buffer_size += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
+            InitializePackedSubMeshHeader( mesh, sub_mesh_index, BONE_PALETTE_SIZE, &packed_header );
+            if ( packed_header.VertexCount > MAX_PACKED_VERTEX_COUNT )
+                return 1;
         }
-        unsigned int index_buffer_size = sub_mesh.TriangleCount * 3 * sizeof( uint16_t );
+
+        unsigned int vertex_buffer_size = packed_header.VertexBufferSize;
+        unsigned int index_buffer_size = packed_header.IndexBufferSize;
 
         {
             D3D12_HEAP_PROPERTIES heap_properties = {};
@@ -188,7 +192,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
         {
             vertex_buffer_views[ i ].BufferLocation = vertex_buffer->GetGPUVirtualAddress() + vertex_buffer_offset;
             vertex_buffer_views[ i ].StrideInBytes = VERTEX_ELEMENT_STRIDES[ i ];
-            vertex_buffer_views[ i ].SizeInBytes = sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
+            vertex_buffer_views[ i ].SizeInBytes = packed_header.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
             vertex_buffer_offset += vertex_buffer_views[ i ].SizeInBytes;
         }
 
@@ -196,27 +200,26 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
         index_buffer_view.Format = DXGI_FORMAT_R16_UINT;
         index_buffer_view.SizeInBytes = index_buffer_size;
 
-        UINT upload_buffer_size = vertex_buffer_size + index_buffer_size;
+        UINT upload_buffer_size = vertex_buffer_size + index_buffer_size + packed_header.PartitionBufferSize;
         UINT upload_buffer_offset = AllocateUploadMemory( rc, upload_buffer_size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT );
         BYTE* upload_buffer_data = rc->UploadBufferData + upload_buffer_offset;
 
-        Pack::RGB32FloatToRGBM16Unorm( sub_mesh.VertexCount, reinterpret_cast< float* >( mesh->Positions + sub_mesh.VertexOffset ), reinterpret_cast< uint16_t* >( upload_buffer_data ), &constants.PositionScale );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_POSITION ];
-        Pack::RGBA32FloatToRGBA8Unorm( sub_mesh.VertexCount, mesh->BoneWeights + sub_mesh.VertexOffset * BONE_WEIGHTS_PER_VERTEX, reinterpret_cast< uint8_t* >( upload_buffer_data ) );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BONE_WEIGHTS ];
-        Pack::RGBA32UintToRGBA8Uint( sub_mesh.VertexCount, mesh->BoneIndices + sub_mesh.VertexOffset * BONE_WEIGHTS_PER_VERTEX, reinterpret_cast< uint8_t* >( upload_buffer_data ) );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BONE_INDICES ];
-        Pack::TangentsToRGBA8Unorm( sub_mesh.VertexCount, reinterpret_cast< float* >( mesh->Tangents + sub_mesh.VertexOffset ), reinterpret_cast< float* >( mesh->Bitangents + sub_mesh.VertexOffset ), reinterpret_cast< float* >( mesh->Normals + sub_mesh.VertexOffset ), reinterpret_cast< uint8_t* >( upload_buffer_data ) );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENTS ];
-        Pack::RGB32FloatToRGBM8Unorm( sub_mesh.VertexCount, mesh->TangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, reinterpret_cast< uint8_t* >( upload_buffer_data ), &constants.DeformFactorsTangentScale );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_DEFORM_FACTORS_TANGENT ];
-        Pack::RGB32FloatToRGBM8Unorm( sub_mesh.VertexCount, mesh->BitangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, reinterpret_cast< uint8_t* >( upload_buffer_data ), &constants.DeformFactorsBitangentScale );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_DEFORM_FACTORS_BITANGENT ];
-        memcpy( upload_buffer_data, mesh->Tangents + sub_mesh.VertexOffset, sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ] );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ];
-        memcpy( upload_buffer_data, mesh->Bitangents + sub_mesh.VertexOffset, sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ] );
-        upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ];
-        Pack::RGB32UintToRGB16Uint( sub_mesh.TriangleCount, mesh->Indices + sub_mesh.TriangleOffset * 3, ( uint16_t* )upload_buffer_data );
+        if ( is_baked )
+        {
+            // The buffers are sized for the baked header, so a blob that changed since cannot fall back to packing
+            if ( !LoadPackedSubMeshData( packed_filepath, packed_header, upload_buffer_data ) )
+                return 1;
+        }
+        else
+        {
+            PackSubMesh( mesh, sub_mesh_index, BONE_PALETTE_SIZE, &packed_header, upload_buffer_data );
+        }
+        partition_data.assign( upload_buffer_data + vertex_buffer_size + index_buffer_size, upload_buffer_data + upload_buffer_size );
+        InitializePackedPartitions( packed_header, partition_data.data(), &partitions );
+        partition_constants.resize( packed_header.PartitionCount );
+        constants.PositionScale = packed_header.PositionScale;
+        constants.DeformFactorsTangentScale = packed_header.DeformFactorsTangentScale;
+        constants.DeformFactorsBitangentScale = packed_header.DeformFactorsBitangentScale;
 
         command_list->CopyBufferRegion( vertex_buffer, 0, rc->UploadBuffer, 0, vertex_buffer_size );
         command_list->CopyBufferRegion( index_buffer, 0, rc->UploadBuffer, vertex_buffer_size, index_buffer_size );
@@ -247,6 +250,15 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
     unsigned int view_option = VIEW_OPTION_SMOOTH_NEW;
     bool is_paused = false;
 
+    unsigned int corner_weighting = TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA;
+    const char* corner_weightings[] =
+    {
+        "ANGLE x AREA",
+        "FAST ANGLE x AREA",
+        "AREA",
+        "UNIFORM",
+    };
+
     const char* view_options[] =
     {
         "SMOOTH OLD",
@@ -265,6 +277,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
         SimpleComponentDesc::Label( "NEW = Skinning + Deform Factors" ),
         SimpleComponentDesc::Label( "REF = Reference" ),
         SimpleComponentDesc::Dropdown( "View", _countof( view_options ), view_options, &view_option ),
+        SimpleComponentDesc::Dropdown( "REF Weighting", _countof( corner_weightings ), corner_weightings, &corner_weighting ),
         SimpleComponentDesc::Button( "Play/Pause", []( void* user_data ) { bool& is_paused = *static_cast< bool* >( user_data ); is_paused = !is_paused; }, &is_paused ),
         SimpleComponentDesc::Slider( "Diff Intensity", 0, 100, &constants.DiffIntensity ),
     };
@@ -344,28 +357,57 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
             DirectX::XMStoreFloat4( &constants.ViewDirection, view_direction );
             DirectX::XMStoreFloat4x4( &constants.ViewProjection, view * projection );
 
-            CalculateBoneTransformations( mesh, 0, animation_time, constants.BoneTransformations );
-            UpdateNormalsAndTangents( mesh, 1, constants.BoneTransformations );
+            // Pose the mesh on the pool while the main thread waits for the frame and records the upload
+            mesh_workspace->CornerWeighting = static_cast< ETriangleCornerWeighting >( corner_weighting );
+            STaskCounter pose_counter;
+            SubmitTask( task_pool, &pose_counter, [ mesh, mesh_workspace, sub_mesh_index, animation_time, &key_cursors, &node_transformations, &bone_transformations, task_pool ]()
+            {
+                CalculateBoneTransformations( mesh, 0, animation_time, key_cursors.data(), node_transformations.data(), bone_transformations.data() );
+                UpdateNormalsAndTangents( mesh, mesh_workspace, sub_mesh_index, bone_transformations.data(), task_pool );
+            } );
 
             command_list = PrepareFrame( rc );
 
-            // Upload reference tangents and bitangents
+            // The bone transformations go into the partition constants below, and the pose tells whether any
+            // reference tangents changed at all
+            WaitForTasks( task_pool, &pose_counter );
+
+            // Upload reference tangents and bitangents, unless the pose left them as they were. The copies into
+            // upload memory run on the pool while the copy commands are recorded, as those only execute once the
+            // frame is submitted.
+            STaskCounter upload_counter;
+            if ( mesh_workspace->UpdatedVertexCount > 0 )
             {
                 D3D12_RESOURCE_BARRIER pre_copy_barrier = { D3D12_RESOURCE_BARRIER_TYPE_TRANSITION, D3D12_RESOURCE_BARRIER_FLAG_NONE, vertex_buffer, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER, D3D12_RESOURCE_STATE_COPY_DEST };
                 command_list->ResourceBarrier( 1, &pre_copy_barrier );
             
-                UINT upload_buffer_size = sub_mesh.VertexCount * ( VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ] + VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ] );
+                UINT upload_buffer_size = packed_header.VertexCount * ( VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ] + VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ] );
                 UINT upload_buffer_offset = AllocateUploadMemory( rc, upload_buffer_size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT );
                 BYTE* upload_buffer_data = rc->UploadBufferData + upload_buffer_offset;
                 
-                memcpy( upload_buffer_data, mesh->Tangents + sub_mesh.VertexOffset, sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ] );
-                upload_buffer_data += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ];
-                memcpy( upload_buffer_data, mesh->Bitangents + sub_mesh.VertexOffset, sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ] );
+                // Vertices shared by several partitions are packed once per partition
+                SubmitTask( task_pool, &upload_counter, [ upload_buffer_data, mesh, &sub_mesh, &packed_header, &partitions ]()
+                {
+                    DirectX::XMFLOAT3* tangents_ref = reinterpret_cast< DirectX::XMFLOAT3* >( upload_buffer_data );
+                    for ( unsigned int i = 0; i < packed_header.VertexCount; ++i )
+                    {
+                        tangents_ref[ i ] = mesh->Tangents[ sub_mesh.VertexOffset + partitions.SourceVertices[ i ] ];
+                    }
+                } );
+                upload_buffer_data += packed_header.VertexCount * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ];
+                SubmitTask( task_pool, &upload_counter, [ upload_buffer_data, mesh, &sub_mesh, &packed_header, &partitions ]()
+                {
+                    DirectX::XMFLOAT3* bitangents_ref = reinterpret_cast< DirectX::XMFLOAT3* >( upload_buffer_data );
+                    for ( unsigned int i = 0; i < packed_header.VertexCount; ++i )
+                    {
+                        bitangents_ref[ i ] = mesh->Bitangents[ sub_mesh.VertexOffset + partitions.SourceVertices[ i ] ];
+                    }
+                } );
             
                 unsigned int vertex_buffer_offset = 0;
                 for ( unsigned int i = 0; i < VERTEX_ELEMENT_TANGENT_REF; ++i )
                 {
-                    vertex_buffer_offset += sub_mesh.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
+                    vertex_buffer_offset += packed_header.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
                 }
                 command_list->CopyBufferRegion( vertex_buffer, vertex_buffer_offset, rc->UploadBuffer, upload_buffer_offset, upload_buffer_size );
             
@@ -373,12 +415,33 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
                 command_list->ResourceBarrier( 1, &post_copy_barrier );
             }
 
+            WaitForTasks( task_pool, &upload_counter );
+
             // Draw
             {
                 command_list->SetGraphicsRootSignature( root_signature );
 
-                BYTE* constant_upload_data = AllocateAndSetGraphicsConstantBuffer( rc, sizeof( SConstants ), 0 );
-                memcpy( constant_upload_data, &constants, sizeof( SConstants ) );
+                // Each partition gets its own constants, with only the bones it uses uploaded
+                for ( unsigned int i = 0; i < packed_header.PartitionCount; ++i )
+                {
+                    const SPackedPartition& partition = partitions.Partitions[ i ];
+                    for ( unsigned int j = 0; j < partition.BoneCount; ++j )
+                    {
+                        constants.BoneTransformations[ j ] = bone_transformations[ partitions.Bones[ partition.BoneOffset + j ] ];
+                    }
+
+                    UINT constant_upload_offset = AllocateUploadMemory( rc, sizeof( SConstants ), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT );
+                    memcpy( rc->UploadBufferData + constant_upload_offset, &constants, offsetof( SConstants, BoneTransformations ) + partition.BoneCount * sizeof( DirectX::XMFLOAT4X4 ) );
+                    partition_constants[ i ] = rc->UploadBuffer->GetGPUVirtualAddress() + constant_upload_offset;
+                }
+                auto draw_partitions = [ command_list, &packed_header, &partitions, &partition_constants ]()
+                {
+                    for ( unsigned int i = 0; i < packed_header.PartitionCount; ++i )
+                    {
+                        command_list->SetGraphicsRootConstantBufferView( 0, partition_constants[ i ] );
+                        command_list->DrawIndexedInstanced( partitions.Partitions[ i ].TriangleCount * 3, 1, partitions.Partitions[ i ].TriangleOffset * 3, 0, 0 );
+                    }
+                };
 
                 command_list->IASetPrimitiveTopology( D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
                 command_list->IASetIndexBuffer( &index_buffer_view );
@@ -408,7 +471,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
                                 break;
                         }
 
-                        command_list->DrawIndexedInstanced( mesh->SubMeshes[ 1 ].TriangleCount * 3, 1, 0, 0, 0 );
+                        draw_partitions();
 
                         break;
                     }
@@ -434,7 +497,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
                                     break;
                             }
 
-                            command_list->DrawIndexedInstanced( mesh->SubMeshes[ 1 ].TriangleCount * 3, 1, 0, 0, 0 );
+                            draw_partitions();
                         }
 
                         // Right view
@@ -455,7 +518,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
                                     break;
                             }
 
-                            command_list->DrawIndexedInstanced( mesh->SubMeshes[ 1 ].TriangleCount * 3, 1, 0, 0, 0 );
+                            draw_partitions();
                         }
 
                         break;
@@ -482,7 +545,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
                                 break;
                         }
 
-                        command_list->DrawIndexedInstanced( mesh->SubMeshes[ 1 ].TriangleCount * 3, 1, 0, 0, 0 );
+                        draw_partitions();
 
                         break;
                     }
@@ -498,6 +561,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
     index_buffer->Release();
     vertex_buffer->Release();
 
+    DestroyMeshWorkspace( mesh_workspace );
     DestroyMesh( mesh );
 
     for ( unsigned int i = 0; i < _countof( pipeline_states ); ++i )
@@ -508,6 +572,7 @@ int WinMain( HINSTANCE, HINSTANCE, LPSTR, int )
 
     DestroySimpleTweakbar( tweakbar );
 
+    DestroyTaskPool( task_pool );
     DestroyRenderContext( rc );
     DestroyWindowContext( wc );
 
@@ -1,101 +1,93 @@
 #include "Mesh.h"
+#include "Animation.h"
+#include "Arena.h"
+#include "MeshCache.h"
+#include "TaskPool.h"
+#include "TriangleFrames.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
-void CalculateNormalsAndTangents( CMesh* mesh, unsigned int sub_mesh_index, const DirectX::XMFLOAT3* sub_mesh_positions )
-{
-    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+static const unsigned int IMPORT_FLAGS = aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs;
+static const unsigned int VERTEX_BATCH_SIZE = 1024;
+static const unsigned int TRIANGLE_BATCH_SIZE = 2048;
+static const float MESH_WORKSPACE_BONE_TOLERANCE = 1e-5f;
+static const float MESH_WORKSPACE_FULL_UPDATE_RATIO = 0.5f;
+// Animation keys are dropped while they move no joint by more than this fraction of the bounding box diagonal
+static const float KEY_REDUCTION_TOLERANCE = 1e-4f;
 
-    memset( mesh->Normals + sub_mesh.VertexOffset, 0, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
-    memset( mesh->Tangents + sub_mesh.VertexOffset, 0, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
-    memset( mesh->Bitangents + sub_mesh.VertexOffset, 0, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
+double GetElapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
 
-    for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
-    {
-        unsigned int sub_mesh_indices[ 3 ];
-        sub_mesh_indices[ 0 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 0 ];
-        sub_mesh_indices[ 1 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 1 ];
-        sub_mesh_indices[ 2 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 2 ];
+void NormalizeNormalAndTangents( CMesh* mesh, unsigned int vertex_index )
+{
+    DirectX::XMVECTOR normal = DirectX::XMLoadFloat3( &mesh->Normals[ vertex_index ] );
+    DirectX::XMVECTOR tangent = DirectX::XMLoadFloat3( &mesh->Tangents[ vertex_index ] );
+    DirectX::XMVECTOR bitangent = DirectX::XMLoadFloat3( &mesh->Bitangents[ vertex_index ] );
 
-        unsigned int indices[ 3 ];
-        indices[ 0 ] = sub_mesh_indices[ 0 ] + sub_mesh.VertexOffset;
-        indices[ 1 ] = sub_mesh_indices[ 1 ] + sub_mesh.VertexOffset;
-        indices[ 2 ] = sub_mesh_indices[ 2 ] + sub_mesh.VertexOffset;
+    normal = DirectX::XMVector3Normalize( normal );
 
-        DirectX::XMVECTOR texture_coords[ 3 ];
-        texture_coords[ 0 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ indices[ 0 ] ] );
-        texture_coords[ 1 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ indices[ 1 ] ] );
-        texture_coords[ 2 ] = DirectX::XMLoadFloat2( &mesh->TextureCoords[ indices[ 2 ] ] );
+    DirectX::XMStoreFloat3( &mesh->Normals[ vertex_index ], normal );
+    DirectX::XMStoreFloat3( &mesh->Tangents[ vertex_index ], DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( normal, bitangent ), normal ) ) );
+    DirectX::XMStoreFloat3( &mesh->Bitangents[ vertex_index ], DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( normal, tangent ), normal ) ) );
+}
 
-        DirectX::XMVECTOR u0 = DirectX::XMVectorSubtract( texture_coords[ 1 ], texture_coords[ 0 ] );
-        DirectX::XMVECTOR u1 = DirectX::XMVectorSubtract( texture_coords[ 2 ], texture_coords[ 0 ] );
+// Gathers the triangle frames over the incident corners of each vertex in [vertex_begin, vertex_end) of the sub mesh.
+// Every vertex is written by exactly one call, so disjoint vertex ranges can be processed concurrently.
+void CalculateNormalsAndTangentsGather( CMesh* mesh, unsigned int sub_mesh_index, const STriangleFrames& frames, unsigned int vertex_begin, unsigned int vertex_end )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
 
-        float uv_area = DirectX::XMVectorGetX( DirectX::XMVector2Cross( u0, u1 ) );
-        if ( uv_area == 0 )
-            continue;
-        float s0 = -DirectX::XMVectorGetX( u1 ) / uv_area;
-        float s1 = DirectX::XMVectorGetY( u1 ) / uv_area;
-        float t0 = DirectX::XMVectorGetX( u0 ) / uv_area;
-        float t1 = -DirectX::XMVectorGetY( u0 ) / uv_area;
-
-        DirectX::XMVECTOR positions[ 3 ];
-        positions[ 0 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 0 ] ] );
-        positions[ 1 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 1 ] ] );
-        positions[ 2 ] = DirectX::XMLoadFloat3( &sub_mesh_positions[ sub_mesh_indices[ 2 ] ] );
-
-        DirectX::XMVECTOR e0 = DirectX::XMVectorSubtract( positions[ 1 ], positions[ 0 ] );
-        DirectX::XMVECTOR e1 = DirectX::XMVectorSubtract( positions[ 2 ], positions[ 0 ] );
-
-        DirectX::XMVECTOR triangle_normal = DirectX::XMVector3Cross( e1, e0 );
-        float triangle_area = DirectX::XMVectorGetX( DirectX::XMVector3Length( triangle_normal ) );
-
-        DirectX::XMVECTOR triangle_tangent = DirectX::XMVector3Normalize( DirectX::XMVectorAdd( DirectX::XMVectorScale( e0, s0 ), DirectX::XMVectorScale( e1, t0 ) ) );
-        DirectX::XMVECTOR triangle_bitangent = DirectX::XMVector3Normalize( DirectX::XMVectorAdd( DirectX::XMVectorScale( e0, s1 ), DirectX::XMVectorScale( e1, t1 ) ) );
-
-        for ( unsigned int k = 0; k < 3; ++k )
-        {
-            DirectX::XMVECTOR e2 = DirectX::XMVectorSubtract( positions[ ( k + 1 ) % 3 ], positions[ k ] );
-            DirectX::XMVECTOR e3 = DirectX::XMVectorSubtract( positions[ ( k + 2 ) % 3 ], positions[ k ] );
-            float wedge_angle = DirectX::XMVectorGetX( DirectX::XMVector3AngleBetweenVectors( e2, e3 ) ) * triangle_area;
-
-            DirectX::XMVECTOR vertex_normal = DirectX::XMLoadFloat3( &mesh->Normals[ indices[ k ] ] );
-            DirectX::XMVECTOR vertex_tangent = DirectX::XMLoadFloat3( &mesh->Tangents[ indices[ k ] ] );
-            DirectX::XMVECTOR vertex_bitangent = DirectX::XMLoadFloat3( &mesh->Bitangents[ indices[ k ] ] );
-            
-            vertex_normal = DirectX::XMVectorAdd( vertex_normal, DirectX::XMVectorScale( triangle_normal, wedge_angle ) );
-            vertex_tangent = DirectX::XMVectorAdd( vertex_tangent, DirectX::XMVectorScale( triangle_tangent, wedge_angle ) );
-            vertex_bitangent = DirectX::XMVectorAdd( vertex_bitangent, DirectX::XMVectorScale( triangle_bitangent, wedge_angle ) );
-            
-            DirectX::XMStoreFloat3( &mesh->Normals[ indices[ k ] ], vertex_normal );
-            DirectX::XMStoreFloat3( &mesh->Tangents[ indices[ k ] ], vertex_tangent );
-            DirectX::XMStoreFloat3( &mesh->Bitangents[ indices[ k ] ], vertex_bitangent );
-        }
-    }
+    const float* normals[ 3 ] = { GetTriangleFrameStream( frames, TRIANGLE_FRAME_NORMAL_X ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_NORMAL_Y ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_NORMAL_Z ) };
+    const float* tangents[ 3 ] = { GetTriangleFrameStream( frames, TRIANGLE_FRAME_TANGENT_X ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_TANGENT_Y ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_TANGENT_Z ) };
+    const float* bitangents[ 3 ] = { GetTriangleFrameStream( frames, TRIANGLE_FRAME_BITANGENT_X ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_BITANGENT_Y ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_BITANGENT_Z ) };
+    const float* corner_weights = GetTriangleFrameStream( frames, TRIANGLE_FRAME_CORNER_WEIGHT_0 );
 
-    for ( unsigned int i = sub_mesh.VertexOffset; i < ( sub_mesh.VertexOffset + sub_mesh.VertexCount ); ++i )
+    const unsigned int corner_offset = sub_mesh.TriangleOffset * 3;
+    for ( unsigned int i = sub_mesh.VertexOffset + vertex_begin; i < sub_mesh.VertexOffset + vertex_end; ++i )
     {
-        DirectX::XMVECTOR normal = DirectX::XMLoadFloat3( &mesh->Normals[ i ] );
-        DirectX::XMVECTOR tangent = DirectX::XMLoadFloat3( &mesh->Tangents[ i ] );
-        DirectX::XMVECTOR bitangent = DirectX::XMLoadFloat3( &mesh->Bitangents[ i ] );
+        float vertex_normal[ 3 ] = {};
+        float vertex_tangent[ 3 ] = {};
+        float vertex_bitangent[ 3 ] = {};
+
+        for ( unsigned int j = mesh->AdjacencyOffsets[ i ]; j < mesh->AdjacencyOffsets[ i + 1 ]; ++j )
+        {
+            const unsigned int corner = mesh->AdjacencyCorners[ j ] - corner_offset;
+            const unsigned int triangle_index = corner / 3;
+            const float wedge_angle = corner_weights[ ( corner % 3 ) * frames.Stride + triangle_index ];
+
+            for ( unsigned int k = 0; k < 3; ++k )
+            {
+                vertex_normal[ k ] += normals[ k ][ triangle_index ] * wedge_angle;
+                vertex_tangent[ k ] += tangents[ k ][ triangle_index ] * wedge_angle;
+                vertex_bitangent[ k ] += bitangents[ k ][ triangle_index ] * wedge_angle;
+            }
+        }
 
-        normal = DirectX::XMVector3Normalize( normal );
+        mesh->Normals[ i ] = DirectX::XMFLOAT3( vertex_normal );
+        mesh->Tangents[ i ] = DirectX::XMFLOAT3( vertex_tangent );
+        mesh->Bitangents[ i ] = DirectX::XMFLOAT3( vertex_bitangent );
 
-        DirectX::XMStoreFloat3( &mesh->Normals[ i ], normal );
-        DirectX::XMStoreFloat3( &mesh->Tangents[ i ], DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( normal, bitangent ), normal ) ) );
-        DirectX::XMStoreFloat3( &mesh->Bitangents[ i ], DirectX::XMVector3Normalize( DirectX::XMVector3Cross( DirectX::XMVector3Cross( normal, tangent ), normal ) ) );
+        NormalizeNormalAndTangents( mesh, i );
     }
 }
-void UpdateNormalsAndTangents( CMesh* mesh, unsigned int sub_mesh_index, const DirectX::XMFLOAT4X4* bone_transformations )
+void SkinSubMeshPositions( const CMesh* mesh, const CMesh::SSubMesh& sub_mesh, const DirectX::XMFLOAT4X4* bone_transformations, unsigned int vertex_begin, unsigned int vertex_end, DirectX::XMFLOAT3* sub_mesh_positions )
 {
-    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
-
-    DirectX::XMFLOAT3* sub_mesh_positions = new DirectX::XMFLOAT3[ sub_mesh.VertexCount ];
-    for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+    for ( unsigned int i = vertex_begin; i < vertex_end; ++i )
     {
         DirectX::XMVECTOR base_position = DirectX::XMLoadFloat3( &mesh->Positions[ sub_mesh.VertexOffset + i ] );
 
@@ -111,61 +103,252 @@ void UpdateNormalsAndTangents( CMesh* mesh, unsigned int sub_mesh_index, const D
         }
         DirectX::XMStoreFloat3( &sub_mesh_positions[ i ], skin_position );
     }
+}
 
-    CalculateNormalsAndTangents( mesh, sub_mesh_index, sub_mesh_positions );
+// Calculates the normals and tangents of the sub mesh from the positions in the workspace
+void CalculateSkinnedNormalsAndTangents( CMesh* mesh, SMeshWorkspace* workspace, unsigned int sub_mesh_index, ETriangleCornerWeighting corner_weighting, CTaskPool* task_pool )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
 
-    delete[] sub_mesh_positions;
+    // The frames of a smaller sub mesh use a smaller stride within the same block
+    STriangleFrames frames;
+    InitializeTriangleFrames( frames, sub_mesh.TriangleCount, workspace->TriangleFrames.Data );
+
+    const ETriangleKernel triangle_kernel = GetTriangleKernel();
+    ParallelFor( task_pool, sub_mesh.TriangleCount, TRIANGLE_BATCH_SIZE, [ mesh, &sub_mesh, workspace, triangle_kernel, corner_weighting, &frames ]( unsigned int begin, unsigned int end )
+    {
+        CalculateTriangleFrames( triangle_kernel, corner_weighting, mesh->Indices + sub_mesh.TriangleOffset * 3, &workspace->SkinnedPositions[ 0 ].x, mesh->TriangleUVs + sub_mesh.TriangleOffset, mesh->TriangleCount, begin, end, frames );
+    } );
+    ParallelFor( task_pool, sub_mesh.VertexCount, VERTEX_BATCH_SIZE, [ mesh, sub_mesh_index, &frames ]( unsigned int begin, unsigned int end )
+    {
+        CalculateNormalsAndTangentsGather( mesh, sub_mesh_index, frames, begin, end );
+    } );
 }
+static const uint8_t VERTEX_FLAG_SKIN = 1;
+static const uint8_t VERTEX_FLAG_GATHER = 2;
 
-void CreateNodeHierarchy( const aiScene* scene, const aiNode* node, CMesh::SNode& mesh_node, const std::unordered_map<std::string, unsigned int>& bone_index_map, const std::vector<DirectX::XMFLOAT4X4>& bone_offsets )
+bool IsBoneDirty( const DirectX::XMFLOAT4X4& bone_transformation, const DirectX::XMFLOAT4X4& previous_bone_transformation, float tolerance )
 {
-    std::string node_name( node->mName.C_Str() );
+    for ( unsigned int i = 0; i < 4; ++i )
+    {
+        for ( unsigned int j = 0; j < 4; ++j )
+        {
+            if ( !( fabsf( bone_transformation.m[ i ][ j ] - previous_bone_transformation.m[ i ][ j ] ) <= tolerance ) )
+                return true;
+        }
+    }
+    return false;
+}
 
-    aiMatrix4x4 transformation = node->mTransformation;
-    transformation.Transpose();
-    mesh_node.Transformation = DirectX::XMFLOAT4X4( &transformation.a1 );
+// Runs the function over consecutive runs of the sorted list, split over the task pool
+template< typename TFunction >
+void ParallelForRuns( CTaskPool* pool, const unsigned int* list, unsigned int count, unsigned int batch_size, const TFunction& function )
+{
+    ParallelFor( pool, count, batch_size, [ list, &function ]( unsigned int begin, unsigned int end )
+    {
+        for ( unsigned int i = begin; i < end; ++i )
+        {
+            const unsigned int run_begin = list[ i ];
+            while ( i + 1 < end && list[ i + 1 ] == list[ i ] + 1 )
+            {
+                ++i;
+            }
+            function( run_begin, list[ i ] + 1 );
+        }
+    } );
+}
 
-    mesh_node.AnimationChannels = new unsigned int[ scene->mNumAnimations ];
-    for ( unsigned int i = 0; i < scene->mNumAnimations; ++i )
+void UpdateNormalsAndTangents( CMesh* mesh, SMeshWorkspace* workspace, unsigned int sub_mesh_index, const DirectX::XMFLOAT4X4* bone_transformations, CTaskPool* task_pool )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+    assert( sub_mesh.VertexCount <= workspace->VertexCapacity && sub_mesh.TriangleCount <= workspace->TriangleCapacity );
+
+    if ( workspace->PreviousSubMeshIndex != sub_mesh_index || workspace->PreviousCornerWeighting != workspace->CornerWeighting )
     {
-        mesh_node.AnimationChannels[ i ] = INVALID_INDEX;
-        for ( unsigned int j = 0; j < scene->mAnimations[ i ]->mNumChannels; ++j )
+        ParallelFor( task_pool, sub_mesh.VertexCount, VERTEX_BATCH_SIZE, [ mesh, &sub_mesh, bone_transformations, workspace ]( unsigned int begin, unsigned int end )
+        {
+            SkinSubMeshPositions( mesh, sub_mesh, bone_transformations, begin, end, workspace->SkinnedPositions );
+        } );
+
+        CalculateSkinnedNormalsAndTangents( mesh, workspace, sub_mesh_index, workspace->CornerWeighting, task_pool );
+
+        memcpy( workspace->PreviousBoneTransformations, bone_transformations, workspace->BoneCapacity * sizeof( DirectX::XMFLOAT4X4 ) );
+        workspace->PreviousSubMeshIndex = sub_mesh_index;
+        workspace->PreviousCornerWeighting = workspace->CornerWeighting;
+        workspace->DirtyBoneCount = workspace->BoneCapacity;
+        workspace->SkinnedVertexCount = sub_mesh.VertexCount;
+        workspace->UpdatedTriangleCount = sub_mesh.TriangleCount;
+        workspace->UpdatedVertexCount = sub_mesh.VertexCount;
+        return;
+    }
+
+    // Only the dirty bones are remembered, so slow motion below the tolerance still adds up until the bone is dirty
+    unsigned int dirty_bone_count = 0;
+    unsigned int skin_vertex_count = 0;
+    const unsigned int* influence_vertices_begin = workspace->InfluenceVertices;
+    for ( unsigned int i = 0; i < workspace->BoneCapacity; ++i )
+    {
+        if ( !IsBoneDirty( bone_transformations[ i ], workspace->PreviousBoneTransformations[ i ], workspace->BoneTolerance ) )
+            continue;
+
+        workspace->PreviousBoneTransformations[ i ] = bone_transformations[ i ];
+        ++dirty_bone_count;
+
+        const unsigned int* influence_vertices_end = influence_vertices_begin + workspace->InfluenceOffsets[ i + 1 ];
+        for ( const unsigned int* it = std::lower_bound( influence_vertices_begin + workspace->InfluenceOffsets[ i ], influence_vertices_end, sub_mesh.VertexOffset ); it != influence_vertices_end && *it < sub_mesh.VertexOffset + sub_mesh.VertexCount; ++it )
         {
-            if ( scene->mAnimations[ i ]->mChannels[ j ]->mNodeName == node->mName )
+            const unsigned int vertex_index = *it - sub_mesh.VertexOffset;
+            skin_vertex_count += workspace->VertexFlags[ vertex_index ] == 0 ? 1 : 0;
+            workspace->VertexFlags[ vertex_index ] = VERTEX_FLAG_SKIN;
+        }
+    }
+
+    // Past this point the one-ring grows to most of the sub mesh, so everything is recomputed as it costs less
+    if ( skin_vertex_count > sub_mesh.VertexCount * MESH_WORKSPACE_FULL_UPDATE_RATIO )
+    {
+        memset( workspace->VertexFlags, 0, sub_mesh.VertexCount * sizeof( uint8_t ) );
+        workspace->PreviousSubMeshIndex = INVALID_INDEX;
+        UpdateNormalsAndTangents( mesh, workspace, sub_mesh_index, bone_transformations, task_pool );
+        workspace->DirtyBoneCount = dirty_bone_count;
+        return;
+    }
+
+    // The lists are built by scanning the flags, which keeps them sorted without sorting. Sorted lists form long
+    // runs for the vector kernels and keep the memory accesses in order.
+    unsigned int frame_triangle_count = 0;
+    unsigned int gather_vertex_count = 0;
+    if ( skin_vertex_count > 0 )
+    {
+        // Every triangle around a moved vertex changes, and with it every vertex of those triangles
+        skin_vertex_count = 0;
+        for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+        {
+            if ( workspace->VertexFlags[ i ] == 0 )
+                continue;
+
+            workspace->SkinVertices[ skin_vertex_count++ ] = i;
+            for ( unsigned int j = mesh->AdjacencyOffsets[ sub_mesh.VertexOffset + i ]; j < mesh->AdjacencyOffsets[ sub_mesh.VertexOffset + i + 1 ]; ++j )
             {
-                mesh_node.AnimationChannels[ i ] = j;
-                break;
+                workspace->TriangleFlags[ mesh->AdjacencyCorners[ j ] / 3 - sub_mesh.TriangleOffset ] = 1;
             }
         }
+        for ( unsigned int i = 0; i < sub_mesh.TriangleCount; ++i )
+        {
+            if ( workspace->TriangleFlags[ i ] == 0 )
+                continue;
+
+            workspace->TriangleFlags[ i ] = 0;
+            workspace->FrameTriangles[ frame_triangle_count++ ] = i;
+            for ( unsigned int j = 0; j < 3; ++j )
+            {
+                workspace->VertexFlags[ mesh->Indices[ ( sub_mesh.TriangleOffset + i ) * 3 + j ] ] |= VERTEX_FLAG_GATHER;
+            }
+        }
+        for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+        {
+            if ( workspace->VertexFlags[ i ] == 0 )
+                continue;
+
+            workspace->VertexFlags[ i ] = 0;
+            workspace->GatherVertices[ gather_vertex_count++ ] = i;
+        }
     }
 
-    if ( bone_index_map.find( node_name ) != bone_index_map.end() )
+    ParallelForRuns( task_pool, workspace->SkinVertices, skin_vertex_count, VERTEX_BATCH_SIZE, [ mesh, &sub_mesh, bone_transformations, workspace ]( unsigned int begin, unsigned int end )
     {
-        mesh_node.BoneIndex = bone_index_map.at( node_name );
-        mesh_node.BoneOffset = bone_offsets[ mesh_node.BoneIndex ];
+        SkinSubMeshPositions( mesh, sub_mesh, bone_transformations, begin, end, workspace->SkinnedPositions );
+    } );
+
+    STriangleFrames frames;
+    InitializeTriangleFrames( frames, sub_mesh.TriangleCount, workspace->TriangleFrames.Data );
+
+    const ETriangleKernel triangle_kernel = GetTriangleKernel();
+    const ETriangleCornerWeighting corner_weighting = workspace->CornerWeighting;
+    ParallelForRuns( task_pool, workspace->FrameTriangles, frame_triangle_count, TRIANGLE_BATCH_SIZE, [ mesh, &sub_mesh, workspace, triangle_kernel, corner_weighting, &frames ]( unsigned int begin, unsigned int end )
+    {
+        CalculateTriangleFrames( triangle_kernel, corner_weighting, mesh->Indices + sub_mesh.TriangleOffset * 3, &workspace->SkinnedPositions[ 0 ].x, mesh->TriangleUVs + sub_mesh.TriangleOffset, mesh->TriangleCount, begin, end, frames );
+    } );
+    ParallelForRuns( task_pool, workspace->GatherVertices, gather_vertex_count, VERTEX_BATCH_SIZE, [ mesh, sub_mesh_index, &frames ]( unsigned int begin, unsigned int end )
+    {
+        CalculateNormalsAndTangentsGather( mesh, sub_mesh_index, frames, begin, end );
+    } );
+
+    workspace->DirtyBoneCount = dirty_bone_count;
+    workspace->SkinnedVertexCount = skin_vertex_count;
+    workspace->UpdatedTriangleCount = frame_triangle_count;
+    workspace->UpdatedVertexCount = gather_vertex_count;
+}
+
+typedef std::unordered_multimap<std::string, unsigned int> NodeIndex;
+
+unsigned int CountNodes( const aiNode* node )
+{
+    unsigned int node_count = 1;
+    for ( unsigned int i = 0; i < node->mNumChildren; ++i )
+    {
+        node_count += CountNodes( node->mChildren[ i ] );
     }
-    else
+    return node_count;
+}
+
+// Appends the node and then its subtrees, so the parent of every node comes before it
+void FlattenNodeHierarchy( const aiScene* scene, const aiNode* node, unsigned int parent, CMesh* mesh, unsigned int& node_count, NodeIndex& node_index )
+{
+    const unsigned int index = node_count++;
+    node_index.emplace( std::string( node->mName.C_Str() ), index );
+
+    aiMatrix4x4 transformation = node->mTransformation;
+    transformation.Transpose();
+    mesh->NodeTransformations[ index ] = DirectX::XMFLOAT4X4( &transformation.a1 );
+    mesh->NodeParents[ index ] = parent;
+    mesh->NodeBoneIndices[ index ] = INVALID_INDEX;
+
+    for ( unsigned int i = 0; i < scene->mNumAnimations; ++i )
     {
-        mesh_node.BoneIndex = INVALID_INDEX;
-        DirectX::XMStoreFloat4x4( &mesh_node.BoneOffset, DirectX::XMMatrixIdentity() );
+        mesh->NodeAnimationChannels[ i * mesh->NodeCount + index ] = INVALID_INDEX;
     }
 
-    mesh_node.ChildCount = node->mNumChildren;
-    mesh_node.Children = new CMesh::SNode[ mesh_node.ChildCount ];
-    for ( unsigned int i = 0; i < mesh_node.ChildCount; ++i )
+    for ( unsigned int i = 0; i < node->mNumChildren; ++i )
     {
-        CreateNodeHierarchy( scene, node->mChildren[ i ], mesh_node.Children[ i ], bone_index_map, bone_offsets );
+        FlattenNodeHierarchy( scene, node->mChildren[ i ], index, mesh, node_count, node_index );
     }
 }
-void DestroyNodeHierarchy( CMesh::SNode& mesh_node )
+void BindNodeHierarchy( const aiScene* scene, const NodeIndex& node_index, const std::unordered_map<std::string, unsigned int>& bone_index_map, const std::vector<DirectX::XMFLOAT4X4>& bone_offsets, CMesh* mesh )
 {
-    for ( unsigned int i = 0; i < mesh_node.ChildCount; ++i )
+    // Nodes are looked up by name once per channel and once per bone instead of comparing every node against every channel
+    for ( unsigned int i = 0; i < scene->mNumAnimations; ++i )
     {
-        DestroyNodeHierarchy( mesh_node.Children[ i ] );
+        unsigned int* animation_channels = mesh->NodeAnimationChannels + i * mesh->NodeCount;
+        for ( unsigned int j = 0; j < scene->mAnimations[ i ]->mNumChannels; ++j )
+        {
+            auto range = node_index.equal_range( std::string( scene->mAnimations[ i ]->mChannels[ j ]->mNodeName.C_Str() ) );
+            for ( auto it = range.first; it != range.second; ++it )
+            {
+                // The first channel targeting a node wins
+                if ( animation_channels[ it->second ] == INVALID_INDEX )
+                {
+                    animation_channels[ it->second ] = j;
+                }
+            }
+        }
     }
 
-    delete[] mesh_node.AnimationChannels;
-    delete[] mesh_node.Children;
+    // A bone is driven by the last node with its name in depth first order, which is the one whose transformation
+    // evaluating the nodes in order keeps
+    for ( const auto& bone : bone_index_map )
+    {
+        unsigned int last_node = INVALID_INDEX;
+        auto range = node_index.equal_range( bone.first );
+        for ( auto it = range.first; it != range.second; ++it )
+        {
+            last_node = last_node != INVALID_INDEX ? std::max( last_node, it->second ) : it->second;
+        }
+        if ( last_node != INVALID_INDEX )
+        {
+            mesh->NodeBoneIndices[ last_node ] = bone.second;
+        }
+        mesh->BoneOffsets[ bone.second ] = bone_offsets[ bone.second ];
+    }
 }
 
 void CalculateBoundingBox( const aiScene* scene, const aiNode* node, DirectX::XMMATRIX parent_transformation, DirectX::XMVECTOR& bounding_box_min, DirectX::XMVECTOR& bounding_box_max )
@@ -193,484 +376,923 @@ void CalculateBoundingBox( const aiScene* scene, const aiNode* node, DirectX::XM
     }
 }
 
-unsigned int FindBoneWeightIndex( unsigned int bone_index, unsigned int* bone_indices )
-{
-    for ( unsigned int i = 0; i < BONE_WEIGHTS_PER_VERTEX; ++i )
-    {
-        if ( bone_index == bone_indices[ i ] )
-        {
-            return i;
-        }
-    }
-    return INVALID_INDEX;
-}
-float GetBoneWeight( unsigned int bone_weight_index, float* bone_weights )
-{
-    return bone_weight_index == INVALID_INDEX ? 0 : bone_weights[ bone_weight_index ];
-}
-
-CMesh* LoadMesh( const char* filepath )
+void CalculateAdjacency( CMesh* mesh, unsigned int sub_mesh_index )
 {
-    CMesh* mesh = new CMesh();
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
 
-    Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile( filepath, aiProcessPreset_TargetRealtime_Quality | aiProcess_FlipUVs );
-    assert( scene != nullptr && scene->mNumMeshes > 0 );
+    const unsigned int corner_begin = sub_mesh.TriangleOffset * 3;
+    const unsigned int corner_end = ( sub_mesh.TriangleOffset + sub_mesh.TriangleCount ) * 3;
 
-    mesh->VertexCount = 0;
-    mesh->TriangleCount = 0;
+    // The sub mesh only writes the end offsets of its own vertices. Its first start offset is the end offset
+    // of the previous sub mesh, or the zero written by ImportMesh.
+    unsigned int* vertex_offsets = mesh->AdjacencyOffsets + sub_mesh.VertexOffset + 1;
+    memset( vertex_offsets, 0, sub_mesh.VertexCount * sizeof( unsigned int ) );
 
-    mesh->SubMeshCount = scene->mNumMeshes;
-    mesh->SubMeshes = new CMesh::SSubMesh[ mesh->SubMeshCount ];
-    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    for ( unsigned int i = corner_begin; i < corner_end; ++i )
     {
-        mesh->SubMeshes[ i ].VertexOffset = mesh->VertexCount;
-        mesh->SubMeshes[ i ].VertexCount = scene->mMeshes[ i ]->mNumVertices;
-        mesh->SubMeshes[ i ].TriangleOffset = mesh->TriangleCount;
-        mesh->SubMeshes[ i ].TriangleCount = scene->mMeshes[ i ]->mNumFaces;
+        ++vertex_offsets[ mesh->Indices[ i ] ];
+    }
 
-        mesh->VertexCount += scene->mMeshes[ i ]->mNumVertices;
-        mesh->TriangleCount += scene->mMeshes[ i ]->mNumFaces;
+    // Turn the counts into start offsets shifted one vertex ahead. Filling the corners in increasing order
+    // then advances every shifted start offset to the end offset of its vertex.
+    unsigned int offset = corner_begin;
+    for ( unsigned int i = 0; i < sub_mesh.VertexCount; ++i )
+    {
+        unsigned int corner_count = vertex_offsets[ i ];
+        vertex_offsets[ i ] = offset;
+        offset += corner_count;
     }
+    assert( offset == corner_end );
 
-    mesh->Positions = new DirectX::XMFLOAT3[ mesh->VertexCount ];
-    mesh->TextureCoords = new DirectX::XMFLOAT2[ mesh->VertexCount ];
-    mesh->Normals = new DirectX::XMFLOAT3[ mesh->VertexCount ];
-    mesh->Tangents = new DirectX::XMFLOAT3[ mesh->VertexCount ];
-    mesh->Bitangents = new DirectX::XMFLOAT3[ mesh->VertexCount ];
-    mesh->BoneWeights = new float[ mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX ];
-    mesh->BoneIndices = new unsigned int[ mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX ];
-    mesh->TangentDeformFactors = new float[ mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX ];
-    mesh->BitangentDeformFactors = new float[ mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX ];
-    memset( mesh->BoneWeights, 0, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX * sizeof( float ) );
-    memset( mesh->BoneIndices, 0, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX * sizeof( unsigned int ) );
-    memset( mesh->TangentDeformFactors, 0, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX * sizeof( float ) );
-    memset( mesh->BitangentDeformFactors, 0, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX * sizeof( float ) );
+    for ( unsigned int i = corner_begin; i < corner_end; ++i )
+    {
+        mesh->AdjacencyCorners[ vertex_offsets[ mesh->Indices[ i ] ]++ ] = i;
+    }
+}
 
-    mesh->Indices = new unsigned int[ mesh->TriangleCount * 3 ];
+void ImportSubMesh( const aiScene* scene, CMesh* mesh, unsigned int sub_mesh_index, const std::vector<unsigned int>& mesh_bone_indices )
+{
+    const aiMesh* scene_mesh = scene->mMeshes[ sub_mesh_index ];
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
 
-    std::unordered_map<std::string, unsigned int> bone_index_map;
-    std::vector<DirectX::XMFLOAT4X4> bone_offsets;
+    assert( scene_mesh->HasPositions() &&
+            scene_mesh->HasTextureCoords( 0 ) &&
+            scene_mesh->HasNormals() &&
+            scene_mesh->HasBones() &&
+            scene_mesh->HasFaces() );
 
-    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
     {
-        assert( scene->mMeshes[ i ]->HasPositions() &&
-                scene->mMeshes[ i ]->HasTextureCoords( 0 ) &&
-                scene->mMeshes[ i ]->HasNormals() &&
-                scene->mMeshes[ i ]->HasBones() &&
-                scene->mMeshes[ i ]->HasFaces() );
-
-        const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ i ];
-
-        for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
-        {
-            mesh->Positions[ sub_mesh.VertexOffset + j ].x = scene->mMeshes[ i ]->mVertices[ j ].x;
-            mesh->Positions[ sub_mesh.VertexOffset + j ].y = scene->mMeshes[ i ]->mVertices[ j ].y;
-            mesh->Positions[ sub_mesh.VertexOffset + j ].z = scene->mMeshes[ i ]->mVertices[ j ].z;
-        }
-        for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
-        {
-            mesh->TextureCoords[ sub_mesh.VertexOffset + j ].x = scene->mMeshes[ i ]->mTextureCoords[ 0 ][ j ].x;
-            mesh->TextureCoords[ sub_mesh.VertexOffset + j ].y = scene->mMeshes[ i ]->mTextureCoords[ 0 ][ j ].y;
-        }
-        if ( scene->mMeshes[ i ]->HasBones() )
+        mesh->Positions[ sub_mesh.VertexOffset + j ].x = scene_mesh->mVertices[ j ].x;
+        mesh->Positions[ sub_mesh.VertexOffset + j ].y = scene_mesh->mVertices[ j ].y;
+        mesh->Positions[ sub_mesh.VertexOffset + j ].z = scene_mesh->mVertices[ j ].z;
+    }
+    for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
+    {
+        mesh->TextureCoords[ sub_mesh.VertexOffset + j ].x = scene_mesh->mTextureCoords[ 0 ][ j ].x;
+        mesh->TextureCoords[ sub_mesh.VertexOffset + j ].y = scene_mesh->mTextureCoords[ 0 ][ j ].y;
+    }
+    if ( scene_mesh->HasBones() )
+    {
+        for ( unsigned int j = 0; j < scene_mesh->mNumBones; ++j )
         {
-            for ( unsigned int j = 0; j < scene->mMeshes[ i ]->mNumBones; ++j )
+            unsigned int bone_index = mesh_bone_indices[ j ];
+
+            for ( unsigned int k = 0; k < scene_mesh->mBones[ j ]->mNumWeights; ++k )
             {
-                unsigned int bone_index = 0;
-                std::string bone_name = std::string( scene->mMeshes[ i ]->mBones[ j ]->mName.C_Str() );
-                if ( bone_index_map.find( bone_name ) == bone_index_map.end() )
-                {
-                    bone_index = static_cast< unsigned int >( bone_index_map.size() );
-                    bone_index_map[ bone_name ] = bone_index;
+                unsigned int vertex_index = scene_mesh->mBones[ j ]->mWeights[ k ].mVertexId;
+                float bone_weight = scene_mesh->mBones[ j ]->mWeights[ k ].mWeight;
+                assert( bone_weight != 0 );
 
-                    aiMatrix4x4 offset_matrix = scene->mMeshes[ i ]->mBones[ j ]->mOffsetMatrix;
-                    offset_matrix.Transpose();
-                    bone_offsets.push_back( DirectX::XMFLOAT4X4( &offset_matrix.a1 ) );
-                }
-                else
-                {
-                    bone_index = bone_index_map[ bone_name ];
-                }
+                float* bone_weights = mesh->BoneWeights + ( sub_mesh.VertexOffset + vertex_index ) * BONE_WEIGHTS_PER_VERTEX;
+                unsigned int* bone_indices = mesh->BoneIndices + ( sub_mesh.VertexOffset + vertex_index ) * BONE_WEIGHTS_PER_VERTEX;
 
-                for ( unsigned int k = 0; k < scene->mMeshes[ i ]->mBones[ j ]->mNumWeights; ++k )
+                for ( unsigned int l = 0; l < BONE_WEIGHTS_PER_VERTEX; ++l )
                 {
-                    unsigned int vertex_index = scene->mMeshes[ i ]->mBones[ j ]->mWeights[ k ].mVertexId;
-                    float bone_weight = scene->mMeshes[ i ]->mBones[ j ]->mWeights[ k ].mWeight;
-                    assert( bone_weight != 0 );
-
-                    float* bone_weights = mesh->BoneWeights + ( sub_mesh.VertexOffset + vertex_index ) * BONE_WEIGHTS_PER_VERTEX;
-                    unsigned int* bone_indices = mesh->BoneIndices + ( sub_mesh.VertexOffset + vertex_index ) * BONE_WEIGHTS_PER_VERTEX;
-
-                    for ( unsigned int l = 0; l < BONE_WEIGHTS_PER_VERTEX; ++l )
+                    if ( bone_weights[ l ] == 0 )
                     {
-                        if ( bone_weights[ l ] == 0 )
-                        {
-                            bone_weights[ l ] = bone_weight;
-                            bone_indices[ l ] = bone_index;
-                            break;
-                        }
+                        bone_weights[ l ] = bone_weight;
+                        bone_indices[ l ] = bone_index;
+                        break;
                     }
                 }
             }
-            for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
-            {
-                float* bone_weights = mesh->BoneWeights + ( sub_mesh.VertexOffset + j ) * BONE_WEIGHTS_PER_VERTEX;
-                unsigned int* bone_indices = mesh->BoneIndices + ( sub_mesh.VertexOffset + j ) * BONE_WEIGHTS_PER_VERTEX;
+        }
+        for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
+        {
+            float* bone_weights = mesh->BoneWeights + ( sub_mesh.VertexOffset + j ) * BONE_WEIGHTS_PER_VERTEX;
+            unsigned int* bone_indices = mesh->BoneIndices + ( sub_mesh.VertexOffset + j ) * BONE_WEIGHTS_PER_VERTEX;
 
-                // Make sure the sum of all weights is 1
-                float bone_weight_sum = 0;
+            // Make sure the sum of all weights is 1
+            float bone_weight_sum = 0;
+            for ( unsigned int k = 0; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+            {
+                bone_weight_sum += bone_weights[ k ];
+            }
+            if ( bone_weight_sum == 0 )
+            {
+                bone_weights[ 0 ] = 1.0f;
+            }
+            else
+            {
                 for ( unsigned int k = 0; k < BONE_WEIGHTS_PER_VERTEX; ++k )
                 {
-                    bone_weight_sum += bone_weights[ k ];
+                    bone_weights[ k ] /= bone_weight_sum;
                 }
-                if ( bone_weight_sum == 0 )
+            }
+
+            // Sort bone weights
+            for ( unsigned int k = 1; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+            {
+                for ( unsigned int l = k; l > 0 && bone_weights[ l - 1 ] < bone_weights[ l ]; --l )
                 {
-                    bone_weights[ 0 ] = 1.0f;
+                    std::swap( bone_weights[ l - 1 ], bone_weights[ l ] );
+                    std::swap( bone_indices[ l - 1 ], bone_indices[ l ] );
                 }
-                else
+            }
+        }
+    }
+    for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
+    {
+        assert( scene_mesh->mFaces[ j ].mNumIndices == 3 );
+        mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 0 ] = scene_mesh->mFaces[ j ].mIndices[ 0 ];
+        mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 1 ] = scene_mesh->mFaces[ j ].mIndices[ 1 ];
+        mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 2 ] = scene_mesh->mFaces[ j ].mIndices[ 2 ];
+    }
+
+    CalculateAdjacency( mesh, sub_mesh_index );
+    CalculateTriangleUVs( mesh->Indices + sub_mesh.TriangleOffset * 3, &mesh->TextureCoords[ sub_mesh.VertexOffset ].x, 0, sub_mesh.TriangleCount, mesh->TriangleUVs + sub_mesh.TriangleOffset, mesh->TriangleCount );
+}
+
+// Deform factors of the vertices in [vertex_begin, vertex_end) of the sub mesh. Only the bones of the vertex itself can receive
+// a contribution, so instead of the bone union of every incident triangle only those are looked up. Contributions are summed
+// per vertex in the same triangle order as the scatter reference in GatherValidation.cpp.
+void CalculateDeformFactorsGather( CMesh* mesh, unsigned int sub_mesh_index, const STriangleFrames& frames, unsigned int vertex_begin, unsigned int vertex_end )
+{
+    const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    const float* gradients[ 2 ][ 3 ] =
+    {
+        { GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_0_X ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_0_Y ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_0_Z ) },
+        { GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_1_X ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_1_Y ), GetTriangleFrameStream( frames, TRIANGLE_FRAME_GRADIENT_1_Z ) }
+    };
+    const float* corner_weights = GetTriangleFrameStream( frames, TRIANGLE_FRAME_CORNER_WEIGHT_0 );
+
+    const unsigned int corner_offset = sub_mesh.TriangleOffset * 3;
+    for ( unsigned int i = sub_mesh.VertexOffset + vertex_begin; i < sub_mesh.VertexOffset + vertex_end; ++i )
+    {
+        float tangent_deform_factors[ DEFORM_FACTORS_PER_VERTEX ] = {};
+        float bitangent_deform_factors[ DEFORM_FACTORS_PER_VERTEX ] = {};
+        float deform_factor_sums[ DEFORM_FACTORS_PER_VERTEX ] = {};
+
+        const DirectX::XMFLOAT3 tangent = mesh->Tangents[ i ];
+        const DirectX::XMFLOAT3 bitangent = mesh->Bitangents[ i ];
+
+        // A bone is found at its first weight index, so later duplicates of a bone index never receive a deform factor
+        const unsigned int* vertex_bone_indices = mesh->BoneIndices + i * BONE_WEIGHTS_PER_VERTEX;
+        bool is_first_weight_index[ BONE_WEIGHTS_PER_VERTEX ];
+        for ( unsigned int l = 0; l < BONE_WEIGHTS_PER_VERTEX; ++l )
+        {
+            is_first_weight_index[ l ] = std::find( vertex_bone_indices, vertex_bone_indices + l, vertex_bone_indices[ l ] ) == vertex_bone_indices + l;
+        }
+
+        for ( unsigned int j = mesh->AdjacencyOffsets[ i ]; j < mesh->AdjacencyOffsets[ i + 1 ]; ++j )
+        {
+            const unsigned int corner = mesh->AdjacencyCorners[ j ] - corner_offset;
+            const unsigned int triangle_index = corner / 3;
+
+            const float* bone_weights[ 3 ];
+            const unsigned int* bone_indices[ 3 ];
+            for ( unsigned int k = 0; k < 3; ++k )
+            {
+                const unsigned int index = mesh->Indices[ corner_offset + triangle_index * 3 + k ] + sub_mesh.VertexOffset;
+                bone_weights[ k ] = mesh->BoneWeights + index * BONE_WEIGHTS_PER_VERTEX;
+                bone_indices[ k ] = mesh->BoneIndices + index * BONE_WEIGHTS_PER_VERTEX;
+            }
+
+            const float wedge_angle = corner_weights[ ( corner % 3 ) * frames.Stride + triangle_index ];
+
+            for ( unsigned int l = 1; l < BONE_WEIGHTS_PER_VERTEX; ++l )
+            {
+                if ( !is_first_weight_index[ l ] )
+                    continue;
+
+                // Same weights as the triangle bone union, where only bones with a weight somewhere on the triangle take part
+                const unsigned int bone_index = vertex_bone_indices[ l ];
+                float w[ 3 ] = {};
+                bool is_weighted = false;
+                for ( unsigned int k = 0; k < 3; ++k )
                 {
-                    for ( unsigned int k = 0; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+                    bool is_found = false;
+                    for ( unsigned int n = 0; n < BONE_WEIGHTS_PER_VERTEX; ++n )
                     {
-                        bone_weights[ k ] /= bone_weight_sum;
+                        if ( bone_indices[ k ][ n ] != bone_index )
+                            continue;
+                        if ( !is_found )
+                        {
+                            w[ k ] = bone_weights[ k ][ n ];
+                            is_found = true;
+                        }
+                        is_weighted |= bone_weights[ k ][ n ] != 0;
                     }
                 }
 
-                // Sort bone weights
-                for ( unsigned int k = 1; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+                float dw0 = w[ 1 ] - w[ 0 ];
+                float dw1 = w[ 2 ] - w[ 0 ];
+
+                if ( !is_weighted || ( dw0 == 0 && dw1 == 0 ) )
+                    continue;
+
+                float weight_gradient[ 3 ];
+                for ( unsigned int k = 0; k < 3; ++k )
                 {
-                    for ( unsigned int l = k; l > 0 && bone_weights[ l - 1 ] < bone_weights[ l ]; --l )
-                    {
-                        std::swap( bone_weights[ l - 1 ], bone_weights[ l ] );
-                        std::swap( bone_indices[ l - 1 ], bone_indices[ l ] );
-                    }
+                    weight_gradient[ k ] = gradients[ 0 ][ k ][ triangle_index ] * dw0 + gradients[ 1 ][ k ][ triangle_index ] * dw1;
                 }
+
+                tangent_deform_factors[ l - 1 ] += ( tangent.x * weight_gradient[ 0 ] + tangent.y * weight_gradient[ 1 ] + tangent.z * weight_gradient[ 2 ] ) * wedge_angle;
+                bitangent_deform_factors[ l - 1 ] += ( bitangent.x * weight_gradient[ 0 ] + bitangent.y * weight_gradient[ 1 ] + bitangent.z * weight_gradient[ 2 ] ) * wedge_angle;
+                deform_factor_sums[ l - 1 ] += wedge_angle;
             }
         }
-        for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
+
+        for ( unsigned int j = 0; j < DEFORM_FACTORS_PER_VERTEX; ++j )
         {
-            assert( scene->mMeshes[ i ]->mFaces[ j ].mNumIndices == 3 );
-            mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 0 ] = scene->mMeshes[ i ]->mFaces[ j ].mIndices[ 0 ];
-            mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 1 ] = scene->mMeshes[ i ]->mFaces[ j ].mIndices[ 1 ];
-            mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 2 ] = scene->mMeshes[ i ]->mFaces[ j ].mIndices[ 2 ];
+            if ( deform_factor_sums[ j ] > 0 )
+            {
+                tangent_deform_factors[ j ] /= deform_factor_sums[ j ];
+                bitangent_deform_factors[ j ] /= deform_factor_sums[ j ];
+            }
+            mesh->TangentDeformFactors[ i * DEFORM_FACTORS_PER_VERTEX + j ] = tangent_deform_factors[ j ];
+            mesh->BitangentDeformFactors[ i * DEFORM_FACTORS_PER_VERTEX + j ] = bitangent_deform_factors[ j ];
         }
-
-        CalculateNormalsAndTangents( mesh, i, mesh->Positions + sub_mesh.VertexOffset );
     }
+}
 
-    // Calculate deform factors
-    std::vector<float> deform_factor_sums( mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX, 0 );
-    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
-    {
-        const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ i ];
+size_t CalculatePackedAnimationBytes( const CMesh::SAnimation& animation )
+{
+    return animation.FrameCount * sizeof( double ) + animation.ChannelCount * sizeof( CMesh::SAnimation::SChannel ) + animation.KeyCount * 4 * sizeof( uint16_t );
+}
 
-        for ( unsigned int j = 0; j < sub_mesh.TriangleCount; ++j )
-        {
-            unsigned int indices[ 3 ];
-            indices[ 0 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 0 ] + sub_mesh.VertexOffset;
-            indices[ 1 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 1 ] + sub_mesh.VertexOffset;
-            indices[ 2 ] = mesh->Indices[ ( sub_mesh.TriangleOffset + j ) * 3 + 2 ] + sub_mesh.VertexOffset;
+// Rest pose of a node in depth first order, its descendants are the nodes up to SubtreeEnd
+struct SRestNode
+{
+    unsigned int            Parent;
+    unsigned int            SubtreeEnd;
+    DirectX::XMFLOAT4X4     Transformation;
+};
 
-            DirectX::XMVECTOR positions[ 3 ];
-            positions[ 0 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 0 ] ] );
-            positions[ 1 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 1 ] ] );
-            positions[ 2 ] = DirectX::XMLoadFloat3( &mesh->Positions[ indices[ 2 ] ] );
+void CollectRestNodes( const aiNode* node, unsigned int parent, DirectX::XMMATRIX parent_transformation, std::vector<SRestNode>& rest_nodes, std::unordered_multimap<std::string, unsigned int>& rest_node_index )
+{
+    const unsigned int index = static_cast< unsigned int >( rest_nodes.size() );
+    rest_node_index.emplace( std::string( node->mName.C_Str() ), index );
 
-            DirectX::XMVECTOR e0 = DirectX::XMVectorSubtract( positions[ 1 ], positions[ 0 ] );
-            DirectX::XMVECTOR e1 = DirectX::XMVectorSubtract( positions[ 2 ], positions[ 0 ] );
-            DirectX::XMVECTOR n = DirectX::XMVector3Cross( e1, e0 );
+    const DirectX::XMMATRIX local_node_transformation = DirectX::XMMatrixTranspose( DirectX::XMLoadFloat4x4( reinterpret_cast< const DirectX::XMFLOAT4X4* >( &node->mTransformation ) ) );
+    const DirectX::XMMATRIX global_node_transformation = local_node_transformation * parent_transformation;
 
-            float triangle_area = DirectX::XMVectorGetX( DirectX::XMVector3Length( n ) );
+    SRestNode rest_node;
+    rest_node.Parent = parent;
+    rest_node.SubtreeEnd = 0;
+    DirectX::XMStoreFloat4x4( &rest_node.Transformation, global_node_transformation );
+    rest_nodes.push_back( rest_node );
 
-            DirectX::XMMATRIX local_to_triangle = DirectX::XMLoadFloat3x3( &DirectX::XMFLOAT3X3(
-                DirectX::XMVectorGetX( e0 ), DirectX::XMVectorGetX( e1 ), DirectX::XMVectorGetX( n ),
-                DirectX::XMVectorGetY( e0 ), DirectX::XMVectorGetY( e1 ), DirectX::XMVectorGetY( n ),
-                DirectX::XMVectorGetZ( e0 ), DirectX::XMVectorGetZ( e1 ), DirectX::XMVectorGetZ( n ) ) );
+    for ( unsigned int i = 0; i < node->mNumChildren; ++i )
+    {
+        CollectRestNodes( node->mChildren[ i ], index, global_node_transformation, rest_nodes, rest_node_index );
+    }
+    rest_nodes[ index ].SubtreeEnd = static_cast< unsigned int >( rest_nodes.size() );
+}
 
-            DirectX::XMVECTOR determinant;
-            DirectX::XMMATRIX triangle_to_local = DirectX::XMMatrixInverse( &determinant, local_to_triangle );
+// Largest scaling of the axes of a row vector transformation
+float CalculateMaxAxisScale( const DirectX::XMFLOAT4X4& transformation )
+{
+    float max_scale = 0.0f;
+    for ( unsigned int r = 0; r < 3; ++r )
+    {
+        const float* row = transformation.m[ r ];
+        max_scale = std::max( max_scale, sqrtf( row[ 0 ] * row[ 0 ] + row[ 1 ] * row[ 1 ] + row[ 2 ] * row[ 2 ] ) );
+    }
+    return max_scale;
+}
 
-            std::vector<bool> bone_weights_done( bone_offsets.size(), false );
-            for ( unsigned int k = 0; k < 3; ++k )
-            {
-                for ( unsigned int l = 0; l < BONE_WEIGHTS_PER_VERTEX; ++l )
-                {
-                    if ( mesh->BoneWeights[ indices[ k ] * BONE_WEIGHTS_PER_VERTEX + l ] == 0 )
-                        continue;
+float CalculateDistance( const DirectX::XMFLOAT4X4& a, const DirectX::XMFLOAT4X4& b )
+{
+    const float x = a.m[ 3 ][ 0 ] - b.m[ 3 ][ 0 ];
+    const float y = a.m[ 3 ][ 1 ] - b.m[ 3 ][ 1 ];
+    const float z = a.m[ 3 ][ 2 ] - b.m[ 3 ][ 2 ];
+    return sqrtf( x * x + y * y + z * z );
+}
 
-                    unsigned int bone_index = mesh->BoneIndices[ indices[ k ] * BONE_WEIGHTS_PER_VERTEX + l ];
+// How far a change of the local transformation of a node moves the joints in world space. Translations are scaled
+// by the parent, rotations and scalings count at the farthest descendant joint, at the length of the bone for leaves
+// and at lone_node_reach for nodes without parent or children.
+struct SNodeReach
+{
+    float                   ParentScale;
+    float                   Reach;
+};
 
-                    if ( bone_weights_done[ bone_index ] )
-                        continue;
-                    bone_weights_done[ bone_index ] = true;
+void CalculateNodeReaches( const std::vector<SRestNode>& rest_nodes, float lone_node_reach, std::vector<SNodeReach>& node_reaches )
+{
+    node_reaches.resize( rest_nodes.size() );
+    for ( unsigned int i = 0; i < rest_nodes.size(); ++i )
+    {
+        const SRestNode& rest_node = rest_nodes[ i ];
+        SNodeReach& node_reach = node_reaches[ i ];
+        node_reach.ParentScale = rest_node.Parent != INVALID_INDEX ? CalculateMaxAxisScale( rest_nodes[ rest_node.Parent ].Transformation ) : 1.0f;
+        node_reach.Reach = 0.0f;
+        for ( unsigned int j = i + 1; j < rest_node.SubtreeEnd; ++j )
+        {
+            node_reach.Reach = std::max( node_reach.Reach, CalculateDistance( rest_node.Transformation, rest_nodes[ j ].Transformation ) );
+        }
+        if ( node_reach.Reach == 0.0f )
+        {
+            node_reach.Reach = rest_node.Parent != INVALID_INDEX ? CalculateDistance( rest_node.Transformation, rest_nodes[ rest_node.Parent ].Transformation ) : lone_node_reach;
+        }
+    }
+}
 
-                    unsigned int weight_indices[ 3 ];
-                    weight_indices[ 0 ] = FindBoneWeightIndex( bone_index, mesh->BoneIndices + indices[ 0 ] * BONE_WEIGHTS_PER_VERTEX );
-                    weight_indices[ 1 ] = FindBoneWeightIndex( bone_index, mesh->BoneIndices + indices[ 1 ] * BONE_WEIGHTS_PER_VERTEX );
-                    weight_indices[ 2 ] = FindBoneWeightIndex( bone_index, mesh->BoneIndices + indices[ 2 ] * BONE_WEIGHTS_PER_VERTEX );
+void ImportAnimationKeys( const aiAnimation* scene_animation, SAnimationKeys& animation_keys )
+{
+    animation_keys.Channels.resize( scene_animation->mNumChannels );
+    for ( unsigned int j = 0; j < scene_animation->mNumChannels; ++j )
+    {
+        const aiNodeAnim* scene_channel = scene_animation->mChannels[ j ];
+        SAnimationKeys::SChannel& channel = animation_keys.Channels[ j ];
 
-                    float w0 = GetBoneWeight( weight_indices[ 0 ], mesh->BoneWeights + indices[ 0 ] * BONE_WEIGHTS_PER_VERTEX );
-                    float w1 = GetBoneWeight( weight_indices[ 1 ], mesh->BoneWeights + indices[ 1 ] * BONE_WEIGHTS_PER_VERTEX );
-                    float w2 = GetBoneWeight( weight_indices[ 2 ], mesh->BoneWeights + indices[ 2 ] * BONE_WEIGHTS_PER_VERTEX );
+        channel.TranslationKeyTimestamps.resize( scene_channel->mNumPositionKeys );
+        channel.TranslationKeys.resize( scene_channel->mNumPositionKeys );
+        for ( unsigned int k = 0; k < scene_channel->mNumPositionKeys; ++k )
+        {
+            channel.TranslationKeyTimestamps[ k ] = scene_channel->mPositionKeys[ k ].mTime;
+            channel.TranslationKeys[ k ].x = scene_channel->mPositionKeys[ k ].mValue.x;
+            channel.TranslationKeys[ k ].y = scene_channel->mPositionKeys[ k ].mValue.y;
+            channel.TranslationKeys[ k ].z = scene_channel->mPositionKeys[ k ].mValue.z;
+        }
 
-                    float dw0 = w1 - w0;
-                    float dw1 = w2 - w0;
+        channel.RotationKeyTimestamps.resize( scene_channel->mNumRotationKeys );
+        channel.RotationKeys.resize( scene_channel->mNumRotationKeys );
+        for ( unsigned int k = 0; k < scene_channel->mNumRotationKeys; ++k )
+        {
+            channel.RotationKeyTimestamps[ k ] = scene_channel->mRotationKeys[ k ].mTime;
+            channel.RotationKeys[ k ].x = scene_channel->mRotationKeys[ k ].mValue.x;
+            channel.RotationKeys[ k ].y = scene_channel->mRotationKeys[ k ].mValue.y;
+            channel.RotationKeys[ k ].z = scene_channel->mRotationKeys[ k ].mValue.z;
+            channel.RotationKeys[ k ].w = scene_channel->mRotationKeys[ k ].mValue.w;
+        }
 
-                    if ( dw0 == 0 && dw1 == 0 )
-                        continue;
+        channel.ScalingKeyTimestamps.resize( scene_channel->mNumScalingKeys );
+        channel.ScalingKeys.resize( scene_channel->mNumScalingKeys );
+        for ( unsigned int k = 0; k < scene_channel->mNumScalingKeys; ++k )
+        {
+            channel.ScalingKeyTimestamps[ k ] = scene_channel->mScalingKeys[ k ].mTime;
+            channel.ScalingKeys[ k ].x = scene_channel->mScalingKeys[ k ].mValue.x;
+            channel.ScalingKeys[ k ].y = scene_channel->mScalingKeys[ k ].mValue.y;
+            channel.ScalingKeys[ k ].z = scene_channel->mScalingKeys[ k ].mValue.z;
+        }
+    }
 
-                    DirectX::XMVECTOR weight_gradient = DirectX::XMVector3Transform( DirectX::XMVectorSet( dw0, dw1, 0, 0 ), triangle_to_local );
+    animation_keys.TicksPerSecond = scene_animation->mTicksPerSecond;
+    animation_keys.Duration = scene_animation->mDuration;
+}
 
-                    for ( unsigned int m = 0; m < 3; ++m )
-                    {
-                        unsigned int weight_index = weight_indices[ m ];
-                        if ( weight_index != INVALID_INDEX && weight_index > 0 )
-                        {
-                            DirectX::XMVECTOR e2 = DirectX::XMVectorSubtract( positions[ ( m + 1 ) % 3 ], positions[ m ] );
-                            DirectX::XMVECTOR e3 = DirectX::XMVectorSubtract( positions[ ( m + 2 ) % 3 ], positions[ m ] );
-                            float wedge_angle = DirectX::XMVectorGetX( DirectX::XMVector3AngleBetweenVectors( e2, e3 ) ) * triangle_area;
+// Channels played by several nodes take the largest reach of them. A node plays the first channel of the animation
+// that targets its name, so later channels with the same name are never played and keep their keys.
+void AssignChannelReaches( const aiAnimation* scene_animation, const std::unordered_multimap<std::string, unsigned int>& rest_node_index, const std::vector<SNodeReach>& node_reaches, SAnimationKeys& animation_keys )
+{
+    std::unordered_map<std::string, unsigned int> played_channels;
+    for ( unsigned int j = 0; j < scene_animation->mNumChannels; ++j )
+    {
+        SAnimationKeys::SChannel& channel = animation_keys.Channels[ j ];
+        channel.ParentScale = -1.0f;
+        channel.Reach = -1.0f;
 
-                            DirectX::XMVECTOR tangent = DirectX::XMLoadFloat3( mesh->Tangents + indices[ m ] );
-                            DirectX::XMVECTOR bitangent = DirectX::XMLoadFloat3( mesh->Bitangents + indices[ m ] );
+        const std::string node_name( scene_animation->mChannels[ j ]->mNodeName.C_Str() );
+        if ( !played_channels.emplace( node_name, j ).second )
+            continue;
 
-                            unsigned int deform_factor_index = indices[ m ] * DEFORM_FACTORS_PER_VERTEX + weight_index - 1;
-                            mesh->TangentDeformFactors[ deform_factor_index ] += DirectX::XMVectorGetX( DirectX::XMVector3Dot( tangent, weight_gradient ) ) * wedge_angle;
-                            mesh->BitangentDeformFactors[ deform_factor_index ] += DirectX::XMVectorGetX( DirectX::XMVector3Dot( bitangent, weight_gradient ) ) * wedge_angle;
-                            deform_factor_sums[ deform_factor_index ] += wedge_angle;
-                        }
-                    }
-                }
-            }
+        auto range = rest_node_index.equal_range( node_name );
+        for ( auto it = range.first; it != range.second; ++it )
+        {
+            channel.ParentScale = std::max( channel.ParentScale, node_reaches[ it->second ].ParentScale );
+            channel.Reach = std::max( channel.Reach, node_reaches[ it->second ].Reach );
         }
     }
-    for ( unsigned int i = 0; i < mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX; ++i )
+}
+
+void AllocateMeshArrays( SArena& arena, CMesh* mesh, const aiScene* scene, const std::vector<SAnimationKeys>& animation_keys, char** clip_data, SMeshMemoryReport* report )
+{
+    mesh->SubMeshes = ArenaAllocate<CMesh::SSubMesh>( arena, mesh->SubMeshCount );
+
+    mesh->Positions = ArenaAllocate<DirectX::XMFLOAT3>( arena, mesh->VertexCount );
+    mesh->TextureCoords = ArenaAllocate<DirectX::XMFLOAT2>( arena, mesh->VertexCount );
+    mesh->Normals = ArenaAllocate<DirectX::XMFLOAT3>( arena, mesh->VertexCount );
+    mesh->Tangents = ArenaAllocate<DirectX::XMFLOAT3>( arena, mesh->VertexCount );
+    mesh->Bitangents = ArenaAllocate<DirectX::XMFLOAT3>( arena, mesh->VertexCount );
+    mesh->BoneWeights = ArenaAllocate<float>( arena, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX );
+    mesh->BoneIndices = ArenaAllocate<unsigned int>( arena, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX );
+    mesh->TangentDeformFactors = ArenaAllocate<float>( arena, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    mesh->BitangentDeformFactors = ArenaAllocate<float>( arena, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    const size_t vertex_end = arena.AllocatedSize;
+
+    mesh->Indices = ArenaAllocate<unsigned int>( arena, mesh->TriangleCount * 3 );
+    const size_t index_end = arena.AllocatedSize;
+    mesh->AdjacencyOffsets = ArenaAllocate<unsigned int>( arena, mesh->VertexCount + 1 );
+    mesh->AdjacencyCorners = ArenaAllocate<unsigned int>( arena, mesh->TriangleCount * 3 );
+    const size_t adjacency_end = arena.AllocatedSize;
+    mesh->TriangleUVs = ArenaAllocate<float>( arena, mesh->TriangleCount * TRIANGLE_UV_STREAM_COUNT );
+    const size_t triangle_uv_end = arena.AllocatedSize;
+
+    // Every animation is one block that PackAnimationClip fills
+    mesh->Animations = ArenaAllocate<CMesh::SAnimation>( arena, scene->mNumAnimations );
+    for ( unsigned int i = 0; i < scene->mNumAnimations; ++i )
     {
-        if ( deform_factor_sums[ i ] > 0 )
-        {
-            mesh->TangentDeformFactors[ i ] /= deform_factor_sums[ i ];
-            mesh->BitangentDeformFactors[ i ] /= deform_factor_sums[ i ];
-        }
+        clip_data[ i ] = ArenaAllocate<char>( arena, CalculateAnimationClipSize( animation_keys[ i ] ) );
     }
+    const size_t animation_end = arena.AllocatedSize;
+
+    mesh->NodeParents = ArenaAllocate<unsigned int>( arena, mesh->NodeCount );
+    mesh->NodeTransformations = ArenaAllocate<DirectX::XMFLOAT4X4>( arena, mesh->NodeCount );
+    mesh->NodeAnimationChannels = ArenaAllocate<unsigned int>( arena, mesh->NodeCount * scene->mNumAnimations );
+    mesh->NodeBoneIndices = ArenaAllocate<unsigned int>( arena, mesh->NodeCount );
+    mesh->BoneOffsets = ArenaAllocate<DirectX::XMFLOAT4X4>( arena, mesh->BoneCount );
+
+    mesh->AnimatedNodeCounts = ArenaAllocate<unsigned int>( arena, scene->mNumAnimations );
+    mesh->AnimatedNodes = ArenaAllocate<unsigned int>( arena, mesh->NodeCount * scene->mNumAnimations );
+    mesh->AnimatedNodeParents = ArenaAllocate<unsigned int>( arena, mesh->NodeCount * scene->mNumAnimations );
+    mesh->AnimatedChannelCounts = ArenaAllocate<unsigned int>( arena, scene->mNumAnimations );
+    mesh->AnimatedChannelPositions = ArenaAllocate<unsigned int>( arena, mesh->NodeCount * scene->mNumAnimations );
+    mesh->StaticNodeTransformations = ArenaAllocate<DirectX::XMFLOAT4X4>( arena, mesh->NodeCount );
+    mesh->StaticBoneTransformations = ArenaAllocate<DirectX::XMFLOAT4X4>( arena, mesh->BoneCount );
+
+    if ( report != nullptr )
+    {
+        report->VertexBytes = vertex_end;
+        report->IndexBytes = index_end - vertex_end;
+        report->AdjacencyBytes = adjacency_end - index_end;
+        report->TriangleUVBytes = triangle_uv_end - adjacency_end;
+        report->AnimationBytes = animation_end - triangle_uv_end;
+        report->HierarchyBytes = arena.AllocatedSize - animation_end;
+    }
+}
 
-    mesh->AnimationCount = scene->mNumAnimations;
-    mesh->Animations = new CMesh::SAnimation[ mesh->AnimationCount ];
-    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+CMesh* ImportMesh( const char* filepath, CTaskPool* task_pool, SMeshLoadReport* report )
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    CMesh* mesh = new CMesh();
+
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile( filepath, IMPORT_FLAGS );
+    assert( scene != nullptr && scene->mNumMeshes > 0 );
+
+    mesh->VertexCount = 0;
+    mesh->TriangleCount = 0;
+
+    mesh->SubMeshCount = scene->mNumMeshes;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
     {
-        CMesh::SAnimation& animation = mesh->Animations[ i ];
+        mesh->VertexCount += scene->mMeshes[ i ]->mNumVertices;
+        mesh->TriangleCount += scene->mMeshes[ i ]->mNumFaces;
+    }
+    mesh->AnimationCount = scene->mNumAnimations;
+    mesh->NodeCount = CountNodes( scene->mRootNode );
 
-        animation.ChannelCount = scene->mAnimations[ i ]->mNumChannels;
-        animation.Channels = new CMesh::SAnimation::SChannel[ animation.ChannelCount ];
-        for ( unsigned int j = 0; j < animation.ChannelCount; ++j )
-        {
-            CMesh::SAnimation::SChannel& channel = animation.Channels[ j ];
+    // Bone indices are assigned up front in sub mesh order so that they do not depend on task scheduling
+    std::unordered_map<std::string, unsigned int> bone_index_map;
+    std::vector<DirectX::XMFLOAT4X4> bone_offsets;
+    std::vector< std::vector<unsigned int> > sub_mesh_bone_indices( mesh->SubMeshCount );
 
-            channel.TranslationKeyCount = scene->mAnimations[ i ]->mChannels[ j ]->mNumPositionKeys;
-            channel.TranslationKeyTimestamps = new double[ channel.TranslationKeyCount ];
-            channel.TranslationKeys = new DirectX::XMFLOAT3[ channel.TranslationKeyCount ];
-            for ( unsigned int k = 0; k < channel.TranslationKeyCount; ++k )
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        sub_mesh_bone_indices[ i ].resize( scene->mMeshes[ i ]->mNumBones );
+        for ( unsigned int j = 0; j < scene->mMeshes[ i ]->mNumBones; ++j )
+        {
+            unsigned int bone_index = 0;
+            std::string bone_name = std::string( scene->mMeshes[ i ]->mBones[ j ]->mName.C_Str() );
+            if ( bone_index_map.find( bone_name ) == bone_index_map.end() )
             {
-                channel.TranslationKeyTimestamps[ k ] = scene->mAnimations[ i ]->mChannels[ j ]->mPositionKeys[ k ].mTime;
-                channel.TranslationKeys[ k ].x = scene->mAnimations[ i ]->mChannels[ j ]->mPositionKeys[ k ].mValue.x;
-                channel.TranslationKeys[ k ].y = scene->mAnimations[ i ]->mChannels[ j ]->mPositionKeys[ k ].mValue.y;
-                channel.TranslationKeys[ k ].z = scene->mAnimations[ i ]->mChannels[ j ]->mPositionKeys[ k ].mValue.z;
-            }
+                bone_index = static_cast< unsigned int >( bone_index_map.size() );
+                bone_index_map[ bone_name ] = bone_index;
 
-            channel.RotationKeyCount = scene->mAnimations[ i ]->mChannels[ j ]->mNumRotationKeys;
-            channel.RotationKeyTimestamps = new double[ channel.RotationKeyCount ];
-            channel.RotationKeys = new DirectX::XMFLOAT4[ channel.RotationKeyCount ];
-            for ( unsigned int k = 0; k < channel.RotationKeyCount; ++k )
-            {
-                channel.RotationKeyTimestamps[ k ] = scene->mAnimations[ i ]->mChannels[ j ]->mRotationKeys[ k ].mTime;
-                channel.RotationKeys[ k ].x = scene->mAnimations[ i ]->mChannels[ j ]->mRotationKeys[ k ].mValue.x;
-                channel.RotationKeys[ k ].y = scene->mAnimations[ i ]->mChannels[ j ]->mRotationKeys[ k ].mValue.y;
-                channel.RotationKeys[ k ].z = scene->mAnimations[ i ]->mChannels[ j ]->mRotationKeys[ k ].mValue.z;
-                channel.RotationKeys[ k ].w = scene->mAnimations[ i ]->mChannels[ j ]->mRotationKeys[ k ].mValue.w;
+                aiMatrix4x4 offset_matrix = scene->mMeshes[ i ]->mBones[ j ]->mOffsetMatrix;
+                offset_matrix.Transpose();
+                bone_offsets.push_back( DirectX::XMFLOAT4X4( &offset_matrix.a1 ) );
             }
-
-            channel.ScalingKeyCount = scene->mAnimations[ i ]->mChannels[ j ]->mNumScalingKeys;
-            channel.ScalingKeyTimestamps = new double[ channel.ScalingKeyCount ];
-            channel.ScalingKeys = new DirectX::XMFLOAT3[ channel.ScalingKeyCount ];
-            for ( unsigned int k = 0; k < channel.ScalingKeyCount; ++k )
+            else
             {
-                channel.ScalingKeyTimestamps[ k ] = scene->mAnimations[ i ]->mChannels[ j ]->mScalingKeys[ k ].mTime;
-                channel.ScalingKeys[ k ].x = scene->mAnimations[ i ]->mChannels[ j ]->mScalingKeys[ k ].mValue.x;
-                channel.ScalingKeys[ k ].y = scene->mAnimations[ i ]->mChannels[ j ]->mScalingKeys[ k ].mValue.y;
-                channel.ScalingKeys[ k ].z = scene->mAnimations[ i ]->mChannels[ j ]->mScalingKeys[ k ].mValue.z;
+                bone_index = bone_index_map[ bone_name ];
             }
+            sub_mesh_bone_indices[ i ][ j ] = bone_index;
         }
-
-        animation.TicksPerSecond = scene->mAnimations[ i ]->mTicksPerSecond;
-        animation.Duration = scene->mAnimations[ i ]->mDuration;
     }
 
-    CreateNodeHierarchy( scene, scene->mRootNode, mesh->Root, bone_index_map, bone_offsets );
+    mesh->BoneCount = static_cast< unsigned int >( bone_index_map.size() );
+
+    STaskCounter task_counter;
+
+    // The clips are sized by the keys that survive the reduction, so the animations are imported and reduced
+    // before the arena is measured
+    std::vector<SAnimationKeys> animation_keys( mesh->AnimationCount );
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        SubmitTask( task_pool, &task_counter, [ scene, i, &animation_keys ]()
+        {
+            ImportAnimationKeys( scene->mAnimations[ i ], animation_keys[ i ] );
+        } );
+    }
 
     DirectX::XMVECTOR bounding_box_min = DirectX::XMVectorSet( FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX );
     DirectX::XMVECTOR bounding_box_max = DirectX::XMVectorSet( -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX );
-    CalculateBoundingBox( scene, scene->mRootNode, DirectX::XMMatrixIdentity(), bounding_box_min, bounding_box_max );
-    DirectX::XMStoreFloat3( &mesh->BoundingBoxCenter, DirectX::XMVectorScale( DirectX::XMVectorAdd( bounding_box_max, bounding_box_min ), 0.5f ) );
-    DirectX::XMStoreFloat3( &mesh->BoundingBoxExtent, DirectX::XMVectorScale( DirectX::XMVectorSubtract( bounding_box_max, bounding_box_min ), 0.5f ) );
+    SubmitTask( task_pool, &task_counter, [ scene, &bounding_box_min, &bounding_box_max ]()
+    {
+        CalculateBoundingBox( scene, scene->mRootNode, DirectX::XMMatrixIdentity(), bounding_box_min, bounding_box_max );
+    } );
+
+    WaitForTasks( task_pool, &task_counter );
+
+    // The tolerance follows the size of the mesh, so it does not depend on the units of the asset
+    const float mesh_size = DirectX::XMVectorGetX( DirectX::XMVector3Length( DirectX::XMVectorSubtract( bounding_box_max, bounding_box_min ) ) );
+    std::vector<SRestNode> rest_nodes;
+    std::unordered_multimap<std::string, unsigned int> rest_node_index;
+    std::vector<SNodeReach> node_reaches;
+    CollectRestNodes( scene->mRootNode, INVALID_INDEX, DirectX::XMMatrixIdentity(), rest_nodes, rest_node_index );
+    CalculateNodeReaches( rest_nodes, mesh_size, node_reaches );
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        AssignChannelReaches( scene->mAnimations[ i ], rest_node_index, node_reaches, animation_keys[ i ] );
+    }
+    ReduceAnimationKeys( animation_keys.data(), mesh->AnimationCount, KEY_REDUCTION_TOLERANCE * mesh_size, task_pool, &report->KeyReduction );
+
+    // The packed tracks cannot address a longer timeline, so such an animation fails the import before anything
+    // is allocated for it
+    report->KeyReduction.MaxFrameCount = 0;
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        report->KeyReduction.MaxFrameCount = std::max( report->KeyReduction.MaxFrameCount, CountAnimationFrames( animation_keys[ i ] ) );
+    }
+    if ( report->KeyReduction.MaxFrameCount > MAX_ANIMATION_FRAME_COUNT )
+    {
+        delete mesh;
+        return nullptr;
+    }
+
+    // Measure first, then sub-allocate every array of the mesh from one block
+    std::vector<char*> clip_data( mesh->AnimationCount );
+    SArena arena = {};
+    AllocateMeshArrays( arena, mesh, scene, animation_keys, clip_data.data(), &mesh->MemoryReport );
+    CreateArena( arena, arena.Size );
+    AllocateMeshArrays( arena, mesh, scene, animation_keys, clip_data.data(), nullptr );
+    mesh->Arena = arena.Data;
+    mesh->MemoryReport.TotalBytes = arena.Capacity;
+    mesh->MemoryReport.PaddingBytes = arena.Capacity - arena.AllocatedSize;
+
+    unsigned int vertex_offset = 0;
+    unsigned int triangle_offset = 0;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        mesh->SubMeshes[ i ].VertexOffset = vertex_offset;
+        mesh->SubMeshes[ i ].VertexCount = scene->mMeshes[ i ]->mNumVertices;
+        mesh->SubMeshes[ i ].TriangleOffset = triangle_offset;
+        mesh->SubMeshes[ i ].TriangleCount = scene->mMeshes[ i ]->mNumFaces;
 
+        vertex_offset += scene->mMeshes[ i ]->mNumVertices;
+        triangle_offset += scene->mMeshes[ i ]->mNumFaces;
+    }
+
+    memset( mesh->BoneWeights, 0, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX * sizeof( float ) );
+    memset( mesh->BoneIndices, 0, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX * sizeof( unsigned int ) );
+    memset( mesh->TangentDeformFactors, 0, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX * sizeof( float ) );
+    memset( mesh->BitangentDeformFactors, 0, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX * sizeof( float ) );
+    mesh->AdjacencyOffsets[ 0 ] = 0;
+
+    // Each sub mesh owns a disjoint range of vertices and triangles, so they can be imported independently
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        SubmitTask( task_pool, &task_counter, [ scene, mesh, i, &sub_mesh_bone_indices ]()
+        {
+            ImportSubMesh( scene, mesh, i, sub_mesh_bone_indices[ i ] );
+        } );
+    }
+
+    // The static node transformations include the inverse root transformation
     aiMatrix4x4 root_transformation = scene->mRootNode->mTransformation;
     root_transformation.Inverse();
     root_transformation.Transpose();
     mesh->InverseRootTransformation = DirectX::XMFLOAT4X4( &root_transformation.a1 );
 
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        SubmitTask( task_pool, &task_counter, [ mesh, i, &animation_keys, &clip_data ]()
+        {
+            PackAnimationClip( animation_keys[ i ], clip_data[ i ], &mesh->Animations[ i ] );
+        } );
+    }
+
+    SubmitTask( task_pool, &task_counter, [ scene, mesh, &bone_index_map, &bone_offsets ]()
+    {
+        NodeIndex node_index;
+        unsigned int node_count = 0;
+        FlattenNodeHierarchy( scene, scene->mRootNode, INVALID_INDEX, mesh, node_count, node_index );
+        BindNodeHierarchy( scene, node_index, bone_index_map, bone_offsets, mesh );
+        ClassifyStaticNodes( mesh );
+    } );
+
+    WaitForTasks( task_pool, &task_counter );
+
+    report->KeyReduction.PackedBytes = 0;
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        report->KeyReduction.PackedBytes += CalculatePackedAnimationBytes( mesh->Animations[ i ] );
+    }
+
+    report->ImportSeconds = GetElapsedSeconds( start );
+
+    // The triangle frames and the gather passes compute every triangle and vertex on their own, so the
+    // results are bit-identical no matter how the work is split across threads or which kernel runs
+    unsigned int max_triangle_count = 0;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        max_triangle_count = std::max( max_triangle_count, mesh->SubMeshes[ i ].TriangleCount );
+    }
+    std::vector<float> triangle_frame_data( CalculateTriangleFramesSize( max_triangle_count ) / sizeof( float ) );
+
+    const ETriangleKernel triangle_kernel = GetTriangleKernel();
+    report->TriangleKernel = triangle_kernel;
+    report->NormalsAndTangentsSeconds = 0;
+    report->DeformFactorsSeconds = 0;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ i ];
+
+        STriangleFrames frames;
+        InitializeTriangleFrames( frames, sub_mesh.TriangleCount, triangle_frame_data.data() );
+
+        std::chrono::steady_clock::time_point stage_start = std::chrono::steady_clock::now();
+        ParallelFor( task_pool, sub_mesh.TriangleCount, TRIANGLE_BATCH_SIZE, [ mesh, &sub_mesh, triangle_kernel, &frames ]( unsigned int begin, unsigned int end )
+        {
+            CalculateTriangleFrames( triangle_kernel, TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA, mesh->Indices + sub_mesh.TriangleOffset * 3, &mesh->Positions[ sub_mesh.VertexOffset ].x, mesh->TriangleUVs + sub_mesh.TriangleOffset, mesh->TriangleCount, begin, end, frames );
+        } );
+        ParallelFor( task_pool, sub_mesh.VertexCount, VERTEX_BATCH_SIZE, [ mesh, i, &frames ]( unsigned int begin, unsigned int end )
+        {
+            CalculateNormalsAndTangentsGather( mesh, i, frames, begin, end );
+        } );
+        report->NormalsAndTangentsSeconds += GetElapsedSeconds( stage_start );
+
+        stage_start = std::chrono::steady_clock::now();
+        ParallelFor( task_pool, sub_mesh.VertexCount, VERTEX_BATCH_SIZE, [ mesh, i, &frames ]( unsigned int begin, unsigned int end )
+        {
+            CalculateDeformFactorsGather( mesh, i, frames, begin, end );
+        } );
+        report->DeformFactorsSeconds += GetElapsedSeconds( stage_start );
+    }
+
+    DirectX::XMStoreFloat3( &mesh->BoundingBoxCenter, DirectX::XMVectorScale( DirectX::XMVectorAdd( bounding_box_max, bounding_box_min ), 0.5f ) );
+    DirectX::XMStoreFloat3( &mesh->BoundingBoxExtent, DirectX::XMVectorScale( DirectX::XMVectorSubtract( bounding_box_max, bounding_box_min ), 0.5f ) );
+
+    mesh->SourceKey = 0;
+    mesh->CacheData = nullptr;
+
     return mesh;
 }
 
-void DestroyMesh( CMesh* mesh )
+CMesh* LoadMesh( const char* filepath, CTaskPool* task_pool, SMeshLoadReport* report )
 {
-    DestroyNodeHierarchy( mesh->Root );
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
-    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    SMeshLoadReport load_report = {};
+
+    const uint64_t cache_stamp = CalculateMeshCacheStamp( filepath, IMPORT_FLAGS );
+    const std::string cache_filepath = std::string( filepath ) + MESH_CACHE_EXTENSION;
+
+    CMesh* mesh = LoadMeshCache( cache_filepath.c_str(), filepath, IMPORT_FLAGS, cache_stamp );
+    load_report.LoadedFromCache = mesh != nullptr;
+    if ( mesh == nullptr )
     {
-        const CMesh::SAnimation& animation = mesh->Animations[ i ];
-        for ( unsigned int j = 0; j < animation.ChannelCount; ++j )
+        mesh = ImportMesh( filepath, task_pool, &load_report );
+        if ( mesh != nullptr )
         {
-            const CMesh::SAnimation::SChannel& channel = animation.Channels[ j ];
-            delete[] channel.TranslationKeyTimestamps;
-            delete[] channel.TranslationKeys;
-            delete[] channel.RotationKeyTimestamps;
-            delete[] channel.RotationKeys;
-            delete[] channel.ScalingKeyTimestamps;
-            delete[] channel.ScalingKeys;
+            mesh->SourceKey = CalculateMeshCacheKey( filepath, IMPORT_FLAGS );
+            SaveMeshCache( mesh, cache_filepath.c_str(), cache_stamp );
         }
-        delete[] animation.Channels;
     }
-    delete[] mesh->Animations;
 
-    delete[] mesh->Indices;
+    load_report.TotalSeconds = GetElapsedSeconds( start );
+    if ( report != nullptr )
+    {
+        *report = load_report;
+    }
+
+    return mesh;
+}
 
-    delete[] mesh->BitangentDeformFactors;
-    delete[] mesh->TangentDeformFactors;
-    delete[] mesh->BoneIndices;
-    delete[] mesh->BoneWeights;
-    delete[] mesh->Bitangents;
-    delete[] mesh->Tangents;
-    delete[] mesh->Normals;
-    delete[] mesh->TextureCoords;
-    delete[] mesh->Positions;
+void DestroyMesh( CMesh* mesh )
+{
+    // Cached meshes live entirely inside the mapped cache file
+    if ( mesh->CacheData != nullptr )
+    {
+        UnloadMeshCache( mesh );
+        return;
+    }
 
-    delete[] mesh->SubMeshes;
+    FreeAligned( mesh->Arena );
 
     delete mesh;
     mesh = nullptr;
 }
 
-void CalculateBoneTransformations( const CMesh::SNode& mesh_node, const CMesh::SAnimation& animation, unsigned int animation_index, double animation_time, DirectX::XMMATRIX parent_transformation, DirectX::XMMATRIX inverse_root_transformation, DirectX::XMFLOAT4X4* bone_transformations )
+void AllocateMeshWorkspace( SArena& arena, SMeshWorkspace* workspace )
 {
-    DirectX::XMMATRIX local_node_transformation = DirectX::XMLoadFloat4x4( &mesh_node.Transformation );
+    workspace->SkinnedPositions = ArenaAllocate<DirectX::XMFLOAT3>( arena, workspace->VertexCapacity );
+    float* triangle_frame_data = ArenaAllocate<float>( arena, CalculateTriangleFramesSize( workspace->TriangleCapacity ) / sizeof( float ) );
+    InitializeTriangleFrames( workspace->TriangleFrames, workspace->TriangleCapacity, triangle_frame_data );
+
+    workspace->InfluenceOffsets = ArenaAllocate<unsigned int>( arena, workspace->BoneCapacity + 1 );
+    workspace->InfluenceVertices = ArenaAllocate<unsigned int>( arena, workspace->InfluenceCount );
+
+    workspace->PreviousBoneTransformations = ArenaAllocate<DirectX::XMFLOAT4X4>( arena, workspace->BoneCapacity );
+    workspace->VertexFlags = ArenaAllocate<uint8_t>( arena, workspace->VertexCapacity );
+    workspace->TriangleFlags = ArenaAllocate<uint8_t>( arena, workspace->TriangleCapacity );
+    workspace->SkinVertices = ArenaAllocate<unsigned int>( arena, workspace->VertexCapacity );
+    workspace->GatherVertices = ArenaAllocate<unsigned int>( arena, workspace->VertexCapacity );
+    workspace->FrameTriangles = ArenaAllocate<unsigned int>( arena, workspace->TriangleCapacity );
+}
 
-    const int channel_index = mesh_node.AnimationChannels[ animation_index ];
-    if ( channel_index != INVALID_INDEX )
+// The first bone of a vertex always moves it, the others only with a weight
+bool IsBoneInfluence( const CMesh* mesh, unsigned int vertex_index, unsigned int slot )
+{
+    const unsigned int* bone_indices = mesh->BoneIndices + vertex_index * BONE_WEIGHTS_PER_VERTEX;
+    const float* bone_weights = mesh->BoneWeights + vertex_index * BONE_WEIGHTS_PER_VERTEX;
+    if ( slot > 0 && bone_weights[ slot ] == 0 )
+        return false;
+
+    for ( unsigned int i = 0; i < slot; ++i )
     {
-        const CMesh::SAnimation::SChannel channel = animation.Channels[ channel_index ];
+        if ( bone_indices[ i ] == bone_indices[ slot ] && ( i == 0 || bone_weights[ i ] != 0 ) )
+            return false;
+    }
+    return true;
+}
 
-        DirectX::XMVECTOR scaling;
-        if ( channel.ScalingKeyCount == 1 )
+void InitializeMeshWorkspaceCapacity( const CMesh* mesh, SMeshWorkspace* workspace )
+{
+    workspace->VertexCapacity = 0;
+    workspace->TriangleCapacity = 0;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        workspace->VertexCapacity = std::max( workspace->VertexCapacity, mesh->SubMeshes[ i ].VertexCount );
+        workspace->TriangleCapacity = std::max( workspace->TriangleCapacity, mesh->SubMeshes[ i ].TriangleCount );
+    }
+
+    // Meshes without bones still reference the first bone
+    workspace->BoneCapacity = std::max( mesh->BoneCount, 1u );
+    workspace->InfluenceCount = 0;
+    for ( unsigned int i = 0; i < mesh->VertexCount; ++i )
+    {
+        for ( unsigned int j = 0; j < BONE_WEIGHTS_PER_VERTEX; ++j )
         {
-            scaling = DirectX::XMLoadFloat3( &channel.ScalingKeys[ 0 ] );
+            workspace->InfluenceCount += IsBoneInfluence( mesh, i, j ) ? 1 : 0;
         }
-        else
+    }
+}
+
+void CalculateBoneInfluences( const CMesh* mesh, SMeshWorkspace* workspace )
+{
+    // Same shifted counting sort as the vertex adjacency, filling in vertex order keeps every bone sorted
+    unsigned int* bone_offsets = workspace->InfluenceOffsets + 1;
+    memset( workspace->InfluenceOffsets, 0, ( workspace->BoneCapacity + 1 ) * sizeof( unsigned int ) );
+
+    for ( unsigned int i = 0; i < mesh->VertexCount; ++i )
+    {
+        for ( unsigned int j = 0; j < BONE_WEIGHTS_PER_VERTEX; ++j )
         {
-            unsigned int curr_index = channel.ScalingKeyCount - 1;
-            for ( unsigned int i = 0; i < channel.ScalingKeyCount - 1; ++i )
+            if ( IsBoneInfluence( mesh, i, j ) )
             {
-                if ( animation_time <= channel.ScalingKeyTimestamps[ i + 1 ] )
-                {
-                    curr_index = i;
-                    break;
-                }
+                ++bone_offsets[ mesh->BoneIndices[ i * BONE_WEIGHTS_PER_VERTEX + j ] ];
             }
-            unsigned int next_index = std::min( curr_index + 1, channel.ScalingKeyCount - 1 );
-
-            double curr_time = channel.ScalingKeyTimestamps[ curr_index ];
-            double next_time = channel.ScalingKeyTimestamps[ next_index ];
-            float t = static_cast< float >( ( animation_time - curr_time ) / ( next_time - curr_time ) );
-
-            DirectX::XMVECTOR curr_scaling = DirectX::XMLoadFloat3( &channel.ScalingKeys[ curr_index ] );
-            DirectX::XMVECTOR next_scaling = DirectX::XMLoadFloat3( &channel.ScalingKeys[ next_index ] );
-            scaling = DirectX::XMVectorLerp( curr_scaling, next_scaling, t );
         }
+    }
 
-        DirectX::XMVECTOR rotation;
-        if ( channel.RotationKeyCount == 1 )
-        {
-            rotation = DirectX::XMLoadFloat4( &channel.RotationKeys[ 0 ] );
-        }
-        else
+    unsigned int offset = 0;
+    for ( unsigned int i = 0; i < workspace->BoneCapacity; ++i )
+    {
+        unsigned int influence_count = bone_offsets[ i ];
+        bone_offsets[ i ] = offset;
+        offset += influence_count;
+    }
+    assert( offset == workspace->InfluenceCount );
+
+    for ( unsigned int i = 0; i < mesh->VertexCount; ++i )
+    {
+        for ( unsigned int j = 0; j < BONE_WEIGHTS_PER_VERTEX; ++j )
         {
-            unsigned int curr_index = channel.RotationKeyCount - 1;
-            for ( unsigned int i = 0; i < channel.RotationKeyCount - 1; ++i )
+            if ( IsBoneInfluence( mesh, i, j ) )
             {
-                if ( animation_time <= channel.RotationKeyTimestamps[ i + 1 ] )
-                {
-                    curr_index = i;
-                    break;
-                }
+                workspace->InfluenceVertices[ bone_offsets[ mesh->BoneIndices[ i * BONE_WEIGHTS_PER_VERTEX + j ] ]++ ] = i;
             }
-            unsigned int next_index = std::min( curr_index + 1, channel.RotationKeyCount - 1 );
+        }
+    }
+}
 
-            double curr_time = channel.RotationKeyTimestamps[ curr_index ];
-            double next_time = channel.RotationKeyTimestamps[ next_index ];
-            float t = static_cast< float >( ( animation_time - curr_time ) / ( next_time - curr_time ) );
+SMeshWorkspace* CreateMeshWorkspace( const CMesh* mesh )
+{
+    SMeshWorkspace* workspace = new SMeshWorkspace();
+    InitializeMeshWorkspaceCapacity( mesh, workspace );
 
-            DirectX::XMVECTOR curr_rotation = DirectX::XMLoadFloat4( &channel.RotationKeys[ curr_index ] );
-            DirectX::XMVECTOR next_rotation = DirectX::XMLoadFloat4( &channel.RotationKeys[ next_index ] );
-            rotation = DirectX::XMQuaternionNormalize( DirectX::XMQuaternionSlerp( curr_rotation, next_rotation, t ) );
-        }
+    SArena arena = {};
+    AllocateMeshWorkspace( arena, workspace );
+    CreateArena( arena, arena.Size );
+    AllocateMeshWorkspace( arena, workspace );
+    workspace->Data = arena.Data;
+    workspace->DataSize = arena.Capacity;
+    workspace->CornerWeighting = TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA;
+
+    CalculateBoneInfluences( mesh, workspace );
+
+    workspace->BoneTolerance = MESH_WORKSPACE_BONE_TOLERANCE;
+    memset( workspace->VertexFlags, 0, workspace->VertexCapacity * sizeof( uint8_t ) );
+    memset( workspace->TriangleFlags, 0, workspace->TriangleCapacity * sizeof( uint8_t ) );
+    InvalidateMeshWorkspace( workspace );
+
+    return workspace;
+}
+
+void InvalidateMeshWorkspace( SMeshWorkspace* workspace )
+{
+    workspace->PreviousSubMeshIndex = INVALID_INDEX;
+}
+
+void DestroyMeshWorkspace( SMeshWorkspace* workspace )
+{
+    FreeAligned( workspace->Data );
+
+    delete workspace;
+    workspace = nullptr;
+}
+
+double CalculateAngleBetweenUnitVectors( const DirectX::XMFLOAT3& a, const DirectX::XMFLOAT3& b )
+{
+    const double cos_angle = static_cast< double >( a.x ) * b.x + static_cast< double >( a.y ) * b.y + static_cast< double >( a.z ) * b.z;
+    return acos( std::min( std::max( cos_angle, -1.0 ), 1.0 ) ) * 180.0 / 3.14159265358979323846;
+}
+bool IsZero( const DirectX::XMFLOAT3& a )
+{
+    return a.x == 0 && a.y == 0 && a.z == 0;
+}
+
+void CalculateCornerWeightingReport( CMesh* mesh, SMeshWorkspace* workspace, const DirectX::XMFLOAT4X4* bone_transformations, ETriangleCornerWeighting corner_weighting, SCornerWeightingReport* report )
+{
+    memset( report, 0, sizeof( SCornerWeightingReport ) );
+    report->CornerWeighting = corner_weighting;
+    InvalidateMeshWorkspace( workspace );
+
+    std::vector<DirectX::XMFLOAT3> normals( workspace->VertexCapacity );
+    std::vector<DirectX::XMFLOAT3> tangents( workspace->VertexCapacity );
 
-        DirectX::XMVECTOR translation;
-        if ( channel.TranslationKeyCount == 1 )
+    unsigned int normal_count = 0;
+    unsigned int tangent_count = 0;
+    for ( unsigned int i = 0; i < mesh->SubMeshCount; ++i )
+    {
+        const CMesh::SSubMesh sub_mesh = mesh->SubMeshes[ i ];
+        if ( bone_transformations != nullptr )
         {
-            translation = DirectX::XMLoadFloat3( &channel.TranslationKeys[ 0 ] );
+            SkinSubMeshPositions( mesh, sub_mesh, bone_transformations, 0, sub_mesh.VertexCount, workspace->SkinnedPositions );
         }
         else
         {
-            unsigned int curr_index = channel.TranslationKeyCount - 1;
-            for ( unsigned int i = 0; i < channel.TranslationKeyCount - 1; ++i )
+            memcpy( workspace->SkinnedPositions, mesh->Positions + sub_mesh.VertexOffset, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
+        }
+
+        // The exact weighting runs last so that the mesh is left with it
+        CalculateSkinnedNormalsAndTangents( mesh, workspace, i, corner_weighting, nullptr );
+        memcpy( normals.data(), mesh->Normals + sub_mesh.VertexOffset, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
+        memcpy( tangents.data(), mesh->Tangents + sub_mesh.VertexOffset, sub_mesh.VertexCount * sizeof( DirectX::XMFLOAT3 ) );
+        CalculateSkinnedNormalsAndTangents( mesh, workspace, i, TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA, nullptr );
+
+        for ( unsigned int j = 0; j < sub_mesh.VertexCount; ++j )
+        {
+            // Vertices without any triangle with UV area have no frame to compare
+            const DirectX::XMFLOAT3& normal = mesh->Normals[ sub_mesh.VertexOffset + j ];
+            if ( !IsZero( normal ) && !IsZero( normals[ j ] ) )
             {
-                if ( animation_time <= channel.TranslationKeyTimestamps[ i + 1 ] )
-                {
-                    curr_index = i;
-                    break;
-                }
+                const double error = CalculateAngleBetweenUnitVectors( normal, normals[ j ] );
+                report->MaxNormalError = std::max( report->MaxNormalError, error );
+                report->MeanNormalError += error;
+                ++normal_count;
             }
-            unsigned int next_index = std::min( curr_index + 1, channel.TranslationKeyCount - 1 );
-
-            double curr_time = channel.TranslationKeyTimestamps[ curr_index ];
-            double next_time = channel.TranslationKeyTimestamps[ next_index ];
-            float t = static_cast< float >( ( animation_time - curr_time ) / ( next_time - curr_time ) );
 
-            DirectX::XMVECTOR curr_translation = DirectX::XMLoadFloat3( &channel.TranslationKeys[ curr_index ] );
-            DirectX::XMVECTOR next_translation = DirectX::XMLoadFloat3( &channel.TranslationKeys[ next_index ] );
-            translation = DirectX::XMVectorLerp( curr_translation, next_translation, t );
+            const DirectX::XMFLOAT3& tangent = mesh->Tangents[ sub_mesh.VertexOffset + j ];
+            if ( !IsZero( tangent ) && !IsZero( tangents[ j ] ) )
+            {
+                const double error = CalculateAngleBetweenUnitVectors( tangent, tangents[ j ] );
+                report->MaxTangentError = std::max( report->MaxTangentError, error );
+                report->MeanTangentError += error;
+                ++tangent_count;
+            }
         }
-
-        DirectX::XMMATRIX scaling_matrix = DirectX::XMMatrixScalingFromVector( scaling );
-        DirectX::XMMATRIX rotation_matrix = DirectX::XMMatrixRotationQuaternion( rotation );
-        DirectX::XMMATRIX translation_matrix = DirectX::XMMatrixTranslationFromVector( translation );
-        local_node_transformation = scaling_matrix * rotation_matrix * translation_matrix;
     }
 
-    DirectX::XMMATRIX global_node_transformation = local_node_transformation * parent_transformation;
+    report->MeanNormalError = normal_count > 0 ? report->MeanNormalError / normal_count : 0;
+    report->MeanTangentError = tangent_count > 0 ? report->MeanTangentError / tangent_count : 0;
+}
 
-    if ( mesh_node.BoneIndex != INVALID_INDEX )
-    {
-        DirectX::XMMATRIX bone_offset = DirectX::XMLoadFloat4x4( &mesh_node.BoneOffset );
-        DirectX::XMStoreFloat4x4( &bone_transformations[ mesh_node.BoneIndex ], bone_offset * global_node_transformation * inverse_root_transformation );
-    }
+size_t CalculateMeshWorkspaceSize( const CMesh* mesh )
+{
+    SMeshWorkspace workspace = {};
+    InitializeMeshWorkspaceCapacity( mesh, &workspace );
 
-    for ( unsigned int i = 0; i < mesh_node.ChildCount; ++i )
-    {
-        CalculateBoneTransformations( mesh_node.Children[ i ], animation, animation_index, animation_time, global_node_transformation, inverse_root_transformation, bone_transformations );
-    }
+    SArena arena = {};
+    AllocateMeshWorkspace( arena, &workspace );
+    return sizeof( SMeshWorkspace ) + arena.Size;
 }
-void CalculateBoneTransformations( CMesh* mesh, unsigned int animation_index, double animation_time, DirectX::XMFLOAT4X4* bone_transformations )
+
+void CalculateMeshMemoryReport( const CMesh* mesh, SMeshMemoryReport* report )
 {
-    assert( animation_index < mesh->AnimationCount );
-    const CMesh::SAnimation& animation = mesh->Animations[ animation_index ];
-    animation_time = fmod( animation_time * animation.TicksPerSecond, animation.Duration );
-    CalculateBoneTransformations( mesh->Root, animation, animation_index, animation_time, DirectX::XMMatrixIdentity(), DirectX::XMLoadFloat4x4( &mesh->InverseRootTransformation ), bone_transformations );
+    *report = mesh->MemoryReport;
+
+    // The cache file holds the same arrays plus its header, the mesh itself and its own alignment
+    if ( mesh->CacheData != nullptr )
+    {
+        report->TotalBytes = static_cast< size_t >( static_cast< const SMeshCacheHeader* >( mesh->CacheData )->Size );
+        report->PaddingBytes = report->TotalBytes - report->VertexBytes - report->IndexBytes - report->AdjacencyBytes - report->TriangleUVBytes - report->AnimationBytes - report->HierarchyBytes;
+    }
 }
\ No newline at end of file
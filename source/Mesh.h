@@ -1,10 +1,30 @@
 #pragma once
 
+#include "TriangleFrames.h"
+
 #include <DirectXMath.h>
+#include <stddef.h>
+#include <stdint.h>
 
 static const unsigned int BONE_WEIGHTS_PER_VERTEX   = 4;
 static const unsigned int DEFORM_FACTORS_PER_VERTEX = BONE_WEIGHTS_PER_VERTEX - 1;
 static const unsigned int INVALID_INDEX             = 0xFFFFFFFF;
+// Packed tracks refer to the timeline of their animation with 16-bit frame indices
+static const unsigned int MAX_ANIMATION_FRAME_COUNT = 1 << 16;
+
+class CTaskPool;
+
+struct SMeshMemoryReport
+{
+    size_t                      VertexBytes;
+    size_t                      IndexBytes;
+    size_t                      AdjacencyBytes;
+    size_t                      TriangleUVBytes;
+    size_t                      AnimationBytes;
+    size_t                      HierarchyBytes;
+    size_t                      PaddingBytes;
+    size_t                      TotalBytes;
+};
 
 class CMesh
 {
@@ -21,6 +41,7 @@ public:
 
     unsigned int                VertexCount;
     unsigned int                TriangleCount;
+    unsigned int                BoneCount;
 
     DirectX::XMFLOAT3*          Positions;
     DirectX::XMFLOAT2*          TextureCoords;
@@ -34,52 +55,186 @@ public:
 
     unsigned int*               Indices;
 
+    // Vertex to incident triangle corner adjacency in compressed sparse row form. The corners of vertex i are
+    // AdjacencyCorners[ AdjacencyOffsets[ i ] ] up to AdjacencyCorners[ AdjacencyOffsets[ i + 1 ] ], in triangle order,
+    // and each corner is an index into Indices
+    unsigned int*               AdjacencyOffsets;
+    unsigned int*               AdjacencyCorners;
+
+    // Rest pose UV coefficients per triangle, see ETriangleUVStream. Stream s of triangle i is TriangleUVs[ s * TriangleCount + i ]
+    float*                      TriangleUVs;
+
+    // The keys of an animation packed into one block, see PackAnimationClip. The tracks share a timeline of the
+    // distinct key times of the animation, and key k of a track is at FrameTimes[ KeyFrames[ KeyOffset + k ] ] with
+    // the three 16-bit words Keys[ ( KeyOffset + k ) * 3 ]. Rotations keep the index of their largest component and
+    // the other three in 15 bits each, translations and scalings are Minimum + Step * word per component. The
+    // timeline holds at most MAX_ANIMATION_FRAME_COUNT frames, and importing an animation with more distinct key
+    // times after the key reduction fails.
     struct SAnimation
     {
+        struct STrack
+        {
+            unsigned int        KeyCount;
+            unsigned int        KeyOffset;
+            DirectX::XMFLOAT3   Minimum;
+            DirectX::XMFLOAT3   Step;
+        };
         struct SChannel
         {
-            unsigned int        TranslationKeyCount;
-            double*             TranslationKeyTimestamps;
-            DirectX::XMFLOAT3*  TranslationKeys;
-
-            unsigned int        RotationKeyCount;
-            double*             RotationKeyTimestamps;
-            DirectX::XMFLOAT4*  RotationKeys;
-
-            unsigned int        ScalingKeyCount;
-            double*             ScalingKeyTimestamps;
-            DirectX::XMFLOAT3*  ScalingKeys;
+            STrack              Translation;
+            STrack              Rotation;
+            STrack              Scaling;
         };
         unsigned int            ChannelCount;
         SChannel*               Channels;
 
+        unsigned int            FrameCount;
+        double*                 FrameTimes;
+
+        unsigned int            KeyCount;
+        uint16_t*               KeyFrames;
+        uint16_t*               Keys;
+
         double                  TicksPerSecond;
         double                  Duration;
     };
     unsigned int                AnimationCount;
     SAnimation*                 Animations;
 
-    struct SNode
-    {
-        DirectX::XMFLOAT4X4     Transformation;
-
-        unsigned int*           AnimationChannels;
-
-        unsigned int            BoneIndex;
-        DirectX::XMFLOAT4X4     BoneOffset;
-
-        unsigned int            ChildCount;
-        SNode*                  Children;
-    };
-    SNode                       Root;
+    // The node hierarchy flattened in depth first order, so every node comes after its parent and one pass in order
+    // evaluates it. The root has no parent. Node i plays channel NodeAnimationChannels[ a * NodeCount + i ] of
+    // animation a and drives the bone NodeBoneIndices[ i ], and both can be INVALID_INDEX.
+    unsigned int                NodeCount;
+    unsigned int*               NodeParents;
+    DirectX::XMFLOAT4X4*        NodeTransformations;
+    unsigned int*               NodeAnimationChannels;
+    unsigned int*               NodeBoneIndices;
+
+    DirectX::XMFLOAT4X4*        BoneOffsets;
+
+    // Nodes that neither play a channel of an animation nor lie below a node that does keep their rest pose in it, so
+    // their global transformations and the transformations of their bones are the same in every animation and
+    // computed once. Animation a only walks its AnimatedNodeCounts[ a ] other nodes, AnimatedNodes[ a * NodeCount + k ]
+    // in depth first order. AnimatedNodeParents[ a * NodeCount + k ] is the position k of the parent among them, or
+    // INVALID_INDEX when the parent keeps its rest pose or the node is the root. The AnimatedChannelCounts[ a ] of
+    // them that play a channel are at the increasing positions AnimatedChannelPositions[ a * NodeCount + j ].
+    unsigned int*               AnimatedNodeCounts;
+    unsigned int*               AnimatedNodes;
+    unsigned int*               AnimatedNodeParents;
+    unsigned int*               AnimatedChannelCounts;
+    unsigned int*               AnimatedChannelPositions;
+    DirectX::XMFLOAT4X4*        StaticNodeTransformations;
+    DirectX::XMFLOAT4X4*        StaticBoneTransformations;
 
     DirectX::XMFLOAT3           BoundingBoxCenter;
     DirectX::XMFLOAT3           BoundingBoxExtent;
 
     DirectX::XMFLOAT4X4         InverseRootTransformation;
+
+    uint64_t                    SourceKey;
+
+    // All arrays above are sub-allocated from a single 64-byte aligned block, or live in the mapped cache. The pass that
+    // measures the block also sorts its bytes into the categories of the memory report.
+    void*                       Arena;
+    SMeshMemoryReport           MemoryReport;
+    void*                       CacheData;
 };
 
-CMesh* LoadMesh( const char* filepath );
+// Errors are world space distances of the joints and bone tips in the rest pose
+struct SKeyReductionReport
+{
+    unsigned int                ImportedKeyCount;
+    unsigned int                KeptKeyCount;
+    size_t                      SavedBytes;
+    size_t                      PackedBytes;
+    double                      Tolerance;
+    double                      MaxError;
+    // Frames of the longest timeline, the import fails when it exceeds MAX_ANIMATION_FRAME_COUNT
+    unsigned int                MaxFrameCount;
+};
+
+struct SMeshLoadReport
+{
+    bool                        LoadedFromCache;
+    ETriangleKernel             TriangleKernel;
+    double                      ImportSeconds;
+    double                      NormalsAndTangentsSeconds;
+    double                      DeformFactorsSeconds;
+    double                      TotalSeconds;
+    SKeyReductionReport         KeyReduction;
+};
+
+// Per instance scratch memory for UpdateNormalsAndTangents. It is sized for the largest sub mesh when created,
+// so updating any sub mesh afterwards never allocates.
+struct SMeshWorkspace
+{
+    unsigned int                VertexCapacity;
+    unsigned int                TriangleCapacity;
+    DirectX::XMFLOAT3*          SkinnedPositions;
+    STriangleFrames             TriangleFrames;
+
+    // Angle times area by default, cheaper weightings trade accuracy of the reference for speed
+    ETriangleCornerWeighting    CornerWeighting;
+
+    // Bone to vertex influence index in compressed sparse row form. The vertices of bone i are InfluenceVertices[ InfluenceOffsets[ i ] ]
+    // up to InfluenceVertices[ InfluenceOffsets[ i + 1 ] ], in increasing order, and each vertex is an index into the mesh vertices
+    unsigned int                BoneCapacity;
+    unsigned int                InfluenceCount;
+    unsigned int*               InfluenceOffsets;
+    unsigned int*               InfluenceVertices;
+
+    // Bones that moved more than the tolerance in any matrix element since they were last applied are dirty. An update
+    // of the same sub mesh with the same weighting as the previous update only recomputes what the dirty bones reach.
+    float                       BoneTolerance;
+    unsigned int                PreviousSubMeshIndex;
+    ETriangleCornerWeighting    PreviousCornerWeighting;
+    DirectX::XMFLOAT4X4*        PreviousBoneTransformations;
+    uint8_t*                    VertexFlags;
+    uint8_t*                    TriangleFlags;
+    unsigned int*               SkinVertices;
+    unsigned int*               GatherVertices;
+    unsigned int*               FrameTriangles;
+
+    // What the last update recomputed
+    unsigned int                DirtyBoneCount;
+    unsigned int                SkinnedVertexCount;
+    unsigned int                UpdatedTriangleCount;
+    unsigned int                UpdatedVertexCount;
+
+    // Everything above lives in a single 64-byte aligned block
+    void*                       Data;
+    size_t                      DataSize;
+};
+
+// Angular errors in degrees of the normals and tangents of a corner weighting against the exact one
+struct SCornerWeightingReport
+{
+    ETriangleCornerWeighting    CornerWeighting;
+    double                      MaxNormalError;
+    double                      MeanNormalError;
+    double                      MaxTangentError;
+    double                      MeanTangentError;
+};
+
+// The report is optional, and only the total is filled in when the mesh was loaded from its cache
+CMesh* LoadMesh( const char* filepath, CTaskPool* task_pool, SMeshLoadReport* report );
 void DestroyMesh( CMesh* mesh );
-void CalculateBoneTransformations( CMesh* mesh, unsigned int animation_index, double animation_time, DirectX::XMFLOAT4X4* bone_transformations );
-void UpdateNormalsAndTangents( CMesh* mesh, unsigned int sub_mesh_index, const DirectX::XMFLOAT4X4* bone_transformations );
\ No newline at end of file
+void CalculateMeshMemoryReport( const CMesh* mesh, SMeshMemoryReport* report );
+
+// Whether the bone in the slot moves the vertex, where a bone repeated in a later slot only counts once
+bool IsBoneInfluence( const CMesh* mesh, unsigned int vertex_index, unsigned int slot );
+
+SMeshWorkspace* CreateMeshWorkspace( const CMesh* mesh );
+void DestroyMeshWorkspace( SMeshWorkspace* workspace );
+size_t CalculateMeshWorkspaceSize( const CMesh* mesh );
+// Makes the next update recompute the whole sub mesh, needed after anything else wrote the mesh normals and tangents
+void InvalidateMeshWorkspace( SMeshWorkspace* workspace );
+
+// Compares all sub meshes in one pose, where null bone transformations mean the rest pose. The mesh is left with
+// the normals and tangents of the exact weighting in that pose.
+void CalculateCornerWeightingReport( CMesh* mesh, SMeshWorkspace* workspace, const DirectX::XMFLOAT4X4* bone_transformations, ETriangleCornerWeighting corner_weighting, SCornerWeightingReport* report );
+
+// Recalculates the normals, tangents and bitangents of the skinned sub mesh, split over the task pool when one is given.
+// The result does not depend on the pool and stays within a relative 1e-3 of the serial scatter reference, the
+// difference coming from the summation order.
+void UpdateNormalsAndTangents( CMesh* mesh, SMeshWorkspace* workspace, unsigned int sub_mesh_index, const DirectX::XMFLOAT4X4* bone_transformations, CTaskPool* task_pool );
\ No newline at end of file
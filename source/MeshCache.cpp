@@ -0,0 +1,377 @@
+#include "MeshCache.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+static const uint64_t FNV_PRIME        = 0x00000100000001B3ull;
+
+uint64_t HashBytes( uint64_t hash, const void* data, size_t size )
+{
+    const uint8_t* bytes = static_cast< const uint8_t* >( data );
+    for ( size_t i = 0; i < size; ++i )
+    {
+        hash ^= bytes[ i ];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t CalculateMeshCacheKey( const char* source_filepath, unsigned int import_flags )
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = HashBytes( hash, &MESH_CACHE_VERSION, sizeof( MESH_CACHE_VERSION ) );
+    hash = HashBytes( hash, &import_flags, sizeof( import_flags ) );
+
+    FILE* file = fopen( source_filepath, "rb" );
+    if ( file == nullptr )
+        return hash;
+
+    char buffer[ 64 * 1024 ];
+    size_t read_size = 0;
+    while ( ( read_size = fread( buffer, 1, sizeof( buffer ), file ) ) > 0 )
+    {
+        hash = HashBytes( hash, buffer, read_size );
+    }
+    fclose( file );
+
+    return hash;
+}
+
+uint64_t CalculateMeshCacheStamp( const char* source_filepath, unsigned int import_flags )
+{
+    uint64_t source_size = 0;
+    uint64_t source_time = 0;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+    if ( GetFileAttributesExA( source_filepath, GetFileExInfoStandard, &attributes ) )
+    {
+        source_size = ( static_cast< uint64_t >( attributes.nFileSizeHigh ) << 32 ) | attributes.nFileSizeLow;
+        source_time = ( static_cast< uint64_t >( attributes.ftLastWriteTime.dwHighDateTime ) << 32 ) | attributes.ftLastWriteTime.dwLowDateTime;
+    }
+#else
+    struct stat file_stat = {};
+    if ( stat( source_filepath, &file_stat ) == 0 )
+    {
+        source_size = static_cast< uint64_t >( file_stat.st_size );
+        source_time = static_cast< uint64_t >( file_stat.st_mtime );
+    }
+#endif
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hash = HashBytes( hash, &MESH_CACHE_VERSION, sizeof( MESH_CACHE_VERSION ) );
+    hash = HashBytes( hash, &import_flags, sizeof( import_flags ) );
+    hash = HashBytes( hash, &source_size, sizeof( source_size ) );
+    hash = HashBytes( hash, &source_time, sizeof( source_time ) );
+    return hash;
+}
+
+class CMeshCacheWriter
+{
+public:
+    std::vector<char> Data;
+
+    uint64_t Allocate( size_t size )
+    {
+        uint64_t offset = ( Data.size() + MESH_CACHE_ALIGNMENT - 1 ) & ~static_cast< uint64_t >( MESH_CACHE_ALIGNMENT - 1 );
+        Data.resize( static_cast< size_t >( offset + size ), 0 );
+        return offset;
+    }
+
+    // Returns the offset of the copied array disguised as a pointer, or null for empty arrays
+    template< typename T >
+    T* Write( const T* data, size_t count )
+    {
+        if ( data == nullptr || count == 0 )
+            return nullptr;
+        uint64_t offset = Allocate( count * sizeof( T ) );
+        memcpy( &Data[ static_cast< size_t >( offset ) ], data, count * sizeof( T ) );
+        return reinterpret_cast< T* >( offset );
+    }
+
+    template< typename T >
+    T* At( uint64_t offset )
+    {
+        return reinterpret_cast< T* >( &Data[ static_cast< size_t >( offset ) ] );
+    }
+};
+
+bool SaveMeshCache( const CMesh* mesh, const char* filepath, uint64_t stamp )
+{
+    CMeshCacheWriter writer;
+    writer.Allocate( sizeof( SMeshCacheHeader ) );
+
+    const uint64_t mesh_offset = reinterpret_cast< uint64_t >( writer.Write( mesh, 1 ) );
+
+    CMesh::SSubMesh* sub_meshes = writer.Write( mesh->SubMeshes, mesh->SubMeshCount );
+    DirectX::XMFLOAT3* positions = writer.Write( mesh->Positions, mesh->VertexCount );
+    DirectX::XMFLOAT2* texture_coords = writer.Write( mesh->TextureCoords, mesh->VertexCount );
+    DirectX::XMFLOAT3* normals = writer.Write( mesh->Normals, mesh->VertexCount );
+    DirectX::XMFLOAT3* tangents = writer.Write( mesh->Tangents, mesh->VertexCount );
+    DirectX::XMFLOAT3* bitangents = writer.Write( mesh->Bitangents, mesh->VertexCount );
+    float* bone_weights = writer.Write( mesh->BoneWeights, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX );
+    unsigned int* bone_indices = writer.Write( mesh->BoneIndices, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX );
+    float* tangent_deform_factors = writer.Write( mesh->TangentDeformFactors, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    float* bitangent_deform_factors = writer.Write( mesh->BitangentDeformFactors, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX );
+    unsigned int* indices = writer.Write( mesh->Indices, mesh->TriangleCount * 3 );
+    unsigned int* adjacency_offsets = writer.Write( mesh->AdjacencyOffsets, mesh->VertexCount + 1 );
+    unsigned int* adjacency_corners = writer.Write( mesh->AdjacencyCorners, mesh->TriangleCount * 3 );
+    float* triangle_uvs = writer.Write( mesh->TriangleUVs, mesh->TriangleCount * TRIANGLE_UV_STREAM_COUNT );
+
+    CMesh::SAnimation* animations = writer.Write( mesh->Animations, mesh->AnimationCount );
+    for ( unsigned int i = 0; i < mesh->AnimationCount; ++i )
+    {
+        const CMesh::SAnimation& animation = mesh->Animations[ i ];
+        const uint64_t animation_offset = reinterpret_cast< uint64_t >( animations ) + i * sizeof( CMesh::SAnimation );
+
+        double* frame_times = writer.Write( animation.FrameTimes, animation.FrameCount );
+        CMesh::SAnimation::SChannel* channels = writer.Write( animation.Channels, animation.ChannelCount );
+        uint16_t* key_frames = writer.Write( animation.KeyFrames, animation.KeyCount );
+        uint16_t* keys = writer.Write( animation.Keys, animation.KeyCount * 3 );
+
+        CMesh::SAnimation* cache_animation = writer.At<CMesh::SAnimation>( animation_offset );
+        cache_animation->FrameTimes = frame_times;
+        cache_animation->Channels = channels;
+        cache_animation->KeyFrames = key_frames;
+        cache_animation->Keys = keys;
+    }
+
+    unsigned int* node_parents = writer.Write( mesh->NodeParents, mesh->NodeCount );
+    DirectX::XMFLOAT4X4* node_transformations = writer.Write( mesh->NodeTransformations, mesh->NodeCount );
+    unsigned int* node_animation_channels = writer.Write( mesh->NodeAnimationChannels, mesh->NodeCount * mesh->AnimationCount );
+    unsigned int* node_bone_indices = writer.Write( mesh->NodeBoneIndices, mesh->NodeCount );
+    DirectX::XMFLOAT4X4* bone_offsets = writer.Write( mesh->BoneOffsets, mesh->BoneCount );
+    unsigned int* animated_node_counts = writer.Write( mesh->AnimatedNodeCounts, mesh->AnimationCount );
+    unsigned int* animated_nodes = writer.Write( mesh->AnimatedNodes, mesh->NodeCount * mesh->AnimationCount );
+    unsigned int* animated_node_parents = writer.Write( mesh->AnimatedNodeParents, mesh->NodeCount * mesh->AnimationCount );
+    unsigned int* animated_channel_counts = writer.Write( mesh->AnimatedChannelCounts, mesh->AnimationCount );
+    unsigned int* animated_channel_positions = writer.Write( mesh->AnimatedChannelPositions, mesh->NodeCount * mesh->AnimationCount );
+    DirectX::XMFLOAT4X4* static_node_transformations = writer.Write( mesh->StaticNodeTransformations, mesh->NodeCount );
+    DirectX::XMFLOAT4X4* static_bone_transformations = writer.Write( mesh->StaticBoneTransformations, mesh->BoneCount );
+
+    CMesh* cache_mesh = writer.At<CMesh>( mesh_offset );
+    cache_mesh->SubMeshes = sub_meshes;
+    cache_mesh->Positions = positions;
+    cache_mesh->TextureCoords = texture_coords;
+    cache_mesh->Normals = normals;
+    cache_mesh->Tangents = tangents;
+    cache_mesh->Bitangents = bitangents;
+    cache_mesh->BoneWeights = bone_weights;
+    cache_mesh->BoneIndices = bone_indices;
+    cache_mesh->TangentDeformFactors = tangent_deform_factors;
+    cache_mesh->BitangentDeformFactors = bitangent_deform_factors;
+    cache_mesh->Indices = indices;
+    cache_mesh->AdjacencyOffsets = adjacency_offsets;
+    cache_mesh->AdjacencyCorners = adjacency_corners;
+    cache_mesh->TriangleUVs = triangle_uvs;
+    cache_mesh->Animations = animations;
+    cache_mesh->NodeParents = node_parents;
+    cache_mesh->NodeTransformations = node_transformations;
+    cache_mesh->NodeAnimationChannels = node_animation_channels;
+    cache_mesh->NodeBoneIndices = node_bone_indices;
+    cache_mesh->BoneOffsets = bone_offsets;
+    cache_mesh->AnimatedNodeCounts = animated_node_counts;
+    cache_mesh->AnimatedNodes = animated_nodes;
+    cache_mesh->AnimatedNodeParents = animated_node_parents;
+    cache_mesh->AnimatedChannelCounts = animated_channel_counts;
+    cache_mesh->AnimatedChannelPositions = animated_channel_positions;
+    cache_mesh->StaticNodeTransformations = static_node_transformations;
+    cache_mesh->StaticBoneTransformations = static_bone_transformations;
+    cache_mesh->Arena = nullptr;
+    cache_mesh->CacheData = nullptr;
+
+    SMeshCacheHeader* header = writer.At<SMeshCacheHeader>( 0 );
+    header->Magic = MESH_CACHE_MAGIC;
+    header->Version = MESH_CACHE_VERSION;
+    header->Key = mesh->SourceKey;
+    header->Stamp = stamp;
+    header->Size = writer.Data.size();
+    header->PointerSize = sizeof( void* );
+    header->MeshSize = sizeof( CMesh );
+    header->MeshOffset = mesh_offset;
+
+    FILE* file = fopen( filepath, "wb" );
+    if ( file == nullptr )
+        return false;
+    size_t written_size = fwrite( writer.Data.data(), 1, writer.Data.size(), file );
+    fclose( file );
+
+    return written_size == writer.Data.size();
+}
+
+// Turns the stored offset of an array into a pointer into the mapped file, and fails when the array does not lie
+// inside the file. Arrays that were empty or missing when the cache was written stay null.
+template< typename T >
+bool FixupPointer( T*& pointer, size_t count, char* base, uint64_t size )
+{
+    if ( pointer == nullptr )
+        return true;
+
+    const uint64_t offset = reinterpret_cast< uintptr_t >( pointer );
+    if ( offset > size || count > ( size - offset ) / sizeof( T ) )
+        return false;
+    pointer = reinterpret_cast< T* >( base + offset );
+    return true;
+}
+
+// Writes the stamp into the header of the file, the mapping is private and leaves the file alone
+void RefreshMeshCacheStamp( const char* filepath, uint64_t stamp )
+{
+    FILE* file = fopen( filepath, "r+b" );
+    if ( file == nullptr )
+        return;
+    if ( fseek( file, static_cast< long >( offsetof( SMeshCacheHeader, Stamp ) ), SEEK_SET ) == 0 )
+    {
+        fwrite( &stamp, sizeof( stamp ), 1, file );
+    }
+    fclose( file );
+}
+
+void* MapMeshCache( const char* filepath, uint64_t* size )
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA( filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if ( file == INVALID_HANDLE_VALUE )
+        return nullptr;
+
+    LARGE_INTEGER file_size = {};
+    GetFileSizeEx( file, &file_size );
+    *size = static_cast< uint64_t >( file_size.QuadPart );
+
+    // Copy-on-write so the pointer fix-up never touches the file on disk
+    HANDLE mapping = *size > 0 ? CreateFileMappingA( file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr ) : nullptr;
+    CloseHandle( file );
+    if ( mapping == nullptr )
+        return nullptr;
+
+    void* data = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+    CloseHandle( mapping );
+    return data;
+#else
+    int file = open( filepath, O_RDONLY );
+    if ( file < 0 )
+        return nullptr;
+
+    struct stat file_stat = {};
+    fstat( file, &file_stat );
+    *size = static_cast< uint64_t >( file_stat.st_size );
+
+    // Private mapping so the pointer fix-up never touches the file on disk
+    void* data = *size > 0 ? mmap( nullptr, static_cast< size_t >( *size ), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0 ) : MAP_FAILED;
+    close( file );
+    return data != MAP_FAILED ? data : nullptr;
+#endif
+}
+
+void UnmapMeshCache( void* data, uint64_t size )
+{
+#ifdef _WIN32
+    ( void )size;
+    UnmapViewOfFile( data );
+#else
+    munmap( data, static_cast< size_t >( size ) );
+#endif
+}
+
+CMesh* LoadMeshCache( const char* filepath, const char* source_filepath, unsigned int import_flags, uint64_t stamp )
+{
+    uint64_t size = 0;
+    void* data = MapMeshCache( filepath, &size );
+    if ( data == nullptr )
+        return nullptr;
+
+    const SMeshCacheHeader* header = static_cast< const SMeshCacheHeader* >( data );
+    bool is_valid = size >= sizeof( SMeshCacheHeader ) &&
+                    header->Magic == MESH_CACHE_MAGIC &&
+                    header->Version == MESH_CACHE_VERSION &&
+                    header->Size == size &&
+                    header->PointerSize == sizeof( void* ) &&
+                    header->MeshSize == sizeof( CMesh ) &&
+                    header->MeshOffset <= size - sizeof( CMesh );
+    if ( is_valid && header->Stamp != stamp )
+    {
+        is_valid = header->Key == CalculateMeshCacheKey( source_filepath, import_flags );
+        if ( is_valid )
+        {
+            RefreshMeshCacheStamp( filepath, stamp );
+        }
+    }
+    if ( !is_valid )
+    {
+        UnmapMeshCache( data, size );
+        return nullptr;
+    }
+
+    char* base = static_cast< char* >( data );
+    CMesh* mesh = reinterpret_cast< CMesh* >( base + header->MeshOffset );
+
+    // The counts are the ones SaveMeshCache wrote the arrays with
+    is_valid = FixupPointer( mesh->SubMeshes, mesh->SubMeshCount, base, size ) &&
+               FixupPointer( mesh->Positions, mesh->VertexCount, base, size ) &&
+               FixupPointer( mesh->TextureCoords, mesh->VertexCount, base, size ) &&
+               FixupPointer( mesh->Normals, mesh->VertexCount, base, size ) &&
+               FixupPointer( mesh->Tangents, mesh->VertexCount, base, size ) &&
+               FixupPointer( mesh->Bitangents, mesh->VertexCount, base, size ) &&
+               FixupPointer( mesh->BoneWeights, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX, base, size ) &&
+               FixupPointer( mesh->BoneIndices, mesh->VertexCount * BONE_WEIGHTS_PER_VERTEX, base, size ) &&
+               FixupPointer( mesh->TangentDeformFactors, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX, base, size ) &&
+               FixupPointer( mesh->BitangentDeformFactors, mesh->VertexCount * DEFORM_FACTORS_PER_VERTEX, base, size ) &&
+               FixupPointer( mesh->Indices, mesh->TriangleCount * 3, base, size ) &&
+               FixupPointer( mesh->AdjacencyOffsets, mesh->VertexCount + 1, base, size ) &&
+               FixupPointer( mesh->AdjacencyCorners, mesh->TriangleCount * 3, base, size ) &&
+               FixupPointer( mesh->TriangleUVs, mesh->TriangleCount * TRIANGLE_UV_STREAM_COUNT, base, size ) &&
+               FixupPointer( mesh->Animations, mesh->AnimationCount, base, size );
+
+    for ( unsigned int i = 0; is_valid && i < mesh->AnimationCount; ++i )
+    {
+        CMesh::SAnimation& animation = mesh->Animations[ i ];
+        is_valid = FixupPointer( animation.FrameTimes, animation.FrameCount, base, size ) &&
+                   FixupPointer( animation.Channels, animation.ChannelCount, base, size ) &&
+                   FixupPointer( animation.KeyFrames, animation.KeyCount, base, size ) &&
+                   FixupPointer( animation.Keys, animation.KeyCount * 3, base, size );
+    }
+
+    const size_t node_animation_count = static_cast< size_t >( mesh->NodeCount ) * mesh->AnimationCount;
+    is_valid = is_valid &&
+               FixupPointer( mesh->NodeParents, mesh->NodeCount, base, size ) &&
+               FixupPointer( mesh->NodeTransformations, mesh->NodeCount, base, size ) &&
+               FixupPointer( mesh->NodeAnimationChannels, node_animation_count, base, size ) &&
+               FixupPointer( mesh->NodeBoneIndices, mesh->NodeCount, base, size ) &&
+               FixupPointer( mesh->BoneOffsets, mesh->BoneCount, base, size ) &&
+               FixupPointer( mesh->AnimatedNodeCounts, mesh->AnimationCount, base, size ) &&
+               FixupPointer( mesh->AnimatedNodes, node_animation_count, base, size ) &&
+               FixupPointer( mesh->AnimatedNodeParents, node_animation_count, base, size ) &&
+               FixupPointer( mesh->AnimatedChannelCounts, mesh->AnimationCount, base, size ) &&
+               FixupPointer( mesh->AnimatedChannelPositions, node_animation_count, base, size ) &&
+               FixupPointer( mesh->StaticNodeTransformations, mesh->NodeCount, base, size ) &&
+               FixupPointer( mesh->StaticBoneTransformations, mesh->BoneCount, base, size );
+    if ( !is_valid )
+    {
+        UnmapMeshCache( data, size );
+        return nullptr;
+    }
+
+    mesh->CacheData = data;
+
+    return mesh;
+}
+
+void UnloadMeshCache( CMesh* mesh )
+{
+    assert( mesh->CacheData != nullptr );
+    const SMeshCacheHeader* header = static_cast< const SMeshCacheHeader* >( mesh->CacheData );
+    UnmapMeshCache( mesh->CacheData, header->Size );
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <stdint.h>
+
+static const uint32_t MESH_CACHE_MAGIC     = 0x434D4644; // "DFMC"
+static const uint32_t MESH_CACHE_VERSION   = 10;
+static const uint32_t MESH_CACHE_ALIGNMENT = 64;
+static const char*    MESH_CACHE_EXTENSION = ".cache";
+
+// The cache file is an image of a fully built CMesh. Every pointer in the image is stored as an
+// offset from the start of the file and is fixed up in place after the file has been mapped. The key
+// is the content hash of the source asset and the stamp its size and modification time.
+struct SMeshCacheHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint64_t Stamp;
+    uint64_t Size;
+    uint32_t PointerSize;
+    uint32_t MeshSize;
+    uint64_t MeshOffset;
+};
+
+// Hashes the whole source asset together with the import settings, which becomes the SourceKey of the mesh
+uint64_t CalculateMeshCacheKey( const char* source_filepath, unsigned int import_flags );
+// Hashes the size and modification time of the source asset together with the import settings, without reading it
+uint64_t CalculateMeshCacheStamp( const char* source_filepath, unsigned int import_flags );
+
+// Maps the cache when it was built from the source asset as it is now. A matching stamp is enough, otherwise the source
+// is hashed and a matching key refreshes the stamp, so only a changed or touched source costs a full read. Caches whose
+// arrays do not lie inside the file are rejected.
+CMesh* LoadMeshCache( const char* filepath, const char* source_filepath, unsigned int import_flags, uint64_t stamp );
+// The key is the SourceKey of the mesh
+bool SaveMeshCache( const CMesh* mesh, const char* filepath, uint64_t stamp );
+void UnloadMeshCache( CMesh* mesh );
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "PackedMesh.h"
+#include "PackFunctions.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Packed vertex order, partitions and partition-local bone indices of a sub mesh
+struct SSubMeshPartitioning
+{
+    std::vector<SPackedPartition>   Partitions;
+    std::vector<uint32_t>           Bones;
+    std::vector<uint32_t>           SourceVertices;
+    std::vector<uint32_t>           Indices;
+    std::vector<uint32_t>           BoneIndices;
+};
+
+void PartitionSubMesh( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SSubMeshPartitioning* partitioning )
+{
+    assert( bone_palette_size >= MIN_BONE_PALETTE_SIZE && bone_palette_size <= MAX_BONE_PALETTE_SIZE );
+
+    const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    // The partition each bone and vertex was last added to, and its index there
+    const unsigned int bone_count = mesh->BoneCount > 0 ? mesh->BoneCount : 1;
+    std::vector<uint32_t> bone_partitions( bone_count, UINT32_MAX );
+    std::vector<uint32_t> bone_slots( bone_count, 0 );
+    std::vector<uint32_t> vertex_partitions( sub_mesh.VertexCount, UINT32_MAX );
+    std::vector<uint32_t> vertex_slots( sub_mesh.VertexCount, 0 );
+
+    partitioning->Partitions.clear();
+    partitioning->Bones.clear();
+    partitioning->SourceVertices.clear();
+    partitioning->Indices.resize( sub_mesh.TriangleCount * 3 );
+    partitioning->BoneIndices.clear();
+
+    SPackedPartition partition = {};
+    uint32_t partition_index = 0;
+    for ( unsigned int i = 0; i < sub_mesh.TriangleCount; ++i )
+    {
+        const unsigned int* indices = mesh->Indices + ( sub_mesh.TriangleOffset + i ) * 3;
+
+        uint32_t triangle_bones[ MIN_BONE_PALETTE_SIZE ];
+        unsigned int triangle_bone_count = 0;
+        unsigned int new_bone_count = 0;
+        for ( unsigned int j = 0; j < 3; ++j )
+        {
+            const unsigned int vertex_index = sub_mesh.VertexOffset + indices[ j ];
+            for ( unsigned int k = 0; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+            {
+                const uint32_t bone = mesh->BoneIndices[ vertex_index * BONE_WEIGHTS_PER_VERTEX + k ];
+                if ( !IsBoneInfluence( mesh, vertex_index, k ) ||
+                     std::find( triangle_bones, triangle_bones + triangle_bone_count, bone ) != triangle_bones + triangle_bone_count )
+                    continue;
+
+                triangle_bones[ triangle_bone_count++ ] = bone;
+                new_bone_count += bone_partitions[ bone ] != partition_index ? 1 : 0;
+            }
+        }
+
+        // Close the partition when the bones of the triangle do not fit, they are all new to the next one then
+        if ( partition.BoneCount + new_bone_count > bone_palette_size )
+        {
+            partitioning->Partitions.push_back( partition );
+            ++partition_index;
+
+            partition.TriangleOffset = i;
+            partition.TriangleCount = 0;
+            partition.VertexOffset = static_cast< uint32_t >( partitioning->SourceVertices.size() );
+            partition.VertexCount = 0;
+            partition.BoneOffset = static_cast< uint32_t >( partitioning->Bones.size() );
+            partition.BoneCount = 0;
+        }
+
+        for ( unsigned int j = 0; j < triangle_bone_count; ++j )
+        {
+            const uint32_t bone = triangle_bones[ j ];
+            if ( bone_partitions[ bone ] != partition_index )
+            {
+                bone_partitions[ bone ] = partition_index;
+                bone_slots[ bone ] = partition.BoneCount++;
+                partitioning->Bones.push_back( bone );
+            }
+        }
+
+        // Vertices are packed in the order the triangles first use them
+        for ( unsigned int j = 0; j < 3; ++j )
+        {
+            const unsigned int vertex = indices[ j ];
+            if ( vertex_partitions[ vertex ] != partition_index )
+            {
+                vertex_partitions[ vertex ] = partition_index;
+                vertex_slots[ vertex ] = static_cast< uint32_t >( partitioning->SourceVertices.size() );
+                partitioning->SourceVertices.push_back( vertex );
+                ++partition.VertexCount;
+
+                // Slots without influence point at the first bone, which makes their offsets in the shader exactly 0
+                const unsigned int vertex_index = sub_mesh.VertexOffset + vertex;
+                const uint32_t* bone_indices = mesh->BoneIndices + vertex_index * BONE_WEIGHTS_PER_VERTEX;
+                for ( unsigned int k = 0; k < BONE_WEIGHTS_PER_VERTEX; ++k )
+                {
+                    const uint32_t bone = IsBoneInfluence( mesh, vertex_index, k ) || bone_partitions[ bone_indices[ k ] ] == partition_index ? bone_indices[ k ] : bone_indices[ 0 ];
+                    partitioning->BoneIndices.push_back( bone_slots[ bone ] );
+                }
+            }
+            partitioning->Indices[ i * 3 + j ] = vertex_slots[ vertex ];
+        }
+        ++partition.TriangleCount;
+    }
+    if ( partition.TriangleCount > 0 )
+    {
+        partitioning->Partitions.push_back( partition );
+    }
+}
+
+uint32_t CalculateVertexBufferSize( uint32_t vertex_count )
+{
+    uint32_t vertex_buffer_size = 0;
+    for ( unsigned int i = 0; i < VERTEX_ELEMENT_COUNT; ++i )
+    {
+        vertex_buffer_size += vertex_count * VERTEX_ELEMENT_STRIDES[ i ];
+    }
+    return vertex_buffer_size;
+}
+
+uint32_t CalculateIndexBufferSize( uint32_t triangle_count )
+{
+    return ( triangle_count * 3 * sizeof( uint16_t ) + 3 ) & ~3u;
+}
+
+void InitializePackedSubMeshHeader( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, const SSubMeshPartitioning& partitioning, SPackedSubMeshHeader* header )
+{
+    const unsigned int vertex_count = static_cast< unsigned int >( partitioning.SourceVertices.size() );
+
+    memset( header, 0, sizeof( SPackedSubMeshHeader ) );
+    header->Magic = PACKED_SUB_MESH_MAGIC;
+    header->Version = PACKED_SUB_MESH_VERSION;
+    header->SourceKey = mesh->SourceKey;
+    header->VertexCount = vertex_count;
+    header->TriangleCount = mesh->SubMeshes[ sub_mesh_index ].TriangleCount;
+    header->VertexBufferSize = CalculateVertexBufferSize( vertex_count );
+    header->IndexBufferSize = CalculateIndexBufferSize( header->TriangleCount );
+    header->BonePaletteSize = bone_palette_size;
+    header->PartitionCount = static_cast< uint32_t >( partitioning.Partitions.size() );
+    header->PartitionBufferSize = static_cast< uint32_t >( partitioning.Partitions.size() * sizeof( SPackedPartition ) + ( partitioning.Bones.size() + vertex_count ) * sizeof( uint32_t ) );
+}
+
+void InitializePackedSubMeshHeader( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header )
+{
+    SSubMeshPartitioning partitioning;
+    PartitionSubMesh( mesh, sub_mesh_index, bone_palette_size, &partitioning );
+    InitializePackedSubMeshHeader( mesh, sub_mesh_index, bone_palette_size, partitioning, header );
+}
+
+template< typename T >
+void GatherVertices( const T* in, unsigned int components, const std::vector<uint32_t>& source_vertices, std::vector<T>& out )
+{
+    out.resize( source_vertices.size() * components );
+    for ( size_t i = 0; i < source_vertices.size(); ++i )
+    {
+        memcpy( out.data() + i * components, in + source_vertices[ i ] * components, components * sizeof( T ) );
+    }
+}
+
+bool PackSubMesh( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header, uint8_t* data )
+{
+    const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+
+    SSubMeshPartitioning partitioning;
+    PartitionSubMesh( mesh, sub_mesh_index, bone_palette_size, &partitioning );
+    InitializePackedSubMeshHeader( mesh, sub_mesh_index, bone_palette_size, partitioning, header );
+    if ( header->VertexCount > MAX_PACKED_VERTEX_COUNT )
+        return false;
+
+    const std::vector<uint32_t>& source_vertices = partitioning.SourceVertices;
+    const uint32_t vertex_count = header->VertexCount;
+
+    std::vector<float> positions, bone_weights, tangents, bitangents, normals, tangent_deform_factors, bitangent_deform_factors;
+    GatherVertices( reinterpret_cast< const float* >( mesh->Positions + sub_mesh.VertexOffset ), 3, source_vertices, positions );
+    GatherVertices( mesh->BoneWeights + sub_mesh.VertexOffset * BONE_WEIGHTS_PER_VERTEX, BONE_WEIGHTS_PER_VERTEX, source_vertices, bone_weights );
+    GatherVertices( reinterpret_cast< const float* >( mesh->Tangents + sub_mesh.VertexOffset ), 3, source_vertices, tangents );
+    GatherVertices( reinterpret_cast< const float* >( mesh->Bitangents + sub_mesh.VertexOffset ), 3, source_vertices, bitangents );
+    GatherVertices( reinterpret_cast< const float* >( mesh->Normals + sub_mesh.VertexOffset ), 3, source_vertices, normals );
+    GatherVertices( mesh->TangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, DEFORM_FACTORS_PER_VERTEX, source_vertices, tangent_deform_factors );
+    GatherVertices( mesh->BitangentDeformFactors + sub_mesh.VertexOffset * DEFORM_FACTORS_PER_VERTEX, DEFORM_FACTORS_PER_VERTEX, source_vertices, bitangent_deform_factors );
+
+    Pack::RGB32FloatToRGBM16Unorm( vertex_count, positions.data(), reinterpret_cast< uint16_t* >( data ), &header->PositionScale );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_POSITION ];
+    Pack::RGBA32FloatToRGBA8Unorm( vertex_count, bone_weights.data(), data );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BONE_WEIGHTS ];
+    Pack::RGBA32UintToRGBA8Uint( vertex_count, partitioning.BoneIndices.data(), data );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BONE_INDICES ];
+    Pack::TangentsToRGBA8Unorm( vertex_count, tangents.data(), bitangents.data(), normals.data(), data );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENTS ];
+    Pack::RGB32FloatToRGBM8Unorm( vertex_count, tangent_deform_factors.data(), data, &header->DeformFactorsTangentScale );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_DEFORM_FACTORS_TANGENT ];
+    Pack::RGB32FloatToRGBM8Unorm( vertex_count, bitangent_deform_factors.data(), data, &header->DeformFactorsBitangentScale );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_DEFORM_FACTORS_BITANGENT ];
+    memcpy( data, tangents.data(), vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ] );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_TANGENT_REF ];
+    memcpy( data, bitangents.data(), vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ] );
+    data += vertex_count * VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_BITANGENT_REF ];
+    Pack::RGB32UintToRGB16Uint( header->TriangleCount, partitioning.Indices.data(), reinterpret_cast< uint16_t* >( data ) );
+    memset( data + header->TriangleCount * 3 * sizeof( uint16_t ), 0, header->IndexBufferSize - header->TriangleCount * 3 * sizeof( uint16_t ) );
+    data += header->IndexBufferSize;
+
+    memcpy( data, partitioning.Partitions.data(), partitioning.Partitions.size() * sizeof( SPackedPartition ) );
+    data += partitioning.Partitions.size() * sizeof( SPackedPartition );
+    memcpy( data, partitioning.Bones.data(), partitioning.Bones.size() * sizeof( uint32_t ) );
+    data += partitioning.Bones.size() * sizeof( uint32_t );
+    memcpy( data, source_vertices.data(), source_vertices.size() * sizeof( uint32_t ) );
+    return true;
+}
+
+void InitializePackedPartitions( const SPackedSubMeshHeader& header, const uint8_t* partition_data, SPackedPartitions* partitions )
+{
+    partitions->Partitions = reinterpret_cast< const SPackedPartition* >( partition_data );
+    partitions->Bones = reinterpret_cast< const uint32_t* >( partitions->Partitions + header.PartitionCount );
+
+    uint32_t bone_count = 0;
+    for ( uint32_t i = 0; i < header.PartitionCount; ++i )
+    {
+        bone_count += partitions->Partitions[ i ].BoneCount;
+    }
+    partitions->SourceVertices = partitions->Bones + bone_count;
+}
+
+bool LoadPackedSubMeshHeader( const char* filepath, const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header )
+{
+    FILE* file = fopen( filepath, "rb" );
+    if ( file == nullptr )
+        return false;
+
+    // Every triangle adds at most three packed vertices and every partition at least one triangle
+    const CMesh::SSubMesh& sub_mesh = mesh->SubMeshes[ sub_mesh_index ];
+    bool is_valid = fread( header, sizeof( SPackedSubMeshHeader ), 1, file ) == 1 &&
+                    header->Magic == PACKED_SUB_MESH_MAGIC &&
+                    header->Version == PACKED_SUB_MESH_VERSION &&
+                    header->SourceKey == mesh->SourceKey &&
+                    header->BonePaletteSize == bone_palette_size &&
+                    header->TriangleCount == sub_mesh.TriangleCount &&
+                    header->VertexCount <= header->TriangleCount * 3 &&
+                    header->VertexCount <= MAX_PACKED_VERTEX_COUNT &&
+                    header->VertexBufferSize == CalculateVertexBufferSize( header->VertexCount ) &&
+                    header->IndexBufferSize == CalculateIndexBufferSize( header->TriangleCount ) &&
+                    header->PartitionCount <= header->TriangleCount &&
+                    header->PartitionBufferSize >= header->PartitionCount * sizeof( SPackedPartition ) + header->VertexCount * sizeof( uint32_t );
+    if ( is_valid )
+    {
+        // A truncated blob would otherwise only fail after the buffers were created for it
+        const long data_size = static_cast< long >( header->VertexBufferSize + header->IndexBufferSize + header->PartitionBufferSize );
+        is_valid = fseek( file, 0, SEEK_END ) == 0 && ftell( file ) == static_cast< long >( sizeof( SPackedSubMeshHeader ) ) + data_size;
+    }
+
+    fclose( file );
+    return is_valid;
+}
+
+bool LoadPackedSubMeshData( const char* filepath, const SPackedSubMeshHeader& header, uint8_t* data )
+{
+    FILE* file = fopen( filepath, "rb" );
+    if ( file == nullptr )
+        return false;
+
+    SPackedSubMeshHeader file_header;
+    bool is_valid = fread( &file_header, sizeof( SPackedSubMeshHeader ), 1, file ) == 1 &&
+                    memcmp( &file_header, &header, sizeof( SPackedSubMeshHeader ) ) == 0;
+    if ( is_valid )
+    {
+        const size_t data_size = header.VertexBufferSize + header.IndexBufferSize + header.PartitionBufferSize;
+        is_valid = fread( data, 1, data_size, file ) == data_size;
+    }
+
+    fclose( file );
+    return is_valid;
+}
+
+bool SavePackedSubMesh( const char* filepath, const SPackedSubMeshHeader& header, const uint8_t* data )
+{
+    FILE* file = fopen( filepath, "wb" );
+    if ( file == nullptr )
+        return false;
+
+    const size_t data_size = header.VertexBufferSize + header.IndexBufferSize + header.PartitionBufferSize;
+    bool is_written = fwrite( &header, sizeof( SPackedSubMeshHeader ), 1, file ) == 1 &&
+                      fwrite( data, 1, data_size, file ) == data_size;
+
+    fclose( file );
+    return is_written;
+}
\ No newline at end of file
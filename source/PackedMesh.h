@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum EVertexElement
+{
+    VERTEX_ELEMENT_POSITION = 0,
+    VERTEX_ELEMENT_BONE_WEIGHTS,
+    VERTEX_ELEMENT_BONE_INDICES,
+    VERTEX_ELEMENT_TANGENTS,
+    VERTEX_ELEMENT_DEFORM_FACTORS_TANGENT,
+    VERTEX_ELEMENT_DEFORM_FACTORS_BITANGENT,
+    VERTEX_ELEMENT_TANGENT_REF,
+    VERTEX_ELEMENT_BITANGENT_REF,
+    VERTEX_ELEMENT_COUNT
+};
+static const unsigned int VERTEX_ELEMENT_STRIDES[ VERTEX_ELEMENT_COUNT ] =
+{
+    4 * sizeof( uint16_t ),
+    4 * sizeof( uint8_t ),
+    4 * sizeof( uint8_t ),
+    4 * sizeof( uint8_t ),
+    4 * sizeof( uint8_t ),
+    4 * sizeof( uint8_t ),
+    3 * sizeof( float ),
+    3 * sizeof( float ),
+};
+
+static const uint32_t PACKED_SUB_MESH_MAGIC     = 0x53504644; // "DFPS"
+static const uint32_t PACKED_SUB_MESH_VERSION   = 2;
+static const char*    PACKED_SUB_MESH_EXTENSION = ".bin";
+
+// Bones in the constant buffer of Shader.hlsl. A palette has to hold every bone of a triangle, and the bone
+// indices are 8-bit per vertex.
+static const unsigned int BONE_PALETTE_SIZE     = 64;
+static const unsigned int MIN_BONE_PALETTE_SIZE = 3 * BONE_WEIGHTS_PER_VERTEX;
+static const unsigned int MAX_BONE_PALETTE_SIZE = 256;
+
+// The index buffer is 16-bit, which limits the packed vertices of a sub mesh including the ones partitioning duplicates
+static const unsigned int MAX_PACKED_VERTEX_COUNT = 0x10000;
+
+// A packed sub mesh is the header followed by the GPU-ready vertex streams, in EVertexElement order, the
+// 16-bit index buffer padded to 4 bytes and the partitions. The vertex and index data can be copied straight
+// into upload memory. The partition data is read on the CPU and laid out as SPackedPartition per partition,
+// the bones of each partition and the sub mesh vertex of each packed vertex, all as 32-bit values.
+struct SPackedSubMeshHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t SourceKey;
+    uint32_t VertexCount;
+    uint32_t TriangleCount;
+    uint32_t VertexBufferSize;
+    uint32_t IndexBufferSize;
+    float    PositionScale;
+    float    DeformFactorsTangentScale;
+    float    DeformFactorsBitangentScale;
+    uint32_t BonePaletteSize;
+    uint32_t PartitionCount;
+    uint32_t PartitionBufferSize;
+};
+
+// A range of triangles drawn with one bone palette. The bone indices of its vertices are relative to its bones,
+// and vertices used by several partitions are duplicated so that each partition has its own range. The indices
+// are not rebased, so a partition is drawn with a start index of TriangleOffset * 3 and a base vertex of 0.
+struct SPackedPartition
+{
+    uint32_t TriangleOffset;
+    uint32_t TriangleCount;
+    uint32_t VertexOffset;
+    uint32_t VertexCount;
+    uint32_t BoneOffset;
+    uint32_t BoneCount;
+};
+
+// Views into the partition data of a packed sub mesh. Bones are indices into the bone transformations of the
+// mesh and source vertices are relative to the sub mesh.
+struct SPackedPartitions
+{
+    const SPackedPartition* Partitions;
+    const uint32_t*         Bones;
+    const uint32_t*         SourceVertices;
+};
+
+void GetPackedSubMeshFilepath( const char* source_filepath, unsigned int sub_mesh_index, char* filepath, size_t filepath_size );
+
+// Splits the sub mesh into partitions of at most bone_palette_size bones each. Triangles keep their order and a
+// partition is closed when the bones of the next triangle would not fit.
+void InitializePackedSubMeshHeader( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header );
+// Returns false without writing the data when the packed sub mesh has more than MAX_PACKED_VERTEX_COUNT vertices,
+// which the header shows as well
+bool PackSubMesh( const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header, uint8_t* data );
+
+// The partition data starts at data + header.VertexBufferSize + header.IndexBufferSize
+void InitializePackedPartitions( const SPackedSubMeshHeader& header, const uint8_t* partition_data, SPackedPartitions* partitions );
+
+// Reads the header of a baked sub mesh, so the buffers can be sized before the data is read. Rejects blobs baked from
+// another version of the source asset, with another layout or another palette size, and blobs whose sizes do not add
+// up, from the stored fields alone without partitioning the sub mesh again.
+bool LoadPackedSubMeshHeader( const char* filepath, const CMesh* mesh, unsigned int sub_mesh_index, unsigned int bone_palette_size, SPackedSubMeshHeader* header );
+// Reads the data after a header that LoadPackedSubMeshHeader accepted, and fails when the file has changed since
+bool LoadPackedSubMeshData( const char* filepath, const SPackedSubMeshHeader& header, uint8_t* data );
+bool SavePackedSubMesh( const char* filepath, const SPackedSubMeshHeader& header, const uint8_t* data );
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <math.h>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define SIMD_LANES_X86
+#include <emmintrin.h>
+#endif
+
+// Lane types for the kernels that are written once against a lane type. Each provides Vector and Mask types,
+// a WIDTH and only correctly rounded arithmetic, so every lane type produces the same bits as the scalar one.
+//
+// Translation units compiled for a wider instruction set must define their own lane types instead of including
+// this file, since the linker could otherwise pick their copy of these inline functions for every caller.
+
+struct SScalarLanes
+{
+    typedef float Vector;
+    typedef bool Mask;
+    static const unsigned int WIDTH = 1;
+
+    static Vector Load( const float* data ) { return *data; }
+    static void Store( float* data, Vector a ) { *data = a; }
+    static Vector Set( float a ) { return a; }
+    static Vector Add( Vector a, Vector b ) { return a + b; }
+    static Vector Sub( Vector a, Vector b ) { return a - b; }
+    static Vector Mul( Vector a, Vector b ) { return a * b; }
+    static Vector Div( Vector a, Vector b ) { return a / b; }
+    static Vector Sqrt( Vector a ) { return sqrtf( a ); }
+    static Vector Abs( Vector a ) { return fabsf( a ); }
+    static Vector Min( Vector a, Vector b ) { return a < b ? a : b; }
+    static Vector Max( Vector a, Vector b ) { return a > b ? a : b; }
+    static Mask Greater( Vector a, Vector b ) { return a > b; }
+    static Mask GreaterEqual( Vector a, Vector b ) { return a >= b; }
+    static Vector Select( Mask mask, Vector a, Vector b ) { return mask ? a : b; }
+};
+
+#ifdef SIMD_LANES_X86
+struct SSseLanes
+{
+    typedef __m128 Vector;
+    typedef __m128 Mask;
+    static const unsigned int WIDTH = 4;
+
+    static Vector Load( const float* data ) { return _mm_loadu_ps( data ); }
+    static void Store( float* data, Vector a ) { _mm_storeu_ps( data, a ); }
+    static Vector Set( float a ) { return _mm_set1_ps( a ); }
+    static Vector Add( Vector a, Vector b ) { return _mm_add_ps( a, b ); }
+    static Vector Sub( Vector a, Vector b ) { return _mm_sub_ps( a, b ); }
+    static Vector Mul( Vector a, Vector b ) { return _mm_mul_ps( a, b ); }
+    static Vector Div( Vector a, Vector b ) { return _mm_div_ps( a, b ); }
+    static Vector Sqrt( Vector a ) { return _mm_sqrt_ps( a ); }
+    static Vector Abs( Vector a ) { return _mm_andnot_ps( _mm_set1_ps( -0.0f ), a ); }
+    static Vector Min( Vector a, Vector b ) { return _mm_min_ps( a, b ); }
+    static Vector Max( Vector a, Vector b ) { return _mm_max_ps( a, b ); }
+    static Mask Greater( Vector a, Vector b ) { return _mm_cmpgt_ps( a, b ); }
+    static Mask GreaterEqual( Vector a, Vector b ) { return _mm_cmpge_ps( a, b ); }
+    static Vector Select( Mask mask, Vector a, Vector b ) { return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) ); }
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,458 @@
+#include "Skinning.h"
+#include "SimdLanes.h"
+
+#include <assert.h>
+#include <math.h>
+
+template< typename TLanes >
+struct SSkinningKernel
+{
+    typedef typename TLanes::Vector V;
+    typedef typename TLanes::Mask M;
+
+    struct SVector3
+    {
+        V x, y, z;
+    };
+
+    static SVector3 Add( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Add( a.x, b.x ), TLanes::Add( a.y, b.y ), TLanes::Add( a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Subtract( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Sub( a.x, b.x ), TLanes::Sub( a.y, b.y ), TLanes::Sub( a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Scale( const SVector3& a, V s )
+    {
+        SVector3 result = { TLanes::Mul( a.x, s ), TLanes::Mul( a.y, s ), TLanes::Mul( a.z, s ) };
+        return result;
+    }
+    static SVector3 Cross( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result =
+        {
+            TLanes::Sub( TLanes::Mul( a.y, b.z ), TLanes::Mul( a.z, b.y ) ),
+            TLanes::Sub( TLanes::Mul( a.z, b.x ), TLanes::Mul( a.x, b.z ) ),
+            TLanes::Sub( TLanes::Mul( a.x, b.y ), TLanes::Mul( a.y, b.x ) )
+        };
+        return result;
+    }
+    static V Dot( const SVector3& a, const SVector3& b )
+    {
+        return TLanes::Add( TLanes::Add( TLanes::Mul( a.x, b.x ), TLanes::Mul( a.y, b.y ) ), TLanes::Mul( a.z, b.z ) );
+    }
+    static V RSqrt( V a )
+    {
+        return TLanes::Div( TLanes::Set( 1 ), TLanes::Sqrt( a ) );
+    }
+    static SVector3 Normalize( const SVector3& a )
+    {
+        return Scale( a, RSqrt( Dot( a, a ) ) );
+    }
+    static SVector3 Capped( const SVector3& a )
+    {
+        return Scale( a, TLanes::Min( TLanes::Set( 1 ), TLanes::Mul( RSqrt( Dot( a, a ) ), TLanes::Set( 0.9f ) ) ) );
+    }
+
+    struct SQuaternion
+    {
+        SVector3 v;
+        V w;
+    };
+
+    static SQuaternion AddScaled( const SQuaternion& a, const SQuaternion& b, V s )
+    {
+        SQuaternion result = { Add( a.v, Scale( b.v, s ) ), TLanes::Add( a.w, TLanes::Mul( b.w, s ) ) };
+        return result;
+    }
+    static V Dot( const SQuaternion& a, const SQuaternion& b )
+    {
+        return TLanes::Add( Dot( a.v, b.v ), TLanes::Mul( a.w, b.w ) );
+    }
+    static SVector3 Rotate( const SQuaternion& r, const SVector3& a )
+    {
+        SVector3 t = Add( Cross( r.v, a ), Scale( a, r.w ) );
+        return Add( a, Scale( Cross( r.v, t ), TLanes::Set( 2 ) ) );
+    }
+    static SVector3 Transform( const SQuaternion& r, const SQuaternion& d, const SVector3& a )
+    {
+        SVector3 translation = Add( Subtract( Scale( d.v, r.w ), Scale( r.v, d.w ) ), Cross( r.v, d.v ) );
+        return Add( Rotate( r, a ), Scale( translation, TLanes::Set( 2 ) ) );
+    }
+
+    // Same 11th and 10th degree minimax polynomials as XMScalarSinCos. The angles are already within [-pi, pi],
+    // so only the reflection into [-pi/2, pi/2] is needed.
+    static void SinCos( V x, V* sin, V* cos )
+    {
+        M above = TLanes::Greater( x, TLanes::Set( 1.570796327f ) );
+        M below = TLanes::Greater( TLanes::Set( -1.570796327f ), x );
+        V y = TLanes::Select( above, TLanes::Sub( TLanes::Set( 3.141592654f ), x ), TLanes::Select( below, TLanes::Sub( TLanes::Set( -3.141592654f ), x ), x ) );
+        V sign = TLanes::Select( above, TLanes::Set( -1 ), TLanes::Select( below, TLanes::Set( -1 ), TLanes::Set( 1 ) ) );
+        V y2 = TLanes::Mul( y, y );
+
+        V s = TLanes::Set( -2.3889859e-08f );
+        s = TLanes::Add( TLanes::Mul( s, y2 ), TLanes::Set( 2.7525562e-06f ) );
+        s = TLanes::Add( TLanes::Mul( s, y2 ), TLanes::Set( -0.00019840874f ) );
+        s = TLanes::Add( TLanes::Mul( s, y2 ), TLanes::Set( 0.0083333310f ) );
+        s = TLanes::Add( TLanes::Mul( s, y2 ), TLanes::Set( -0.16666667f ) );
+        s = TLanes::Add( TLanes::Mul( s, y2 ), TLanes::Set( 1 ) );
+        *sin = TLanes::Mul( s, y );
+
+        V c = TLanes::Set( -2.6051615e-07f );
+        c = TLanes::Add( TLanes::Mul( c, y2 ), TLanes::Set( 2.4760495e-05f ) );
+        c = TLanes::Add( TLanes::Mul( c, y2 ), TLanes::Set( -0.0013888378f ) );
+        c = TLanes::Add( TLanes::Mul( c, y2 ), TLanes::Set( 0.041666638f ) );
+        c = TLanes::Add( TLanes::Mul( c, y2 ), TLanes::Set( -0.5f ) );
+        c = TLanes::Add( TLanes::Mul( c, y2 ), TLanes::Set( 1 ) );
+        *cos = TLanes::Mul( c, sign );
+    }
+
+    // Converts four unorm components per vertex the way the input assembler does
+    template< typename TComponent >
+    static void LoadUnorm( const TComponent* data, unsigned int vertex_index, float max_value, V* result )
+    {
+        float components[ 4 ][ TLanes::WIDTH ];
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            for ( unsigned int j = 0; j < 4; ++j )
+            {
+                components[ j ][ i ] = static_cast< float >( data[ ( vertex_index + i ) * 4 + j ] ) / max_value;
+            }
+        }
+        for ( unsigned int j = 0; j < 4; ++j )
+        {
+            result[ j ] = TLanes::Load( components[ j ] );
+        }
+    }
+    static SVector3 UnpackRGBMSigned( const V* rgbm, float q )
+    {
+        SVector3 result;
+        result.x = TLanes::Mul( TLanes::Mul( TLanes::Sub( TLanes::Mul( rgbm[ 0 ], TLanes::Set( 2 ) ), TLanes::Set( 1 ) ), rgbm[ 3 ] ), TLanes::Set( q ) );
+        result.y = TLanes::Mul( TLanes::Mul( TLanes::Sub( TLanes::Mul( rgbm[ 1 ], TLanes::Set( 2 ) ), TLanes::Set( 1 ) ), rgbm[ 3 ] ), TLanes::Set( q ) );
+        result.z = TLanes::Mul( TLanes::Mul( TLanes::Sub( TLanes::Mul( rgbm[ 2 ], TLanes::Set( 2 ) ), TLanes::Set( 1 ) ), rgbm[ 3 ] ), TLanes::Set( q ) );
+        return result;
+    }
+    static V UnpackTangents( const V* packed_tangents, SVector3* tangent, SVector3* bitangent )
+    {
+        V angles[ 4 ];
+        for ( unsigned int j = 0; j < 4; ++j )
+        {
+            angles[ j ] = TLanes::Sub( TLanes::Mul( packed_tangents[ j ], TLanes::Set( 2.0f * 3.14159265f ) ), TLanes::Set( 3.14159265f ) );
+        }
+
+        V sin_theta_x, cos_theta_x, sin_theta_y, cos_theta_y, sin_phi_x, cos_phi_x, sin_phi_y, cos_phi_y;
+        SinCos( angles[ 0 ], &sin_theta_x, &cos_theta_x );
+        SinCos( angles[ 2 ], &sin_theta_y, &cos_theta_y );
+        SinCos( TLanes::Abs( angles[ 1 ] ), &sin_phi_x, &cos_phi_x );
+        SinCos( TLanes::Abs( angles[ 3 ] ), &sin_phi_y, &cos_phi_y );
+
+        tangent->x = TLanes::Mul( cos_theta_x, sin_phi_x );
+        tangent->y = TLanes::Mul( sin_theta_x, sin_phi_x );
+        tangent->z = cos_phi_x;
+        bitangent->x = TLanes::Mul( cos_theta_y, sin_phi_y );
+        bitangent->y = TLanes::Mul( sin_theta_y, sin_phi_y );
+        bitangent->z = cos_phi_y;
+
+        return TLanes::Select( TLanes::Greater( angles[ 3 ], TLanes::Set( 0 ) ), TLanes::Set( 1 ), TLanes::Set( -1 ) );
+    }
+
+    // Rows 0 to 3 of the affine part of the influence's bone transformation, per lane
+    static void LoadBoneRows( const DirectX::XMFLOAT4X4* bone_transformations, const uint8_t* bone_indices, unsigned int vertex_index, unsigned int influence, SVector3* rows )
+    {
+        float elements[ 4 ][ 3 ][ TLanes::WIDTH ];
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            const DirectX::XMFLOAT4X4& bone_transformation = bone_transformations[ bone_indices[ ( vertex_index + i ) * 4 + influence ] ];
+            for ( unsigned int r = 0; r < 4; ++r )
+            {
+                for ( unsigned int c = 0; c < 3; ++c )
+                {
+                    elements[ r ][ c ][ i ] = bone_transformation.m[ r ][ c ];
+                }
+            }
+        }
+        for ( unsigned int r = 0; r < 4; ++r )
+        {
+            rows[ r ].x = TLanes::Load( elements[ r ][ 0 ] );
+            rows[ r ].y = TLanes::Load( elements[ r ][ 1 ] );
+            rows[ r ].z = TLanes::Load( elements[ r ][ 2 ] );
+        }
+    }
+    static void LoadDualQuaternion( const SDualQuaternion* bone_dual_quaternions, const uint8_t* bone_indices, unsigned int vertex_index, unsigned int influence, SQuaternion* real, SQuaternion* dual )
+    {
+        float elements[ 8 ][ TLanes::WIDTH ];
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            const SDualQuaternion& bone_dual_quaternion = bone_dual_quaternions[ bone_indices[ ( vertex_index + i ) * 4 + influence ] ];
+            elements[ 0 ][ i ] = bone_dual_quaternion.Real.x;
+            elements[ 1 ][ i ] = bone_dual_quaternion.Real.y;
+            elements[ 2 ][ i ] = bone_dual_quaternion.Real.z;
+            elements[ 3 ][ i ] = bone_dual_quaternion.Real.w;
+            elements[ 4 ][ i ] = bone_dual_quaternion.Dual.x;
+            elements[ 5 ][ i ] = bone_dual_quaternion.Dual.y;
+            elements[ 6 ][ i ] = bone_dual_quaternion.Dual.z;
+            elements[ 7 ][ i ] = bone_dual_quaternion.Dual.w;
+        }
+        real->v.x = TLanes::Load( elements[ 0 ] );
+        real->v.y = TLanes::Load( elements[ 1 ] );
+        real->v.z = TLanes::Load( elements[ 2 ] );
+        real->w = TLanes::Load( elements[ 3 ] );
+        dual->v.x = TLanes::Load( elements[ 4 ] );
+        dual->v.y = TLanes::Load( elements[ 5 ] );
+        dual->v.z = TLanes::Load( elements[ 6 ] );
+        dual->w = TLanes::Load( elements[ 7 ] );
+    }
+    static SVector3 LoadVector3( const DirectX::XMFLOAT3* data, unsigned int vertex_index )
+    {
+        float x[ TLanes::WIDTH ], y[ TLanes::WIDTH ], z[ TLanes::WIDTH ];
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            x[ i ] = data[ vertex_index + i ].x;
+            y[ i ] = data[ vertex_index + i ].y;
+            z[ i ] = data[ vertex_index + i ].z;
+        }
+        SVector3 result = { TLanes::Load( x ), TLanes::Load( y ), TLanes::Load( z ) };
+        return result;
+    }
+    static void StoreVector3( DirectX::XMFLOAT3* data, unsigned int vertex_index, const SVector3& a )
+    {
+        float x[ TLanes::WIDTH ], y[ TLanes::WIDTH ], z[ TLanes::WIDTH ];
+        TLanes::Store( x, a.x );
+        TLanes::Store( y, a.y );
+        TLanes::Store( z, a.z );
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            data[ vertex_index + i ].x = x[ i ];
+            data[ vertex_index + i ].y = y[ i ];
+            data[ vertex_index + i ].z = z[ i ];
+        }
+    }
+
+    // One overload per palette type. Both give the offsets of the other influences relative to the first, the
+    // skinned position and the skinned tangent frame.
+    static void Skin( const DirectX::XMFLOAT4X4* bone_transformations, const uint8_t* bone_indices, unsigned int vertex_index, const V* bone_weights, const SVector3& position, SVector3* q, SVector3* skinned_position, SVector3* tangent, SVector3* bitangent )
+    {
+        // The bone transformations are uploaded as they are, so the shader's column major mul against them
+        // is the row vector times the rows here, with the translation in the last row
+        SVector3 bone_matrix[ 3 ];
+        for ( unsigned int k = 0; k < 4; ++k )
+        {
+            SVector3 rows[ 4 ];
+            LoadBoneRows( bone_transformations, bone_indices, vertex_index, k, rows );
+
+            q[ k ] = Add( Add( Add( Scale( rows[ 0 ], position.x ), Scale( rows[ 1 ], position.y ) ), Scale( rows[ 2 ], position.z ) ), rows[ 3 ] );
+            for ( unsigned int r = 0; r < 3; ++r )
+            {
+                bone_matrix[ r ] = k == 0 ? Scale( rows[ r ], bone_weights[ 0 ] ) : Add( bone_matrix[ r ], Scale( rows[ r ], bone_weights[ k ] ) );
+            }
+        }
+        q[ 1 ] = Subtract( q[ 1 ], q[ 0 ] );
+        q[ 2 ] = Subtract( q[ 2 ], q[ 0 ] );
+        q[ 3 ] = Subtract( q[ 3 ], q[ 0 ] );
+
+        *skinned_position = Add( Add( Add( q[ 0 ], Scale( q[ 1 ], bone_weights[ 1 ] ) ), Scale( q[ 2 ], bone_weights[ 2 ] ) ), Scale( q[ 3 ], bone_weights[ 3 ] ) );
+
+        *tangent = Add( Add( Scale( bone_matrix[ 0 ], tangent->x ), Scale( bone_matrix[ 1 ], tangent->y ) ), Scale( bone_matrix[ 2 ], tangent->z ) );
+        *bitangent = Add( Add( Scale( bone_matrix[ 0 ], bitangent->x ), Scale( bone_matrix[ 1 ], bitangent->y ) ), Scale( bone_matrix[ 2 ], bitangent->z ) );
+    }
+    static void Skin( const SDualQuaternion* bone_dual_quaternions, const uint8_t* bone_indices, unsigned int vertex_index, const V* bone_weights, const SVector3& position, SVector3* q, SVector3* skinned_position, SVector3* tangent, SVector3* bitangent )
+    {
+        SQuaternion real[ 4 ], dual[ 4 ];
+        for ( unsigned int k = 0; k < 4; ++k )
+        {
+            LoadDualQuaternion( bone_dual_quaternions, bone_indices, vertex_index, k, &real[ k ], &dual[ k ] );
+            q[ k ] = Transform( real[ k ], dual[ k ], position );
+        }
+        q[ 1 ] = Subtract( q[ 1 ], q[ 0 ] );
+        q[ 2 ] = Subtract( q[ 2 ], q[ 0 ] );
+        q[ 3 ] = Subtract( q[ 3 ], q[ 0 ] );
+
+        // Blend in the hemisphere of the first influence so the shortest rotation is taken
+        SQuaternion zero = { { TLanes::Set( 0 ), TLanes::Set( 0 ), TLanes::Set( 0 ) }, TLanes::Set( 0 ) };
+        SQuaternion blended_real = AddScaled( zero, real[ 0 ], bone_weights[ 0 ] );
+        SQuaternion blended_dual = AddScaled( zero, dual[ 0 ], bone_weights[ 0 ] );
+        for ( unsigned int k = 1; k < 4; ++k )
+        {
+            V weight = TLanes::Select( TLanes::Greater( TLanes::Set( 0 ), Dot( real[ 0 ], real[ k ] ) ), TLanes::Sub( TLanes::Set( 0 ), bone_weights[ k ] ), bone_weights[ k ] );
+            blended_real = AddScaled( blended_real, real[ k ], weight );
+            blended_dual = AddScaled( blended_dual, dual[ k ], weight );
+        }
+
+        V inverse_length = RSqrt( Dot( blended_real, blended_real ) );
+        blended_real = AddScaled( zero, blended_real, inverse_length );
+        blended_dual = AddScaled( zero, blended_dual, inverse_length );
+
+        *skinned_position = Transform( blended_real, blended_dual, position );
+        *tangent = Rotate( blended_real, *tangent );
+        *bitangent = Rotate( blended_real, *bitangent );
+    }
+
+    // Processes whole groups of WIDTH vertices and returns where it stopped
+    template< typename TPalette >
+    static unsigned int Run( const SSkinningInput& input, const TPalette* palette, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output )
+    {
+        unsigned int i = vertex_begin;
+        for ( ; i + TLanes::WIDTH <= vertex_end; i += TLanes::WIDTH )
+        {
+            V packed_position[ 4 ], bone_weights[ 4 ], packed_tangents[ 4 ], packed_deform_factors_tangent[ 4 ], packed_deform_factors_bitangent[ 4 ];
+            LoadUnorm( input.Positions, i, 65535.0f, packed_position );
+            LoadUnorm( input.BoneWeights, i, 255.0f, bone_weights );
+            LoadUnorm( input.Tangents, i, 255.0f, packed_tangents );
+            LoadUnorm( input.DeformFactorsTangent, i, 255.0f, packed_deform_factors_tangent );
+            LoadUnorm( input.DeformFactorsBitangent, i, 255.0f, packed_deform_factors_bitangent );
+
+            SVector3 position = UnpackRGBMSigned( packed_position, input.PositionScale );
+
+            SVector3 tangent, bitangent;
+            V tangent_sign = UnpackTangents( packed_tangents, &tangent, &bitangent );
+
+            SVector3 q[ 4 ], skinned_position;
+            Skin( palette, input.BoneIndices, i, bone_weights, position, q, &skinned_position, &tangent, &bitangent );
+
+            StoreVector3( output.TangentsOld, i, tangent );
+            StoreVector3( output.BitangentsOld, i, bitangent );
+            StoreVector3( output.NormalsOld, i, Scale( Cross( tangent, bitangent ), tangent_sign ) );
+
+            SVector3 deform_factors_tangent = UnpackRGBMSigned( packed_deform_factors_tangent, input.DeformFactorsTangentScale );
+            SVector3 deform_factors_bitangent = UnpackRGBMSigned( packed_deform_factors_bitangent, input.DeformFactorsBitangentScale );
+            tangent = Add( tangent, Capped( Add( Add( Scale( q[ 1 ], deform_factors_tangent.x ), Scale( q[ 2 ], deform_factors_tangent.y ) ), Scale( q[ 3 ], deform_factors_tangent.z ) ) ) );
+            bitangent = Add( bitangent, Capped( Add( Add( Scale( q[ 1 ], deform_factors_bitangent.x ), Scale( q[ 2 ], deform_factors_bitangent.y ) ), Scale( q[ 3 ], deform_factors_bitangent.z ) ) ) );
+            tangent = Normalize( tangent );
+            bitangent = Normalize( bitangent );
+
+            StoreVector3( output.Positions, i, skinned_position );
+            StoreVector3( output.TangentsNew, i, tangent );
+            StoreVector3( output.BitangentsNew, i, bitangent );
+            StoreVector3( output.NormalsNew, i, Scale( Cross( tangent, bitangent ), tangent_sign ) );
+            StoreVector3( output.NormalsRef, i, Scale( Cross( LoadVector3( input.TangentsRef, i ), LoadVector3( input.BitangentsRef, i ) ), tangent_sign ) );
+        }
+        return i;
+    }
+};
+
+const char* GetSkinningMethodName( ESkinningMethod skinning_method )
+{
+    static const char* SKINNING_METHOD_NAMES[ SKINNING_METHOD_COUNT ] = { "lbs", "dqs" };
+    return SKINNING_METHOD_NAMES[ skinning_method ];
+}
+
+void CalculateBoneDualQuaternions( const DirectX::XMFLOAT4X4* bone_transformations, unsigned int bone_count, SDualQuaternion* bone_dual_quaternions )
+{
+    for ( unsigned int i = 0; i < bone_count; ++i )
+    {
+        const DirectX::XMFLOAT4X4& m = bone_transformations[ i ];
+
+        // Row vectors are transformed by the rows, so r[ j ][ i ] is the column vector rotation matrix with the scale
+        // of each row removed
+        float r[ 3 ][ 3 ];
+        for ( unsigned int j = 0; j < 3; ++j )
+        {
+            const float length = sqrtf( m.m[ j ][ 0 ] * m.m[ j ][ 0 ] + m.m[ j ][ 1 ] * m.m[ j ][ 1 ] + m.m[ j ][ 2 ] * m.m[ j ][ 2 ] );
+            const float inverse_length = length > 0.0f ? 1.0f / length : 0.0f;
+            r[ 0 ][ j ] = m.m[ j ][ 0 ] * inverse_length;
+            r[ 1 ][ j ] = m.m[ j ][ 1 ] * inverse_length;
+            r[ 2 ][ j ] = m.m[ j ][ 2 ] * inverse_length;
+        }
+
+        // Divide by the largest of the four to stay accurate
+        float x, y, z, w;
+        const float trace = r[ 0 ][ 0 ] + r[ 1 ][ 1 ] + r[ 2 ][ 2 ];
+        if ( trace > 0.0f )
+        {
+            const float s = sqrtf( trace + 1.0f ) * 2.0f;
+            w = 0.25f * s;
+            x = ( r[ 2 ][ 1 ] - r[ 1 ][ 2 ] ) / s;
+            y = ( r[ 0 ][ 2 ] - r[ 2 ][ 0 ] ) / s;
+            z = ( r[ 1 ][ 0 ] - r[ 0 ][ 1 ] ) / s;
+        }
+        else if ( r[ 0 ][ 0 ] > r[ 1 ][ 1 ] && r[ 0 ][ 0 ] > r[ 2 ][ 2 ] )
+        {
+            const float s = sqrtf( 1.0f + r[ 0 ][ 0 ] - r[ 1 ][ 1 ] - r[ 2 ][ 2 ] ) * 2.0f;
+            w = ( r[ 2 ][ 1 ] - r[ 1 ][ 2 ] ) / s;
+            x = 0.25f * s;
+            y = ( r[ 0 ][ 1 ] + r[ 1 ][ 0 ] ) / s;
+            z = ( r[ 0 ][ 2 ] + r[ 2 ][ 0 ] ) / s;
+        }
+        else if ( r[ 1 ][ 1 ] > r[ 2 ][ 2 ] )
+        {
+            const float s = sqrtf( 1.0f + r[ 1 ][ 1 ] - r[ 0 ][ 0 ] - r[ 2 ][ 2 ] ) * 2.0f;
+            w = ( r[ 0 ][ 2 ] - r[ 2 ][ 0 ] ) / s;
+            x = ( r[ 0 ][ 1 ] + r[ 1 ][ 0 ] ) / s;
+            y = 0.25f * s;
+            z = ( r[ 1 ][ 2 ] + r[ 2 ][ 1 ] ) / s;
+        }
+        else
+        {
+            const float s = sqrtf( 1.0f + r[ 2 ][ 2 ] - r[ 0 ][ 0 ] - r[ 1 ][ 1 ] ) * 2.0f;
+            w = ( r[ 1 ][ 0 ] - r[ 0 ][ 1 ] ) / s;
+            x = ( r[ 0 ][ 2 ] + r[ 2 ][ 0 ] ) / s;
+            y = ( r[ 1 ][ 2 ] + r[ 2 ][ 1 ] ) / s;
+            z = 0.25f * s;
+        }
+
+        const float inverse_length = 1.0f / sqrtf( x * x + y * y + z * z + w * w );
+        x *= inverse_length;
+        y *= inverse_length;
+        z *= inverse_length;
+        w *= inverse_length;
+
+        // Half the translation times the rotation
+        const float tx = m.m[ 3 ][ 0 ] * 0.5f;
+        const float ty = m.m[ 3 ][ 1 ] * 0.5f;
+        const float tz = m.m[ 3 ][ 2 ] * 0.5f;
+        bone_dual_quaternions[ i ].Real = DirectX::XMFLOAT4( x, y, z, w );
+        bone_dual_quaternions[ i ].Dual = DirectX::XMFLOAT4(
+            tx * w + ty * z - tz * y,
+            ty * w + tz * x - tx * z,
+            tz * w + tx * y - ty * x,
+            -( tx * x + ty * y + tz * z ) );
+    }
+}
+
+void InitializeSkinningInput( const SPackedSubMeshHeader& header, const uint8_t* data, SSkinningInput* input )
+{
+    const uint8_t* streams[ VERTEX_ELEMENT_COUNT ];
+    for ( unsigned int i = 0; i < VERTEX_ELEMENT_COUNT; ++i )
+    {
+        streams[ i ] = data;
+        data += header.VertexCount * VERTEX_ELEMENT_STRIDES[ i ];
+    }
+
+    input->VertexCount = header.VertexCount;
+    input->Positions = reinterpret_cast< const uint16_t* >( streams[ VERTEX_ELEMENT_POSITION ] );
+    input->BoneWeights = streams[ VERTEX_ELEMENT_BONE_WEIGHTS ];
+    input->BoneIndices = streams[ VERTEX_ELEMENT_BONE_INDICES ];
+    input->Tangents = streams[ VERTEX_ELEMENT_TANGENTS ];
+    input->DeformFactorsTangent = streams[ VERTEX_ELEMENT_DEFORM_FACTORS_TANGENT ];
+    input->DeformFactorsBitangent = streams[ VERTEX_ELEMENT_DEFORM_FACTORS_BITANGENT ];
+    input->TangentsRef = reinterpret_cast< const DirectX::XMFLOAT3* >( streams[ VERTEX_ELEMENT_TANGENT_REF ] );
+    input->BitangentsRef = reinterpret_cast< const DirectX::XMFLOAT3* >( streams[ VERTEX_ELEMENT_BITANGENT_REF ] );
+    input->PositionScale = header.PositionScale;
+    input->DeformFactorsTangentScale = header.DeformFactorsTangentScale;
+    input->DeformFactorsBitangentScale = header.DeformFactorsBitangentScale;
+}
+
+template< typename TPalette >
+void SkinPackedVertices( const SSkinningInput& input, const TPalette* palette, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output )
+{
+    assert( vertex_end <= input.VertexCount );
+
+    unsigned int i = vertex_begin;
+#ifdef SIMD_LANES_X86
+    i = SSkinningKernel<SSseLanes>::Run( input, palette, i, vertex_end, output );
+#endif
+    SSkinningKernel<SScalarLanes>::Run( input, palette, i, vertex_end, output );
+}
+
+void SkinPackedVertices( const SSkinningInput& input, const DirectX::XMFLOAT4X4* bone_transformations, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output )
+{
+    SkinPackedVertices<DirectX::XMFLOAT4X4>( input, bone_transformations, vertex_begin, vertex_end, output );
+}
+
+void SkinPackedVerticesDualQuaternion( const SSkinningInput& input, const SDualQuaternion* bone_dual_quaternions, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output )
+{
+    SkinPackedVertices<SDualQuaternion>( input, bone_dual_quaternions, vertex_begin, vertex_end, output );
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "PackedMesh.h"
+
+#include <DirectXMath.h>
+#include <stdint.h>
+
+// Views into the vertex streams of a packed sub mesh, laid out as the vertex shader reads them. The reference
+// tangents are updated per frame by the viewer, so they can point at other memory than the packed data.
+struct SSkinningInput
+{
+    unsigned int                VertexCount;
+    const uint16_t*             Positions;
+    const uint8_t*              BoneWeights;
+    const uint8_t*              BoneIndices;
+    const uint8_t*              Tangents;
+    const uint8_t*              DeformFactorsTangent;
+    const uint8_t*              DeformFactorsBitangent;
+    const DirectX::XMFLOAT3*    TangentsRef;
+    const DirectX::XMFLOAT3*    BitangentsRef;
+    float                       PositionScale;
+    float                       DeformFactorsTangentScale;
+    float                       DeformFactorsBitangentScale;
+};
+
+// The OLD frame is the linear blend skinned tangent frame, the NEW frame adds the deform factor correction and
+// the REF normal comes from the reference tangents. Every array has one element per vertex of the input.
+struct SSkinningOutput
+{
+    DirectX::XMFLOAT3*  Positions;
+    DirectX::XMFLOAT3*  TangentsOld;
+    DirectX::XMFLOAT3*  BitangentsOld;
+    DirectX::XMFLOAT3*  NormalsOld;
+    DirectX::XMFLOAT3*  TangentsNew;
+    DirectX::XMFLOAT3*  BitangentsNew;
+    DirectX::XMFLOAT3*  NormalsNew;
+    DirectX::XMFLOAT3*  NormalsRef;
+};
+
+enum ESkinningMethod
+{
+    SKINNING_METHOD_LINEAR_BLEND = 0,
+    SKINNING_METHOD_DUAL_QUATERNION,
+    SKINNING_METHOD_COUNT
+};
+
+// A rigid bone transformation in 8 floats instead of 16. The real part is the rotation and the dual part is half
+// the translation times the rotation.
+struct SDualQuaternion
+{
+    DirectX::XMFLOAT4   Real;
+    DirectX::XMFLOAT4   Dual;
+};
+
+const char* GetSkinningMethodName( ESkinningMethod skinning_method );
+
+// Any scale in the bone transformations is dropped, since dual quaternions only represent rotations and translations
+void CalculateBoneDualQuaternions( const DirectX::XMFLOAT4X4* bone_transformations, unsigned int bone_count, SDualQuaternion* bone_dual_quaternions );
+
+void InitializeSkinningInput( const SPackedSubMeshHeader& header, const uint8_t* data, SSkinningInput* input );
+
+// Performs the operations of VSMain in Shader.hlsl in the same order, on the bone transformations as they are
+// uploaded. The bone transformations must be affine. Square roots and divisions are correctly rounded and sincos
+// is a fixed polynomial, so the results are bit-identical across lane widths but can differ from a GPU in the
+// last bits where it uses approximate rsqrt and sincos.
+void SkinPackedVertices( const SSkinningInput& input, const DirectX::XMFLOAT4X4* bone_transformations, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output );
+
+// Blends the dual quaternions of the influences instead of their matrices, with the same deform factor correction.
+// The offsets of the other influences are still each bone's transformation of the position relative to the first,
+// so the correction is first order accurate for both methods and only the blend of the frame differs.
+void SkinPackedVerticesDualQuaternion( const SSkinningInput& input, const SDualQuaternion* bone_dual_quaternions, unsigned int vertex_begin, unsigned int vertex_end, const SSkinningOutput& output );
\ No newline at end of file
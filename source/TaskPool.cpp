@@ -0,0 +1,266 @@
+#include "TaskPool.h"
+
+#include <assert.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// The pool and worker index of the current thread, so tasks submitted by a worker go to its own deque
+static thread_local CTaskPool* g_WorkerPool = nullptr;
+static thread_local unsigned int g_WorkerIndex = 0;
+
+void PushTask( CTaskPool* pool, CTaskPool::STask task )
+{
+    const unsigned int worker_index = g_WorkerPool == pool ? g_WorkerIndex : pool->NextWorkerIndex.fetch_add( 1, std::memory_order_relaxed ) % pool->WorkerCount;
+
+    // Counted before it is visible, so a thread that finds the task can never take the count below zero
+    pool->QueuedTaskCount.fetch_add( 1 );
+    {
+        CTaskPool::SWorker& worker = pool->Workers[ worker_index ];
+        std::lock_guard<std::mutex> lock( worker.Mutex );
+        worker.Tasks.push_back( std::move( task ) );
+    }
+
+    // Sleeping threads count themselves before they check the queued tasks, so one of the two sides sees the other
+    if ( pool->SleepingThreadCount.load() > 0 )
+    {
+        {
+            std::lock_guard<std::mutex> lock( pool->SleepMutex );
+        }
+        pool->TaskAvailable.notify_one();
+    }
+}
+
+bool PopTask( CTaskPool* pool, CTaskPool::STask* task )
+{
+    if ( pool->QueuedTaskCount.load() == 0 )
+        return false;
+
+    const bool is_worker = g_WorkerPool == pool;
+    const unsigned int first_worker_index = is_worker ? g_WorkerIndex : pool->NextWorkerIndex.load( std::memory_order_relaxed );
+    if ( is_worker )
+    {
+        CTaskPool::SWorker& worker = pool->Workers[ first_worker_index ];
+        std::lock_guard<std::mutex> lock( worker.Mutex );
+        if ( !worker.Tasks.empty() )
+        {
+            *task = std::move( worker.Tasks.back() );
+            worker.Tasks.pop_back();
+            pool->QueuedTaskCount.fetch_sub( 1 );
+            return true;
+        }
+    }
+
+    for ( unsigned int i = is_worker ? 1 : 0; i < pool->WorkerCount; ++i )
+    {
+        CTaskPool::SWorker& victim = pool->Workers[ ( first_worker_index + i ) % pool->WorkerCount ];
+        std::lock_guard<std::mutex> lock( victim.Mutex );
+        if ( !victim.Tasks.empty() )
+        {
+            *task = std::move( victim.Tasks.front() );
+            victim.Tasks.pop_front();
+            pool->QueuedTaskCount.fetch_sub( 1 );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Only the decrement that takes the counter to zero holds the waiting mutex, and it takes the tasks waiting on the
+// counter before it lets go. A waiter can reuse the memory of the counter as soon as it sees zero, so a release after
+// the lock would hand the dependents of a new counter at the same address to the pool before their dependency is done.
+void DecrementCounter( CTaskPool* pool, STaskCounter* counter )
+{
+    unsigned int count = counter->Count.load();
+    while ( count > 1 )
+    {
+        if ( counter->Count.compare_exchange_weak( count, count - 1 ) )
+            return;
+    }
+
+    std::vector<CTaskPool::STask> ready_tasks;
+    {
+        std::lock_guard<std::mutex> lock( pool->WaitingMutex );
+        if ( counter->Count.fetch_sub( 1 ) != 1 || pool->WaitingTaskCount.load() == 0 )
+            return;
+
+        auto range = pool->WaitingTasks.equal_range( counter );
+        for ( auto it = range.first; it != range.second; ++it )
+        {
+            ready_tasks.push_back( std::move( it->second ) );
+        }
+        pool->WaitingTasks.erase( range.first, range.second );
+        pool->WaitingTaskCount.fetch_sub( static_cast< unsigned int >( ready_tasks.size() ) );
+    }
+
+    for ( CTaskPool::STask& task : ready_tasks )
+    {
+        PushTask( pool, std::move( task ) );
+    }
+}
+
+void RunTask( CTaskPool* pool, CTaskPool::STask& task )
+{
+    task.Function();
+
+    if ( task.Counter != nullptr )
+    {
+        DecrementCounter( pool, task.Counter );
+    }
+}
+
+void WorkerThread( CTaskPool* pool, unsigned int worker_index )
+{
+    g_WorkerPool = pool;
+    g_WorkerIndex = worker_index;
+
+    for ( ;; )
+    {
+        CTaskPool::STask task;
+        if ( PopTask( pool, &task ) )
+        {
+            RunTask( pool, task );
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock( pool->SleepMutex );
+        pool->SleepingThreadCount.fetch_add( 1 );
+        pool->TaskAvailable.wait( lock, [ pool ]() { return !pool->IsRunning || pool->QueuedTaskCount.load() > 0; } );
+        pool->SleepingThreadCount.fetch_sub( 1 );
+        if ( !pool->IsRunning && pool->QueuedTaskCount.load() == 0 )
+            return;
+    }
+}
+
+void PinThread( std::thread& thread, unsigned int hardware_thread_index )
+{
+#ifdef _WIN32
+    SetThreadAffinityMask( thread.native_handle(), static_cast< DWORD_PTR >( 1 ) << ( hardware_thread_index % ( sizeof( DWORD_PTR ) * 8 ) ) );
+#elif defined( __linux__ )
+    cpu_set_t cpu_set;
+    CPU_ZERO( &cpu_set );
+    CPU_SET( hardware_thread_index % CPU_SETSIZE, &cpu_set );
+    pthread_setaffinity_np( thread.native_handle(), sizeof( cpu_set ), &cpu_set );
+#else
+    (void)thread;
+    (void)hardware_thread_index;
+#endif
+}
+
+CTaskPool* CreateTaskPool( unsigned int thread_count, bool pin_threads )
+{
+    CTaskPool* pool = new CTaskPool();
+    pool->IsRunning = true;
+    pool->NextWorkerIndex = 0;
+    pool->QueuedTaskCount = 0;
+    pool->SleepingThreadCount = 0;
+    pool->WaitingTaskCount = 0;
+
+    const unsigned int hardware_thread_count = std::thread::hardware_concurrency();
+    if ( thread_count == 0 )
+    {
+        thread_count = hardware_thread_count > 1 ? hardware_thread_count - 1 : 1;
+    }
+
+    pool->Workers.reset( new CTaskPool::SWorker[ thread_count ] );
+    pool->WorkerCount = thread_count;
+    for ( unsigned int i = 0; i < thread_count; ++i )
+    {
+        pool->Threads.push_back( std::thread( WorkerThread, pool, i ) );
+        if ( pin_threads && hardware_thread_count > 1 )
+        {
+            PinThread( pool->Threads.back(), ( i + 1 ) % hardware_thread_count );
+        }
+    }
+
+    return pool;
+}
+
+void DestroyTaskPool( CTaskPool* pool )
+{
+    {
+        std::lock_guard<std::mutex> lock( pool->SleepMutex );
+        pool->IsRunning = false;
+    }
+    pool->TaskAvailable.notify_all();
+
+    for ( std::thread& thread : pool->Threads )
+    {
+        thread.join();
+    }
+
+    assert( pool->WaitingTasks.empty() );
+    delete pool;
+}
+
+void SubmitTask( CTaskPool* pool, STaskCounter* counter, std::function<void()> function )
+{
+    if ( pool == nullptr )
+    {
+        function();
+        return;
+    }
+
+    if ( counter != nullptr )
+    {
+        counter->Count.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    CTaskPool::STask task = { std::move( function ), counter };
+    PushTask( pool, std::move( task ) );
+}
+
+void SubmitDependentTask( CTaskPool* pool, STaskCounter* counter, const STaskCounter* dependency, std::function<void()> function )
+{
+    if ( pool == nullptr )
+    {
+        // Inline tasks are done as soon as they are submitted
+        assert( dependency->Count.load() == 0 );
+        function();
+        return;
+    }
+
+    if ( counter != nullptr )
+    {
+        counter->Count.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    CTaskPool::STask task = { std::move( function ), counter };
+    {
+        // The last task of the dependency takes it to zero under the same lock, so either this sees zero or that
+        // task releases the waiting tasks
+        std::lock_guard<std::mutex> lock( pool->WaitingMutex );
+        pool->WaitingTaskCount.fetch_add( 1 );
+        if ( dependency->Count.load() > 0 )
+        {
+            pool->WaitingTasks.emplace( dependency, std::move( task ) );
+            return;
+        }
+        pool->WaitingTaskCount.fetch_sub( 1 );
+    }
+    PushTask( pool, std::move( task ) );
+}
+
+void WaitForTasks( CTaskPool* pool, STaskCounter* counter )
+{
+    if ( pool == nullptr )
+        return;
+
+    // Help out with queued tasks instead of blocking, which also makes it safe to wait inside a task
+    while ( counter->Count.load( std::memory_order_acquire ) > 0 )
+    {
+        CTaskPool::STask task;
+        if ( PopTask( pool, &task ) )
+        {
+            RunTask( pool, task );
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <assert.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct STaskCounter
+{
+    std::atomic<unsigned int>   Count;
+
+    STaskCounter() : Count( 0 ) {}
+};
+
+class CTaskPool
+{
+public:
+    struct STask
+    {
+        std::function<void()>   Function;
+        STaskCounter*           Counter;
+    };
+
+    // Each worker runs its newest task first and other threads steal its oldest
+    struct SWorker
+    {
+        std::deque<STask>       Tasks;
+        std::mutex              Mutex;
+    };
+
+    std::vector<std::thread>    Threads;
+    std::unique_ptr<SWorker[]>  Workers;
+    unsigned int                WorkerCount;
+    std::atomic<unsigned int>   NextWorkerIndex;
+
+    std::atomic<unsigned int>   QueuedTaskCount;
+    std::atomic<unsigned int>   SleepingThreadCount;
+    std::mutex                  SleepMutex;
+    std::condition_variable     TaskAvailable;
+    bool                        IsRunning;
+
+    // Tasks that are queued once the counter they depend on reaches zero
+    std::unordered_multimap<const STaskCounter*, STask> WaitingTasks;
+    std::atomic<unsigned int>   WaitingTaskCount;
+    std::mutex                  WaitingMutex;
+};
+
+// A thread count of 0 creates one worker per hardware thread except the calling thread. Pinned workers are bound
+// to one hardware thread each, starting after the first one which is left to the calling thread.
+CTaskPool* CreateTaskPool( unsigned int thread_count, bool pin_threads );
+void DestroyTaskPool( CTaskPool* pool );
+
+// Tasks run inline on the calling thread when the pool is null
+void SubmitTask( CTaskPool* pool, STaskCounter* counter, std::function<void()> function );
+// The task is queued once the dependency reaches zero, so the tasks of the dependency must be submitted first
+void SubmitDependentTask( CTaskPool* pool, STaskCounter* counter, const STaskCounter* dependency, std::function<void()> function );
+void WaitForTasks( CTaskPool* pool, STaskCounter* counter );
+
+// Calls function( begin, end ) for batches of the range. The function is taken as is instead of as a std::function,
+// so running inline never allocates, and only the batches handed to the pool wrap a reference to it.
+template< typename TFunction >
+void ParallelFor( CTaskPool* pool, unsigned int count, unsigned int batch_size, const TFunction& function )
+{
+    assert( batch_size > 0 );
+
+    if ( pool == nullptr || count <= batch_size )
+    {
+        function( 0, count );
+        return;
+    }
+
+    // The calling thread takes the first batch itself, the others go to the pool
+    STaskCounter counter;
+    for ( unsigned int begin = batch_size; begin < count; begin += batch_size )
+    {
+        unsigned int end = begin + batch_size < count ? begin + batch_size : count;
+        SubmitTask( pool, &counter, [ &function, begin, end ]() { function( begin, end ); } );
+    }
+    function( 0, batch_size );
+    WaitForTasks( pool, &counter );
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "TaskPool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static const unsigned int OVERHEAD_TASK_COUNT = 100000;
+static const unsigned int DEPENDENCY_CHAIN_LENGTH = 10000;
+static const unsigned int SCALING_ELEMENT_COUNT = 1 << 24;
+static const unsigned int SCALING_BATCH_SIZE = 1 << 14;
+static const unsigned int REPEAT_COUNT = 5;
+
+double GetElapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+// Submits empty tasks from the calling thread and waits for them
+double MeasureTaskOverhead( CTaskPool* pool )
+{
+    double best_seconds = 1e9;
+    for ( unsigned int repeat = 0; repeat < REPEAT_COUNT; ++repeat )
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        STaskCounter counter;
+        for ( unsigned int i = 0; i < OVERHEAD_TASK_COUNT; ++i )
+        {
+            SubmitTask( pool, &counter, []() {} );
+        }
+        WaitForTasks( pool, &counter );
+        best_seconds = std::min( best_seconds, GetElapsedSeconds( start ) );
+    }
+    return best_seconds / OVERHEAD_TASK_COUNT;
+}
+
+// Every task depends on the previous one, so this measures the latency from a counter reaching zero until the
+// task waiting on it runs
+double MeasureDependencyLatency( CTaskPool* pool )
+{
+    double best_seconds = 1e9;
+    for ( unsigned int repeat = 0; repeat < REPEAT_COUNT; ++repeat )
+    {
+        std::vector<STaskCounter> counters( DEPENDENCY_CHAIN_LENGTH );
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        SubmitTask( pool, &counters[ 0 ], []() {} );
+        for ( unsigned int i = 1; i < DEPENDENCY_CHAIN_LENGTH; ++i )
+        {
+            SubmitDependentTask( pool, &counters[ i ], &counters[ i - 1 ], []() {} );
+        }
+        WaitForTasks( pool, &counters.back() );
+        best_seconds = std::min( best_seconds, GetElapsedSeconds( start ) );
+    }
+    return best_seconds / DEPENDENCY_CHAIN_LENGTH;
+}
+
+double MeasureParallelFor( CTaskPool* pool, std::vector<float>& data )
+{
+    double best_seconds = 1e9;
+    for ( unsigned int repeat = 0; repeat < REPEAT_COUNT; ++repeat )
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ParallelFor( pool, static_cast< unsigned int >( data.size() ), SCALING_BATCH_SIZE, [ &data ]( unsigned int begin, unsigned int end )
+        {
+            for ( unsigned int i = begin; i < end; ++i )
+            {
+                data[ i ] = sqrtf( data[ i ] * 0.5f + 1.0f ) * sinf( data[ i ] );
+            }
+        } );
+        best_seconds = std::min( best_seconds, GetElapsedSeconds( start ) );
+    }
+    return best_seconds;
+}
+
+int main( int argc, char** argv )
+{
+    bool pin_threads = false;
+    unsigned int max_thread_count = std::max( std::thread::hardware_concurrency(), 1u );
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[ i ], "-pin" ) == 0 )
+        {
+            pin_threads = true;
+        }
+        else if ( strcmp( argv[ i ], "-threads" ) == 0 && i + 1 < argc )
+        {
+            max_thread_count = std::max( static_cast< unsigned int >( atoi( argv[ ++i ] ) ), 1u );
+        }
+        else
+        {
+            printf( "Usage: %s [-threads <max count>] [-pin]\n", argv[ 0 ] );
+            printf( "Measures the task overhead, the dependency latency and the parallel for scaling of the task pool\n" );
+            printf( "The thread count doubles up to the maximum, which defaults to the number of hardware threads\n" );
+            return 1;
+        }
+    }
+
+    std::vector<float> data( SCALING_ELEMENT_COUNT, 1.0f );
+
+    printf( "%8s %16s %20s %18s %8s\n", "threads", "task overhead ns", "dependency latency ns", "parallel for ms", "speedup" );
+    double single_thread_seconds = 0.0;
+    for ( unsigned int thread_count = 1; ; thread_count = std::min( thread_count * 2, max_thread_count ) )
+    {
+        // The calling thread works too, so a single thread needs no pool at all
+        CTaskPool* pool = thread_count > 1 ? CreateTaskPool( thread_count - 1, pin_threads ) : nullptr;
+
+        const double overhead_seconds = MeasureTaskOverhead( pool );
+        const double latency_seconds = MeasureDependencyLatency( pool );
+        const double parallel_for_seconds = MeasureParallelFor( pool, data );
+        if ( thread_count == 1 )
+        {
+            single_thread_seconds = parallel_for_seconds;
+        }
+
+        printf( "%8u %16.1f %20.1f %18.3f %8.2f\n", thread_count, overhead_seconds * 1e9, latency_seconds * 1e9, parallel_for_seconds * 1e3, single_thread_seconds / parallel_for_seconds );
+
+        if ( pool != nullptr )
+        {
+            DestroyTaskPool( pool );
+        }
+        if ( thread_count == max_thread_count )
+            break;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "TriangleFrames.h"
+#include "TriangleFramesKernel.h"
+#include "SimdLanes.h"
+
+#include <assert.h>
+#include <math.h>
+
+#if defined( SIMD_LANES_X86 ) && defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+static const unsigned int TRIANGLE_FRAMES_ALIGNMENT = 16;
+
+#ifdef SIMD_LANES_X86
+// Compiled with AVX2 enabled in its own translation unit
+unsigned int CalculateTriangleFramesAVX2( ETriangleCornerWeighting corner_weighting, const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames );
+
+bool IsAVX2Supported()
+{
+#ifdef _MSC_VER
+    int info[ 4 ];
+    __cpuid( info, 0 );
+    if ( info[ 0 ] < 7 )
+        return false;
+
+    // AVX2 also needs the operating system to save the YMM registers
+    __cpuid( info, 1 );
+    const bool has_avx = ( info[ 2 ] & ( 1 << 28 ) ) != 0;
+    const bool has_osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+    if ( !has_avx || !has_osxsave || ( _xgetbv( 0 ) & 6 ) != 6 )
+        return false;
+
+    __cpuidex( info, 7, 0 );
+    return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" ) != 0;
+#endif
+}
+#endif
+
+ETriangleKernel GetSupportedTriangleKernel()
+{
+#ifdef SIMD_LANES_X86
+    return IsAVX2Supported() ? TRIANGLE_KERNEL_AVX2 : TRIANGLE_KERNEL_SSE;
+#else
+    return TRIANGLE_KERNEL_SCALAR;
+#endif
+}
+
+static ETriangleKernel g_TriangleKernel = GetSupportedTriangleKernel();
+
+ETriangleKernel GetTriangleKernel()
+{
+    return g_TriangleKernel;
+}
+
+void SetTriangleKernel( ETriangleKernel kernel )
+{
+    // Fall back to the widest supported kernel
+    const ETriangleKernel supported_kernel = GetSupportedTriangleKernel();
+    g_TriangleKernel = kernel < supported_kernel ? kernel : supported_kernel;
+}
+
+const char* GetTriangleKernelName( ETriangleKernel kernel )
+{
+    static const char* TRIANGLE_KERNEL_NAMES[ TRIANGLE_KERNEL_COUNT ] = { "scalar", "sse", "avx2" };
+    return TRIANGLE_KERNEL_NAMES[ kernel ];
+}
+
+const char* GetTriangleCornerWeightingName( ETriangleCornerWeighting corner_weighting )
+{
+    static const char* TRIANGLE_CORNER_WEIGHTING_NAMES[ TRIANGLE_CORNER_WEIGHTING_COUNT ] = { "angle area", "fast angle area", "area", "uniform" };
+    return TRIANGLE_CORNER_WEIGHTING_NAMES[ corner_weighting ];
+}
+
+size_t CalculateTriangleFramesSize( unsigned int triangle_count )
+{
+    const size_t stride = ( triangle_count + TRIANGLE_FRAMES_ALIGNMENT - 1 ) & ~static_cast< size_t >( TRIANGLE_FRAMES_ALIGNMENT - 1 );
+    return stride * TRIANGLE_FRAME_STREAM_COUNT * sizeof( float );
+}
+
+void InitializeTriangleFrames( STriangleFrames& frames, unsigned int triangle_count, float* data )
+{
+    frames.TriangleCount = triangle_count;
+    frames.Stride = ( triangle_count + TRIANGLE_FRAMES_ALIGNMENT - 1 ) & ~( TRIANGLE_FRAMES_ALIGNMENT - 1 );
+    frames.Data = data;
+}
+
+void CalculateTriangleUVs( const unsigned int* indices, const float* texture_coords, unsigned int triangle_begin, unsigned int triangle_end, float* triangle_uvs, unsigned int triangle_uv_stride )
+{
+    for ( unsigned int i = triangle_begin; i < triangle_end; ++i )
+    {
+        const float* uv0 = texture_coords + indices[ i * 3 + 0 ] * 2;
+        const float* uv1 = texture_coords + indices[ i * 3 + 1 ] * 2;
+        const float* uv2 = texture_coords + indices[ i * 3 + 2 ] * 2;
+
+        const float u0x = uv1[ 0 ] - uv0[ 0 ];
+        const float u0y = uv1[ 1 ] - uv0[ 1 ];
+        const float u1x = uv2[ 0 ] - uv0[ 0 ];
+        const float u1y = uv2[ 1 ] - uv0[ 1 ];
+
+        // Same operations as the triangle kernels used to perform per frame
+        const float uv_area = u0x * u1y - u0y * u1x;
+        const bool has_uv_area = uv_area != 0;
+        triangle_uvs[ TRIANGLE_UV_S0 * triangle_uv_stride + i ] = has_uv_area ? ( 0.0f - u1x ) / uv_area : 0.0f;
+        triangle_uvs[ TRIANGLE_UV_S1 * triangle_uv_stride + i ] = has_uv_area ? u1y / uv_area : 0.0f;
+        triangle_uvs[ TRIANGLE_UV_T0 * triangle_uv_stride + i ] = has_uv_area ? u0x / uv_area : 0.0f;
+        triangle_uvs[ TRIANGLE_UV_T1 * triangle_uv_stride + i ] = has_uv_area ? ( 0.0f - u0y ) / uv_area : 0.0f;
+        triangle_uvs[ TRIANGLE_UV_MASK * triangle_uv_stride + i ] = has_uv_area ? 1.0f : 0.0f;
+    }
+}
+
+void CalculateTriangleFrames( ETriangleKernel kernel, ETriangleCornerWeighting corner_weighting, const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames )
+{
+    assert( triangle_end <= frames.TriangleCount );
+
+    unsigned int i = triangle_begin;
+#ifdef SIMD_LANES_X86
+    if ( kernel == TRIANGLE_KERNEL_AVX2 )
+    {
+        i = CalculateTriangleFramesAVX2( corner_weighting, indices, positions, triangle_uvs, triangle_uv_stride, i, triangle_end, frames );
+    }
+    if ( kernel >= TRIANGLE_KERNEL_SSE )
+    {
+        i = STriangleFramesKernel<SSseLanes>::Run( corner_weighting, indices, positions, triangle_uvs, triangle_uv_stride, i, triangle_end, frames );
+    }
+#endif
+    STriangleFramesKernel<SScalarLanes>::Run( corner_weighting, indices, positions, triangle_uvs, triangle_uv_stride, i, triangle_end, frames );
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+
+enum ETriangleKernel
+{
+    TRIANGLE_KERNEL_SCALAR = 0,
+    TRIANGLE_KERNEL_SSE,
+    TRIANGLE_KERNEL_AVX2,
+    TRIANGLE_KERNEL_COUNT
+};
+
+// How the triangle frames are weighted at each corner when gathered into the vertices. The angle times area
+// weighting is the exact one used for baking. The fast variant uses a cubic acos with an absolute error below
+// 7e-5 radians for two corners and gives the third corner the rest of pi, so its angles are off by at most
+// 1.4e-4 radians. The area and uniform weightings need no angles at all.
+enum ETriangleCornerWeighting
+{
+    TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA = 0,
+    TRIANGLE_CORNER_WEIGHTING_FAST_ANGLE_AREA,
+    TRIANGLE_CORNER_WEIGHTING_AREA,
+    TRIANGLE_CORNER_WEIGHTING_UNIFORM,
+    TRIANGLE_CORNER_WEIGHTING_COUNT
+};
+
+enum ETriangleFrameStream
+{
+    TRIANGLE_FRAME_NORMAL_X = 0,
+    TRIANGLE_FRAME_NORMAL_Y,
+    TRIANGLE_FRAME_NORMAL_Z,
+    TRIANGLE_FRAME_TANGENT_X,
+    TRIANGLE_FRAME_TANGENT_Y,
+    TRIANGLE_FRAME_TANGENT_Z,
+    TRIANGLE_FRAME_BITANGENT_X,
+    TRIANGLE_FRAME_BITANGENT_Y,
+    TRIANGLE_FRAME_BITANGENT_Z,
+    TRIANGLE_FRAME_CORNER_WEIGHT_0,
+    TRIANGLE_FRAME_CORNER_WEIGHT_1,
+    TRIANGLE_FRAME_CORNER_WEIGHT_2,
+    TRIANGLE_FRAME_GRADIENT_0_X,
+    TRIANGLE_FRAME_GRADIENT_0_Y,
+    TRIANGLE_FRAME_GRADIENT_0_Z,
+    TRIANGLE_FRAME_GRADIENT_1_X,
+    TRIANGLE_FRAME_GRADIENT_1_Y,
+    TRIANGLE_FRAME_GRADIENT_1_Z,
+    TRIANGLE_FRAME_STREAM_COUNT
+};
+
+// Rest pose UV terms of the tangent and bitangent per triangle, stored as one stream per term. Triangles without
+// UV area have a mask of 0 and coefficients of 0, the others a mask of 1.
+enum ETriangleUVStream
+{
+    TRIANGLE_UV_S0 = 0,
+    TRIANGLE_UV_S1,
+    TRIANGLE_UV_T0,
+    TRIANGLE_UV_T1,
+    TRIANGLE_UV_MASK,
+    TRIANGLE_UV_STREAM_COUNT
+};
+
+// Per triangle data shared by the gather passes, stored as one stream per component. The normal is the
+// unnormalized cross product of the edges, and the normal, tangent and bitangent are zero for triangles
+// without UV area. The corner weights are the wedge angles times the area. Weight gradients are the first
+// two rows of the inverse of the matrix with the edges and the normal as columns.
+struct STriangleFrames
+{
+    unsigned int    TriangleCount;
+    unsigned int    Stride;
+    float*          Data;
+};
+
+// Every kernel performs the same IEEE operations in the same order, so the frames are bit-identical
+// regardless of the kernel and of how the triangles are split into ranges
+ETriangleKernel GetTriangleKernel();
+void SetTriangleKernel( ETriangleKernel kernel );
+const char* GetTriangleKernelName( ETriangleKernel kernel );
+const char* GetTriangleCornerWeightingName( ETriangleCornerWeighting corner_weighting );
+
+size_t CalculateTriangleFramesSize( unsigned int triangle_count );
+void InitializeTriangleFrames( STriangleFrames& frames, unsigned int triangle_count, float* data );
+
+inline float* GetTriangleFrameStream( const STriangleFrames& frames, ETriangleFrameStream stream )
+{
+    return frames.Data + stream * frames.Stride;
+}
+
+// Indices are relative to the sub mesh and texture coordinates are float2 per vertex. Stream s of triangle i is
+// written to triangle_uvs[ s * triangle_uv_stride + i ].
+void CalculateTriangleUVs( const unsigned int* indices, const float* texture_coords, unsigned int triangle_begin, unsigned int triangle_end, float* triangle_uvs, unsigned int triangle_uv_stride );
+
+// Indices are relative to the sub mesh, positions are float3 per vertex and the triangle UVs start at the first
+// triangle of the sub mesh
+void CalculateTriangleFrames( ETriangleKernel kernel, ETriangleCornerWeighting corner_weighting, const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames );
\ No newline at end of file
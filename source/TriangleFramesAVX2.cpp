@@ -0,0 +1,38 @@
+#include "TriangleFrames.h"
+#include "TriangleFramesKernel.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+
+// This file is compiled with AVX2 enabled. It must not include anything with inline functions that other
+// translation units use too, since the linker could pick the AVX2 copy for machines without AVX2.
+
+struct SAVX2Lanes
+{
+    typedef __m256 Vector;
+    typedef __m256 Mask;
+    static const unsigned int WIDTH = 8;
+
+    static Vector Load( const float* data ) { return _mm256_loadu_ps( data ); }
+    static void Store( float* data, Vector a ) { _mm256_storeu_ps( data, a ); }
+    static Vector Set( float a ) { return _mm256_set1_ps( a ); }
+    static Vector Add( Vector a, Vector b ) { return _mm256_add_ps( a, b ); }
+    static Vector Sub( Vector a, Vector b ) { return _mm256_sub_ps( a, b ); }
+    static Vector Mul( Vector a, Vector b ) { return _mm256_mul_ps( a, b ); }
+    static Vector Div( Vector a, Vector b ) { return _mm256_div_ps( a, b ); }
+    static Vector Sqrt( Vector a ) { return _mm256_sqrt_ps( a ); }
+    static Vector Abs( Vector a ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a ); }
+    static Vector Min( Vector a, Vector b ) { return _mm256_min_ps( a, b ); }
+    static Vector Max( Vector a, Vector b ) { return _mm256_max_ps( a, b ); }
+    static Mask Greater( Vector a, Vector b ) { return _mm256_cmp_ps( a, b, _CMP_GT_OQ ); }
+    static Mask GreaterEqual( Vector a, Vector b ) { return _mm256_cmp_ps( a, b, _CMP_GE_OQ ); }
+    static Vector Select( Mask mask, Vector a, Vector b ) { return _mm256_blendv_ps( b, a, mask ); }
+};
+
+unsigned int CalculateTriangleFramesAVX2( ETriangleCornerWeighting corner_weighting, const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames )
+{
+    unsigned int i = STriangleFramesKernel<SAVX2Lanes>::Run( corner_weighting, indices, positions, triangle_uvs, triangle_uv_stride, triangle_begin, triangle_end, frames );
+    _mm256_zeroupper();
+    return i;
+}
+#endif
\ No newline at end of file
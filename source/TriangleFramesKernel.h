@@ -0,0 +1,243 @@
+#pragma once
+
+#include "TriangleFrames.h"
+
+// Triangle frame kernel written once against a lane type, which provides Vector and Mask types, a WIDTH and
+// the arithmetic below. Only correctly rounded operations are used, never fused multiply-add or reciprocal
+// estimates, so every lane type produces the same bits as the scalar one.
+//
+// Every lane type must be distinct, because a translation unit may be compiled for a wider instruction set.
+
+template< ETriangleCornerWeighting TCornerWeighting >
+struct SCornerWeightingTag
+{
+};
+
+template< typename TLanes >
+struct STriangleFramesKernel
+{
+    typedef typename TLanes::Vector V;
+    typedef typename TLanes::Mask M;
+
+    struct SVector3
+    {
+        V x, y, z;
+    };
+
+    static SVector3 Subtract( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Sub( a.x, b.x ), TLanes::Sub( a.y, b.y ), TLanes::Sub( a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Add( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Add( a.x, b.x ), TLanes::Add( a.y, b.y ), TLanes::Add( a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Scale( const SVector3& a, V s )
+    {
+        SVector3 result = { TLanes::Mul( a.x, s ), TLanes::Mul( a.y, s ), TLanes::Mul( a.z, s ) };
+        return result;
+    }
+    static SVector3 Divide( const SVector3& a, V s )
+    {
+        SVector3 result = { TLanes::Div( a.x, s ), TLanes::Div( a.y, s ), TLanes::Div( a.z, s ) };
+        return result;
+    }
+    static SVector3 Cross( const SVector3& a, const SVector3& b )
+    {
+        SVector3 result =
+        {
+            TLanes::Sub( TLanes::Mul( a.y, b.z ), TLanes::Mul( a.z, b.y ) ),
+            TLanes::Sub( TLanes::Mul( a.z, b.x ), TLanes::Mul( a.x, b.z ) ),
+            TLanes::Sub( TLanes::Mul( a.x, b.y ), TLanes::Mul( a.y, b.x ) )
+        };
+        return result;
+    }
+    static V Dot( const SVector3& a, const SVector3& b )
+    {
+        return TLanes::Add( TLanes::Add( TLanes::Mul( a.x, b.x ), TLanes::Mul( a.y, b.y ) ), TLanes::Mul( a.z, b.z ) );
+    }
+    static SVector3 Select( M mask, const SVector3& a, const SVector3& b )
+    {
+        SVector3 result = { TLanes::Select( mask, a.x, b.x ), TLanes::Select( mask, a.y, b.y ), TLanes::Select( mask, a.z, b.z ) };
+        return result;
+    }
+    static SVector3 Normalize( const SVector3& a )
+    {
+        V length = TLanes::Sqrt( Dot( a, a ) );
+        SVector3 zero = { TLanes::Set( 0 ), TLanes::Set( 0 ), TLanes::Set( 0 ) };
+        return Select( TLanes::Greater( length, TLanes::Set( 0 ) ), Divide( a, length ), zero );
+    }
+
+    // Same 7th degree minimax polynomial as XMScalarACos
+    static V ACos( V x )
+    {
+        M non_negative = TLanes::GreaterEqual( x, TLanes::Set( 0 ) );
+        V a = TLanes::Abs( x );
+        V root = TLanes::Sqrt( TLanes::Max( TLanes::Sub( TLanes::Set( 1 ), a ), TLanes::Set( 0 ) ) );
+
+        V result = TLanes::Set( -0.0012624911f );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 0.0066700901f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( -0.0170881256f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 0.0308918810f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( -0.0501743046f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 0.0889789874f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( -0.2145988016f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 1.5707963050f ) );
+        result = TLanes::Mul( result, root );
+
+        return TLanes::Select( non_negative, result, TLanes::Sub( TLanes::Set( 3.141592654f ), result ) );
+    }
+    // Same cubic approximation as XMScalarACosEst
+    static V ACosEst( V x )
+    {
+        M non_negative = TLanes::GreaterEqual( x, TLanes::Set( 0 ) );
+        V a = TLanes::Abs( x );
+        V root = TLanes::Sqrt( TLanes::Max( TLanes::Sub( TLanes::Set( 1 ), a ), TLanes::Set( 0 ) ) );
+
+        V result = TLanes::Set( -0.0187293f );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 0.0742610f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( -0.2121144f ) );
+        result = TLanes::Add( TLanes::Mul( result, a ), TLanes::Set( 1.5707288f ) );
+        result = TLanes::Mul( result, root );
+
+        return TLanes::Select( non_negative, result, TLanes::Sub( TLanes::Set( 3.141592654f ), result ) );
+    }
+    static V CosAngleBetweenVectors( const SVector3& a, const SVector3& b )
+    {
+        V cos_angle = TLanes::Div( Dot( a, b ), TLanes::Sqrt( TLanes::Mul( Dot( a, a ), Dot( b, b ) ) ) );
+        return TLanes::Min( TLanes::Max( cos_angle, TLanes::Set( -1 ) ), TLanes::Set( 1 ) );
+    }
+
+    // One overload per corner weighting, picked at compile time
+    static void CalculateCornerWeights( SCornerWeightingTag<TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA>, const SVector3* p, V area, V* weights )
+    {
+        weights[ 0 ] = TLanes::Mul( ACos( CosAngleBetweenVectors( Subtract( p[ 1 ], p[ 0 ] ), Subtract( p[ 2 ], p[ 0 ] ) ) ), area );
+        weights[ 1 ] = TLanes::Mul( ACos( CosAngleBetweenVectors( Subtract( p[ 2 ], p[ 1 ] ), Subtract( p[ 0 ], p[ 1 ] ) ) ), area );
+        weights[ 2 ] = TLanes::Mul( ACos( CosAngleBetweenVectors( Subtract( p[ 0 ], p[ 2 ] ), Subtract( p[ 1 ], p[ 2 ] ) ) ), area );
+    }
+    static void CalculateCornerWeights( SCornerWeightingTag<TRIANGLE_CORNER_WEIGHTING_FAST_ANGLE_AREA>, const SVector3* p, V area, V* weights )
+    {
+        V angle_0 = ACosEst( CosAngleBetweenVectors( Subtract( p[ 1 ], p[ 0 ] ), Subtract( p[ 2 ], p[ 0 ] ) ) );
+        V angle_1 = ACosEst( CosAngleBetweenVectors( Subtract( p[ 2 ], p[ 1 ] ), Subtract( p[ 0 ], p[ 1 ] ) ) );
+        V angle_2 = TLanes::Max( TLanes::Sub( TLanes::Sub( TLanes::Set( 3.141592654f ), angle_0 ), angle_1 ), TLanes::Set( 0 ) );
+        weights[ 0 ] = TLanes::Mul( angle_0, area );
+        weights[ 1 ] = TLanes::Mul( angle_1, area );
+        weights[ 2 ] = TLanes::Mul( angle_2, area );
+    }
+    static void CalculateCornerWeights( SCornerWeightingTag<TRIANGLE_CORNER_WEIGHTING_AREA>, const SVector3*, V area, V* weights )
+    {
+        weights[ 0 ] = area;
+        weights[ 1 ] = area;
+        weights[ 2 ] = area;
+    }
+    static void CalculateCornerWeights( SCornerWeightingTag<TRIANGLE_CORNER_WEIGHTING_UNIFORM>, const SVector3*, V, V* weights )
+    {
+        weights[ 0 ] = TLanes::Set( 1 );
+        weights[ 1 ] = TLanes::Set( 1 );
+        weights[ 2 ] = TLanes::Set( 1 );
+    }
+
+    static SVector3 LoadPositions( const unsigned int* indices, const float* positions, unsigned int triangle_index, unsigned int corner )
+    {
+        float px[ TLanes::WIDTH ], py[ TLanes::WIDTH ], pz[ TLanes::WIDTH ];
+        for ( unsigned int i = 0; i < TLanes::WIDTH; ++i )
+        {
+            const unsigned int index = indices[ ( triangle_index + i ) * 3 + corner ];
+            px[ i ] = positions[ index * 3 + 0 ];
+            py[ i ] = positions[ index * 3 + 1 ];
+            pz[ i ] = positions[ index * 3 + 2 ];
+        }
+        SVector3 position = { TLanes::Load( px ), TLanes::Load( py ), TLanes::Load( pz ) };
+        return position;
+    }
+    static V LoadUV( const float* triangle_uvs, unsigned int triangle_uv_stride, ETriangleUVStream stream, unsigned int triangle_index )
+    {
+        return TLanes::Load( triangle_uvs + stream * triangle_uv_stride + triangle_index );
+    }
+    static void Store( const STriangleFrames& frames, ETriangleFrameStream stream, unsigned int triangle_index, V value )
+    {
+        TLanes::Store( frames.Data + stream * frames.Stride + triangle_index, value );
+    }
+
+    // Processes whole groups of WIDTH triangles and returns where it stopped
+    template< ETriangleCornerWeighting TCornerWeighting >
+    static unsigned int Run( const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames )
+    {
+        unsigned int i = triangle_begin;
+        for ( ; i + TLanes::WIDTH <= triangle_end; i += TLanes::WIDTH )
+        {
+            SVector3 p[ 3 ];
+            p[ 0 ] = LoadPositions( indices, positions, i, 0 );
+            p[ 1 ] = LoadPositions( indices, positions, i, 1 );
+            p[ 2 ] = LoadPositions( indices, positions, i, 2 );
+
+            // Degenerate UV triangles have zero coefficients and are masked out below, without branching
+            M has_uv_area = TLanes::Greater( LoadUV( triangle_uvs, triangle_uv_stride, TRIANGLE_UV_MASK, i ), TLanes::Set( 0 ) );
+            V s0 = LoadUV( triangle_uvs, triangle_uv_stride, TRIANGLE_UV_S0, i );
+            V s1 = LoadUV( triangle_uvs, triangle_uv_stride, TRIANGLE_UV_S1, i );
+            V t0 = LoadUV( triangle_uvs, triangle_uv_stride, TRIANGLE_UV_T0, i );
+            V t1 = LoadUV( triangle_uvs, triangle_uv_stride, TRIANGLE_UV_T1, i );
+
+            SVector3 e0 = Subtract( p[ 1 ], p[ 0 ] );
+            SVector3 e1 = Subtract( p[ 2 ], p[ 0 ] );
+
+            SVector3 n = Cross( e1, e0 );
+            V area = TLanes::Sqrt( Dot( n, n ) );
+
+            SVector3 tangent = Normalize( Add( Scale( e0, s0 ), Scale( e1, t0 ) ) );
+            SVector3 bitangent = Normalize( Add( Scale( e0, s1 ), Scale( e1, t1 ) ) );
+
+            SVector3 zero = { TLanes::Set( 0 ), TLanes::Set( 0 ), TLanes::Set( 0 ) };
+            SVector3 normal = Select( has_uv_area, n, zero );
+            tangent = Select( has_uv_area, tangent, zero );
+            bitangent = Select( has_uv_area, bitangent, zero );
+
+            V w[ 3 ];
+            CalculateCornerWeights( SCornerWeightingTag<TCornerWeighting>(), p, area, w );
+
+            // Closed form inverse of the matrix with the columns e0, e1 and n
+            SVector3 c0 = Cross( e1, n );
+            SVector3 c1 = Cross( n, e0 );
+            V determinant = Dot( e0, c0 );
+            SVector3 g0 = Divide( c0, determinant );
+            SVector3 g1 = Divide( c1, determinant );
+
+            Store( frames, TRIANGLE_FRAME_NORMAL_X, i, normal.x );
+            Store( frames, TRIANGLE_FRAME_NORMAL_Y, i, normal.y );
+            Store( frames, TRIANGLE_FRAME_NORMAL_Z, i, normal.z );
+            Store( frames, TRIANGLE_FRAME_TANGENT_X, i, tangent.x );
+            Store( frames, TRIANGLE_FRAME_TANGENT_Y, i, tangent.y );
+            Store( frames, TRIANGLE_FRAME_TANGENT_Z, i, tangent.z );
+            Store( frames, TRIANGLE_FRAME_BITANGENT_X, i, bitangent.x );
+            Store( frames, TRIANGLE_FRAME_BITANGENT_Y, i, bitangent.y );
+            Store( frames, TRIANGLE_FRAME_BITANGENT_Z, i, bitangent.z );
+            Store( frames, TRIANGLE_FRAME_CORNER_WEIGHT_0, i, w[ 0 ] );
+            Store( frames, TRIANGLE_FRAME_CORNER_WEIGHT_1, i, w[ 1 ] );
+            Store( frames, TRIANGLE_FRAME_CORNER_WEIGHT_2, i, w[ 2 ] );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_0_X, i, g0.x );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_0_Y, i, g0.y );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_0_Z, i, g0.z );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_1_X, i, g1.x );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_1_Y, i, g1.y );
+            Store( frames, TRIANGLE_FRAME_GRADIENT_1_Z, i, g1.z );
+        }
+        return i;
+    }
+
+    static unsigned int Run( ETriangleCornerWeighting corner_weighting, const unsigned int* indices, const float* positions, const float* triangle_uvs, unsigned int triangle_uv_stride, unsigned int triangle_begin, unsigned int triangle_end, const STriangleFrames& frames )
+    {
+        switch ( corner_weighting )
+        {
+            case TRIANGLE_CORNER_WEIGHTING_FAST_ANGLE_AREA:
+                return Run<TRIANGLE_CORNER_WEIGHTING_FAST_ANGLE_AREA>( indices, positions, triangle_uvs, triangle_uv_stride, triangle_begin, triangle_end, frames );
+            case TRIANGLE_CORNER_WEIGHTING_AREA:
+                return Run<TRIANGLE_CORNER_WEIGHTING_AREA>( indices, positions, triangle_uvs, triangle_uv_stride, triangle_begin, triangle_end, frames );
+            case TRIANGLE_CORNER_WEIGHTING_UNIFORM:
+                return Run<TRIANGLE_CORNER_WEIGHTING_UNIFORM>( indices, positions, triangle_uvs, triangle_uv_stride, triangle_begin, triangle_end, frames );
+            default:
+                return Run<TRIANGLE_CORNER_WEIGHTING_ANGLE_AREA>( indices, positions, triangle_uvs, triangle_uv_stride, triangle_begin, triangle_end, frames );
+        }
+    }
+};
\ No newline at end of file